@@ -0,0 +1,113 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <bitset>
+#include "emulator.h"
+
+//a basic block compiled by chip8aot: runs the instructions in [start, end) straight through
+//and leaves PC at whichever successor it took
+struct AotBlock {
+    uint16_t start;
+    uint16_t end;
+    uint16_t length; //instructions
+    void (*run)(Emulator& e, MachineState& s);
+};
+
+//a ROM compiled by chip8aot, with the bytes it was compiled from (loaded at 0x200)
+struct AotProgram {
+    const char* name;
+    Profile profile; //the quirks the blocks were compiled for
+    const uint8_t* rom;
+    uint32_t size;
+    const AotBlock* blocks;
+    uint32_t count;
+};
+
+//address after skipping the instruction at pc, which is two words long if it is F000 NNNN
+inline uint16_t aotSkip(const MachineState& s, uint16_t pc){
+    return pc + ((s.memory[pc] == 0xF0 && s.memory[(uint16_t)(pc + 1)] == 0x00) ? 4 : 2);
+}
+
+//runs an Emulator on a compiled program: at a PC where a compiled block starts the block's
+//function runs, anywhere else (a computed BNNN target, code outside the ROM) the interpreter
+//steps. A write to bytes a block was compiled from switches off every block whose bytes no
+//longer match, until they match again, so self-modifying code falls back to interpreting
+class AotRunner {
+    private:
+        const AotProgram& program;
+        Emulator emu;
+        std::vector<const AotBlock*> entry; //compiled block starting at each address, null to interpret
+        std::bitset<MEMORYSIZE> covered; //bytes some block was compiled from
+        uint64_t compiledCount = 0, interpretedCount = 0;
+
+        //enable exactly the blocks whose bytes in memory are the ones they were compiled from
+        void revalidate(){
+            const MachineState& s = emu.machine();
+            for(uint32_t i = 0; i < program.count; i++){
+                const AotBlock& block = program.blocks[i];
+                bool same = memcmp(&s.memory[block.start], &program.rom[block.start - 0x200], block.end - block.start) == 0;
+                entry[block.start] = same ? &block : nullptr;
+            }
+        }
+
+    public:
+        AotRunner(const AotProgram& compiled, uint32_t seed): program(compiled), emu(seed, compiled.profile), entry(MEMORYSIZE){
+            for(uint32_t i = 0; i < program.count; i++){
+                for(uint32_t a = program.blocks[i].start; a < program.blocks[i].end; a++)
+                    covered[a] = true;
+            }
+            emu.load(program.rom, program.size);
+            emu.setCompiledCode(&covered);
+            revalidate();
+        }
+
+        AotRunner(const AotRunner&) = delete;
+        AotRunner& operator=(const AotRunner&) = delete;
+
+        //start over from a pristine state holding the same ROM
+        void reset(const MachineState& pristine, uint32_t seed){
+            emu.reset(pristine, seed);
+            emu.takeCompiledWrite();
+            revalidate();
+        }
+
+        //execute count instructions; a block longer than what is left is stepped by the
+        //interpreter, so frames end on exactly the same instruction as with Emulator::run
+        void run(uint64_t count){
+            MachineState& s = emu.machine();
+            uint64_t executed = 0;
+            while(executed < count){
+                const AotBlock* block = entry[s.PC];
+                if(block && block->length <= count - executed){
+                    block->run(emu, s);
+                    executed += block->length;
+                    compiledCount += block->length;
+                }
+                else {
+                    emu.step();
+                    executed++;
+                    interpretedCount++;
+                }
+                if(emu.takeCompiledWrite())
+                    revalidate();
+            }
+        }
+
+        //keys, timers and the display go through the emulator as usual
+        Emulator& emulator(){
+            return emu;
+        }
+
+        uint64_t compiledInstructions() const {
+            return compiledCount;
+        }
+
+        uint64_t interpretedInstructions() const {
+            return interpretedCount;
+        }
+};
+
+#endif
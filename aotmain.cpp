@@ -0,0 +1,72 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <memory>
+#include <cstring>
+#include "aot.h"
+#include "headless.h"
+using namespace std;
+
+//the program chip8aot generated, linked in next to this file
+extern const AotProgram aotProgram;
+
+//run frames frames of 60Hz timing, returns the seconds taken
+template<class Step>
+double timeFrames(Emulator& emu, uint32_t frames, Step step){
+    auto start = chrono::steady_clock::now();
+    for(uint32_t f = 0; f < frames; f++){
+        step(INSTFREQ/TIMERFREQ);
+        emu.decrementTimers();
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+//usage: NAME [--frames N] [--seed N]
+//runs the compiled program and the interpreter for the same frames and compares the final states
+int main(int argc, char* argv[]){
+    uint32_t frames = 3000;
+    uint32_t seed = 1;
+    for(int i = 1; i < argc; i++){
+        string arg = argv[i];
+        bool hasValue = i+1 < argc;
+        if(arg == "--frames" && hasValue){
+            if(!parseNumber(argv[++i], frames))
+                return 1;
+        }
+        else if(arg == "--seed" && hasValue){
+            if(!parseNumber(argv[++i], seed))
+                return 1;
+        }
+        else {
+            cerr << "usage: " << argv[0] << " [--frames N] [--seed N]" << endl;
+            return 1;
+        }
+    }
+
+    AotRunner compiled(aotProgram, seed);
+    Emulator interpreter(seed, aotProgram.profile);
+    if(!interpreter.load(aotProgram.rom, aotProgram.size))
+        return 1;
+
+    double aotTime = timeFrames(compiled.emulator(), frames, [&](uint64_t n){ compiled.run(n); });
+    double interpTime = timeFrames(interpreter, frames, [&](uint64_t n){ interpreter.run(n); });
+
+    uint64_t aotHash = hashDisplay(compiled.emulator().getDisplay());
+    uint64_t interpHash = hashDisplay(interpreter.getDisplay());
+    uint64_t total = compiled.compiledInstructions() + compiled.interpretedInstructions();
+    cout << aotProgram.name << ": " << frames << " frames" << endl;
+    cout << fixed << setprecision(3);
+    cout << "  compiled     " << aotTime*1000 << " ms, " << setprecision(1)
+        << (total ? 100.0*compiled.compiledInstructions()/total : 0) << "% of instructions in compiled blocks" << endl;
+    cout << setprecision(3) << "  interpreter  " << interpTime*1000 << " ms" << endl;
+    cout << hex << setfill('0') << "  display " << setw(16) << aotHash << " / " << setw(16) << interpHash << dec << endl;
+    unique_ptr<MachineState> aotState(new MachineState), interpState(new MachineState);
+    compiled.emulator().save(*aotState);
+    interpreter.save(*interpState);
+    if(aotHash != interpHash || memcmp(aotState.get(), interpState.get(), sizeof(MachineState))){
+        cerr << "Compiled and interpreted runs differ" << endl;
+        return 1;
+    }
+    return 0;
+}
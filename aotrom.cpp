@@ -0,0 +1,66 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include "checkmain.h"
+using namespace std;
+
+//each pass through the loop takes random skips, one of them over F000 NNNN, rewrites the
+//instruction right after its own store (to 6A00 and 6A01 by turns, so the compiled block comes
+//back every other pass), calls a subroutine ending in a skip and jumps through BNNN into the
+//middle of a run of adds; VX and NNN both pick register 2 so every jump quirk lands alike
+const vector<uint16_t> PROGRAM = {
+    0x6500, //200: V5 = 0, passes
+    0x7501, //202: V5 += 1
+    0xC00F, //204: V0 = rand & 15
+    0x3007, //206: skip if V0 == 7
+    0x7101, //208: V1 += 1
+    0x4003, //20A: skip unless V0 == 3
+    0xF000, //20C: I = 0x0ABC, both words skipped together
+    0x0ABC, //20E
+    0x5010, //210: skip if V0 == V1
+    0x7201, //212: V2 += 1
+    0x9010, //214: skip if V0 != V1
+    0x7301, //216: V3 += 1
+    0xE09E, //218: skip if key V0 is down, never
+    0x7401, //21A: V4 += 1
+    0x606A, //21C: V0 = 0x6A
+    0x8150, //21E: V1 = V5
+    0x6201, //220: V2 = 1
+    0x8122, //222: V1 &= V2
+    0xA228, //224: I = 0x228
+    0xF155, //226: store V0-V1 over 228
+    0x6A00, //228: VA = 0, or 1 once rewritten
+    0x8B54, //22A: VB += V5
+    0x2250, //22C: call 250
+    0x6003, //22E: V0 = 3
+    0x8052, //230: V0 &= V5
+    0x800E, //232: V0 <<= 1
+    0x8200, //234: V2 = V0
+    0xB240, //236: jump to 240 + V0
+    0x0000, 0x0000, 0x0000, 0x0000, //238: never reached
+    0x7C01, //240: VC += 1
+    0x7C02, //242: VC += 2
+    0x7C04, //244: VC += 4
+    0x7C08, //246: VC += 8
+    0x1202, //248: next pass
+    0x0000, 0x0000, 0x0000, //24A: never reached
+    0x3A01, //250: skip if VA == 1
+    0x7D01, //252: VD += 1
+    0x00EE  //254: return
+};
+
+//usage: chip8_aotrom FILE
+//writes the ROM the aot tests compile under each profile and run against the interpreter
+int main(int argc, char* argv[]){
+    if(argc != 2){
+        cerr << "usage: " << argv[0] << " FILE" << endl;
+        return 1;
+    }
+    vector<uint8_t> bytes = romBytes(PROGRAM);
+    ofstream file(argv[1], ios::binary);
+    if(!file.write((const char*)bytes.data(), bytes.size())){
+        cerr << "Failed to write " << argv[1] << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,151 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <atomic>
+#include <algorithm>
+
+//sound state the emu thread publishes at each frame boundary, all the beeper needs for one frame
+struct AudioFrame {
+    uint64_t time; //inputClock() when published
+    uint8_t sound; //sound timer, the beeper plays while it is nonzero
+    uint8_t pitch; //XO-CHIP pitch, the pattern plays at 4000*2^((pitch-64)/48) bits per second
+    uint8_t pattern[16]; //XO-CHIP 1-bit pattern buffer
+    bool loaded; //the program ran F002, so pattern plays as it is even if it is all zero
+};
+
+//lock-free single-producer single-consumer ring of frames from the emu thread to the audio
+//callback, the same scheme as InputQueue: a full ring drops the frame and counts it
+class AudioQueue {
+    private:
+        static const uint32_t CAPACITY = 16; //power of two
+        AudioFrame frames[CAPACITY];
+        alignas(64) std::atomic<uint32_t> head{0};
+        alignas(64) std::atomic<uint32_t> tail{0};
+        std::atomic<uint64_t> lost{0};
+
+    public:
+        bool push(const AudioFrame& frame){
+            uint32_t t = tail.load(std::memory_order_relaxed);
+            if(t - head.load(std::memory_order_acquire) == CAPACITY){
+                lost.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            frames[t % CAPACITY] = frame;
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool pop(AudioFrame& frame){
+            uint32_t h = head.load(std::memory_order_relaxed);
+            if(h == tail.load(std::memory_order_acquire))
+                return false;
+            frame = frames[h % CAPACITY];
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+
+        //frames waiting, as seen by the consumer
+        uint32_t pending() const {
+            return tail.load(std::memory_order_acquire) - head.load(std::memory_order_relaxed);
+        }
+
+        uint64_t dropped() const {
+            return lost.load(std::memory_order_relaxed);
+        }
+};
+
+//turns queued frames into 16 bit mono samples, one frame's worth (rate/60) at a time; runs on
+//the audio device's thread and never blocks. A program that never ran F002 gets 0xF0 repeated,
+//a plain square wave of 500Hz at the default pitch; one that loaded all zeros gets silence
+class AudioSynth {
+    private:
+        static const uint32_t MAXQUEUED = 3; //frames of backlog kept, older ones are skipped
+        static const int16_t VOLUME = 3000;
+        int rate;
+        double perFrame; //samples per 60Hz frame
+        double owed = 0; //samples still to play from the current frame
+        double phase = 0; //position in the 128 bit pattern
+        bool have = false; //a frame has been played, the synth isn't just starting
+        AudioFrame current = {};
+
+        //statistics, written by the audio thread only; read them once the device is closed
+        uint64_t played = 0, underruns = 0, skipped = 0;
+        double latencyTotal = 0, latencyMax = 0;
+
+        bool next(AudioQueue& queue, uint64_t now, double bufferDelay){
+            while(queue.pending() > MAXQUEUED && queue.pop(current))
+                skipped++;
+            if(!queue.pop(current)){
+                //nothing published in time: play silence rather than stretching the last frame
+                if(have)
+                    underruns++;
+                current.sound = 0;
+                return false;
+            }
+            if(!current.loaded)
+                memset(current.pattern, 0xF0, sizeof(current.pattern));
+            have = true;
+            played++;
+            double latency = (now > current.time ? (now - current.time)*1e-9 : 0) + bufferDelay;
+            latencyTotal += latency;
+            latencyMax = std::max(latencyMax, latency);
+            return true;
+        }
+
+    public:
+        AudioSynth(int sampleRate): rate(sampleRate), perFrame(sampleRate/60.0){}
+
+        //fill out with count samples; now is inputClock() and bufferDelay the seconds of audio
+        //the device holds ahead of what is being played
+        void fill(int16_t* out, int count, AudioQueue& queue, uint64_t now, double bufferDelay){
+            for(int i = 0; i < count; ){
+                if(owed < 1){
+                    next(queue, now, bufferDelay + (double)i/rate);
+                    owed += perFrame;
+                }
+                int run = std::min<int>(count - i, (int)owed);
+                owed -= run;
+                if(!current.sound){
+                    memset(out + i, 0, run*sizeof(int16_t));
+                    i += run;
+                    continue;
+                }
+                double step = 4000*std::pow(2.0, (current.pitch - 64)/48.0)/rate;
+                for(int end = i + run; i < end; i++){
+                    int bit = (int)phase;
+                    out[i] = (current.pattern[bit >> 3] >> (7 - (bit & 7)) & 1) ? VOLUME : -VOLUME;
+                    phase += step;
+                    if(phase >= 128)
+                        phase -= 128;
+                }
+            }
+        }
+
+        uint64_t framesPlayed() const {
+            return played;
+        }
+
+        //frames the device wanted before the emu thread had published them
+        uint64_t underrunCount() const {
+            return underruns;
+        }
+
+        //frames dropped to keep the backlog at MAXQUEUED, e.g. in turbo
+        uint64_t skippedCount() const {
+            return skipped;
+        }
+
+        //seconds from publish to the frame reaching the speaker
+        double latencyAverage() const {
+            return played ? latencyTotal/played : 0;
+        }
+
+        double latencyWorst() const {
+            return latencyMax;
+        }
+};
+
+#endif
@@ -0,0 +1,164 @@
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include "audio.h"
+#include "romcache.h"
+using namespace std;
+
+//a frame of the sound timer at pitch, with pattern's bytes as the XO-CHIP pattern loaded by
+//F002, or none loaded
+AudioFrame frame(uint8_t sound, uint8_t pitch, const uint8_t* pattern = nullptr){
+    AudioFrame f = {};
+    f.sound = sound;
+    f.pitch = pitch;
+    if(pattern)
+        memcpy(f.pattern, pattern, sizeof(f.pattern));
+    f.loaded = pattern != nullptr;
+    return f;
+}
+
+//the frame the frontend publishes for emu's state
+AudioFrame frame(const Emulator& emu){
+    AudioFrame f = {0, emu.soundTimer(), emu.audioPitch(), {}, emu.audioPatternLoaded()};
+    memcpy(f.pattern, emu.audioPattern(), sizeof(f.pattern));
+    return f;
+}
+
+//bit the pattern plays at sample i when every sample advances it by one
+bool patternBit(const uint8_t* pattern, int i){
+    int bit = i % 128;
+    return pattern[bit >> 3] >> (7 - (bit & 7)) & 1;
+}
+
+//prints what failed, returns 1 if it did
+uint32_t expect(bool ok, const char* what){
+    if(!ok)
+        cout << what << endl;
+    return ok ? 0 : 1;
+}
+
+//usage: chip8_audiocheck
+//runs AudioSynth on frames pushed to an AudioQueue by hand, with no audio device: the default
+//square wave and an XO-CHIP pattern, an all-zero pattern F002 loaded, silence while the sound timer is 0, frames skipped when the
+//backlog grows, underruns when none was published, and frames dropped from a full queue
+int main(){
+    uint32_t failed = 0;
+
+    //48kHz at the default pitch moves 1/12 bit per sample, so the 0xF0 square wave a program
+    //that never loaded a pattern gets is 48 samples high and 48 low: 500Hz. The phase is a
+    //double, so the sample on either side of an edge may round to the other level
+    {
+        AudioQueue queue;
+        AudioSynth synth(48000);
+        queue.push(frame(1, 64));
+        vector<int16_t> out(800);
+        synth.fill(out.data(), out.size(), queue, 0, 0);
+        bool square = true;
+        for(size_t i = 0; i < out.size(); i++){
+            if(i % 48 != 0 && i % 48 != 47)
+                square &= (out[i] > 0) == (i % 96 < 48);
+        }
+        failed += expect(square, "default pattern isn't a 500Hz square wave");
+        failed += expect(synth.framesPlayed() == 1 && synth.underrunCount() == 0 && synth.skippedCount() == 0,
+                         "one frame of square wave wasn't counted as one frame played");
+    }
+
+    //pitch 112 plays 8000 bits per second, one per sample at 8kHz, so the samples spell out the
+    //pattern and carry on through it across frames
+    {
+        const uint8_t pattern[16] = {0xAA, 0x0F, 0x33, 0x81, 0xFE, 0x01, 0x5C, 0xC5,
+                                     0x00, 0xFF, 0x12, 0x48, 0x7E, 0x99, 0x60, 0x06};
+        AudioQueue queue;
+        AudioSynth synth(8000);
+        for(int f = 0; f < 3; f++)
+            queue.push(frame(1, 112, pattern));
+        vector<int16_t> out(400);
+        synth.fill(out.data(), out.size(), queue, 0, 0);
+        bool matches = true;
+        for(size_t i = 0; i < out.size(); i++)
+            matches &= (out[i] > 0) == patternBit(pattern, i);
+        failed += expect(matches, "XO-CHIP pattern samples don't follow the pattern bits");
+        failed += expect(synth.framesPlayed() == 3, "three frames of pattern weren't all played");
+    }
+
+    //a program whose F002 loaded all zeros plays them, flat, not the default square wave it had
+    //before the F002 ran
+    {
+        const uint8_t program[] = {0xA3, 0x00,  //200: I = 0x300, zeros
+                                   0xF0, 0x02,  //202: load the pattern
+                                   0x12, 0x04}; //204: halt
+        shared_ptr<RomImage> rom = RomImage::fromBytes(program, sizeof(program));
+        Emulator emu(1, PROFILE_XOCHIP);
+        emu.reset(rom->pristine(), 1);
+        AudioQueue queue;
+        AudioSynth synth(48000);
+        vector<int16_t> before(800), after(800);
+        AudioFrame f = frame(emu);
+        f.sound = 1;
+        queue.push(f);
+        synth.fill(before.data(), before.size(), queue, 0, 0);
+        emu.run(2);
+        f = frame(emu);
+        f.sound = 1;
+        queue.push(f);
+        synth.fill(after.data(), after.size(), queue, 0, 0);
+        failed += expect(before[0] > 0 && before[50] < 0, "the pattern before F002 isn't the default square wave");
+        bool flat = true;
+        for(int16_t sample : after)
+            flat &= sample < 0;
+        failed += expect(emu.audioPatternLoaded() && flat, "an all-zero pattern loaded by F002 plays the default square wave");
+    }
+
+    //a frame with the sound timer at 0 is silent whatever its pattern, and so is the frame after
+    //it, which wasn't published in time and counts as an underrun
+    {
+        AudioQueue queue;
+        AudioSynth synth(48000);
+        queue.push(frame(1, 64));
+        queue.push(frame(0, 64));
+        vector<int16_t> out(3*800, 1);
+        synth.fill(out.data(), out.size(), queue, 0, 0);
+        bool silent = true;
+        for(size_t i = 800; i < out.size(); i++)
+            silent &= out[i] == 0;
+        failed += expect(silent, "sound timer 0 or a missing frame isn't silent");
+        failed += expect(synth.framesPlayed() == 2 && synth.underrunCount() == 1,
+                         "a missing frame wasn't counted as one underrun");
+    }
+
+    //no underrun before the first frame arrives: the synth is only starting
+    {
+        AudioQueue queue;
+        AudioSynth synth(48000);
+        vector<int16_t> out(2*800, 1);
+        synth.fill(out.data(), out.size(), queue, 0, 0);
+        failed += expect(out[0] == 0 && out.back() == 0, "an empty queue at start isn't silent");
+        failed += expect(synth.underrunCount() == 0 && synth.framesPlayed() == 0, "start-up counted as an underrun");
+    }
+
+    //a backlog of 6 frames skips the oldest 3 down to MAXQUEUED and plays the fourth
+    {
+        AudioQueue queue;
+        AudioSynth synth(48000);
+        for(int f = 0; f < 6; f++)
+            queue.push(frame(f == 3, 64));
+        vector<int16_t> out(800);
+        synth.fill(out.data(), out.size(), queue, 0, 0);
+        failed += expect(synth.skippedCount() == 3 && synth.framesPlayed() == 1 && queue.pending() == 2,
+                         "a backlog of 6 frames didn't skip 3");
+        failed += expect(out[0] > 0, "the frame after a skipped backlog wasn't the one played");
+    }
+
+    //a full queue turns the producer away and counts the frame
+    {
+        AudioQueue queue;
+        uint32_t accepted = 0;
+        for(int f = 0; f < 20; f++)
+            accepted += queue.push(frame(1, 64));
+        failed += expect(accepted == 16 && queue.dropped() == 4 && queue.pending() == 16,
+                         "a full queue didn't drop and count the frames past 16");
+    }
+
+    cout << (failed ? "audio: failed" : "audio: ok") << endl;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,422 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <random>
+#include <cstdio>
+#include "emulator.h"
+#include "headless.h"
+#include "romcache.h"
+#include "wide.h"
+#include "scaler.h"
+#include "checkmain.h"
+using namespace std;
+
+//program to benchmark: generated per opcode class or read from a ROM file
+struct BenchRom {
+    string name;
+    string path; //empty for generated programs
+    shared_ptr<const RomImage> image;
+};
+
+//dispatch engine under test, null decoder runs the block cache
+struct BenchDispatch {
+    string name;
+    Decoder decoder;
+};
+
+//ns/instruction over the repetitions of one rom and dispatch
+struct BenchResult {
+    double median, mean, stddev, best;
+};
+
+//generated program named name
+BenchRom synthetic(const string& name, const vector<uint8_t>& bytes){
+    return {name, "", RomImage::fromBytes(bytes.data(), bytes.size(), name)};
+}
+
+//tight loops that each exercise one class of opcode, jumping back to the loop start at the end
+vector<BenchRom> syntheticRoms(){
+    return {
+        //8XYN arithmetic and 7XNN, loop at 208
+        synthetic("alu", romBytes({0x6001, 0x6103, 0x6207, 0x630F,
+                                   0x8014, 0x8125, 0x8236, 0x8307, 0x840E, 0x8011, 0x8122, 0x8233, 0x8340, 0x7001, 0x7102, 0x1208})),
+        //3XNN/4XNN/5XY0/9XY0/EXA1, a mix of taken and not taken, loop at 204
+        synthetic("skips", romBytes({0x6000, 0x6100,
+                                     0x3001, 0x7101, 0x4002, 0x7201, 0x5010, 0x7301, 0x9020, 0x7401, 0xE0A1, 0x7501, 0x7001, 0x1204})),
+        //nested 2NNN/00EE, loop at 200
+        synthetic("calls", romBytes({0x2204, 0x1200,
+                                     0x2208, 0x00EE,
+                                     0x7001, 0x00EE})),
+        //DXYN with 5 and 15 row font sprites at moving positions, loop at 206
+        synthetic("draw", romBytes({0xA050, 0x6000, 0x6100,
+                                    0xD015, 0x7005, 0x7103, 0xD01F, 0x7009, 0x1206})),
+        //FX55/FX65 over all registers and FX33, loop at 202
+        synthetic("memory", romBytes({0x6A00,
+                                      0xA400, 0xFF55, 0xA400, 0xFF65, 0xA500, 0xFA33, 0x7A01, 0x1202})),
+        //hi-res 16x16 DXY0 with vertical and horizontal scrolls, loop at 208
+        synthetic("scroll", romBytes({0x00FF, 0xA0A0, 0x6000, 0x6100,
+                                      0xD010, 0x7007, 0x7105, 0x00C1, 0x00FB, 0x00D1, 0x00FC, 0x1208})),
+        //FX07/3XNN/1NNN spin on the delay timer, reloaded when it runs out; the block engine skips it
+        synthetic("idle", romBytes({0x6A3C, 0xFA15,
+                                    0xF007, 0x3000, 0x1204, 0x1200})),
+    };
+}
+
+//map a ROM file for benchmarking
+bool readRom(const string& filename, BenchRom& rom){
+    rom = {filename, filename, RomCache::global().get(filename)};
+    return rom.image != nullptr;
+}
+
+//run instructions the way a headless job does, ticking timers once per frame; returns seconds taken
+double timeRun(const BenchRom& rom, Profile profile, Decoder decoder, uint64_t instructions, Profiler* profiler, Debugger* debugger){
+    Emulator emu(1u, profile);
+    emu.reset(rom.image->pristine(), 1);
+    if(profiler)
+        emu.setProfiler(profiler);
+    emu.setDebugger(debugger);
+
+    const uint64_t perFrame = INSTFREQ/TIMERFREQ;
+    auto start = chrono::steady_clock::now();
+    for(uint64_t done = 0; done < instructions; done += perFrame){
+        uint64_t count = min(perFrame, instructions - done);
+        if(decoder){
+            for(uint64_t i = 0; i < count; i++)
+                (emu.*decoder)(emu.fetch());
+        }
+        else
+            emu.run(count);
+        emu.decrementTimers();
+    }
+    //counts the block engine still holds back are part of the profiler's cost
+    if(profiler)
+        emu.setProfiler(nullptr);
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+//time reps runs after one untimed warm-up and summarize ns/instruction
+BenchResult measure(const BenchRom& rom, Profile profile, Decoder decoder, uint64_t instructions, int reps, Profiler* profiler, Debugger* debugger = nullptr){
+    timeRun(rom, profile, decoder, instructions, profiler, debugger);
+
+    vector<double> samples;
+    for(int r = 0; r < reps; r++)
+        samples.push_back(timeRun(rom, profile, decoder, instructions, profiler, debugger)*1e9/instructions);
+    sort(samples.begin(), samples.end());
+
+    BenchResult result;
+    size_t mid = samples.size()/2;
+    result.median = samples.size() % 2 ? samples[mid] : (samples[mid-1] + samples[mid])/2;
+    result.best = samples.front();
+    result.mean = 0;
+    for(double s : samples)
+        result.mean += s;
+    result.mean /= samples.size();
+    double variance = 0;
+    for(double s : samples)
+        variance += (s - result.mean)*(s - result.mean);
+    result.stddev = samples.size() > 1 ? sqrt(variance/(samples.size() - 1)) : 0;
+    return result;
+}
+
+//microseconds to get an instance ready for a run, median over reps batches of short runs;
+//either a fresh instance loading the ROM the old way (ifstream, or a copy for generated programs)
+//or one instance reset from the shared image between runs
+double measureStartup(const BenchRom& rom, Profile profile, bool reset, int reps, int runs){
+    vector<double> samples;
+    Emulator reused(1u, profile);
+    for(int r = 0; r < reps; r++){
+        double seconds = 0;
+        for(int i = 0; i < runs; i++){
+            auto start = chrono::steady_clock::now();
+            unique_ptr<Emulator> fresh;
+            Emulator* emu = &reused;
+            if(reset)
+                reused.reset(rom.image->pristine(), i);
+            else {
+                fresh.reset(new Emulator(i, profile));
+                emu = fresh.get();
+                if(rom.path.empty())
+                    emu->load(rom.image->data(), rom.image->size());
+                else
+                    emu->load(rom.path.c_str());
+            }
+            seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            emu->run(100);
+        }
+        samples.push_back(seconds*1e6/runs);
+    }
+    sort(samples.begin(), samples.end());
+    return samples[samples.size()/2];
+}
+
+//seconds for lanes instances of rom to run steps instructions each, frame by frame: as many
+//separate Emulators on the block engine, or one WideEmulator; wide gets the lockstep counters
+double timeLanes(const BenchRom& rom, Profile profile, size_t lanes, uint64_t steps, WideEmulator* wide){
+    const uint64_t perFrame = INSTFREQ/TIMERFREQ;
+    vector<uint32_t> seeds(lanes);
+    for(size_t l = 0; l < lanes; l++)
+        seeds[l] = l;
+    vector<unique_ptr<Emulator>> emus;
+    if(wide)
+        wide->reset(rom.image->pristine(), seeds);
+    else {
+        //the untimed pass allocates each block cache and translates what the timed one runs,
+        //like the wide emulator that is reused across runs; reset keeps the blocks
+        for(size_t l = 0; l < lanes; l++){
+            emus.emplace_back(new Emulator(seeds[l], profile));
+            Emulator& emu = *emus.back();
+            emu.reset(rom.image->pristine(), seeds[l]);
+            for(uint64_t done = 0; done < steps; done += perFrame){
+                emu.run(min(perFrame, steps - done));
+                emu.decrementTimers();
+            }
+            emu.reset(rom.image->pristine(), seeds[l]);
+        }
+    }
+
+    auto start = chrono::steady_clock::now();
+    for(uint64_t done = 0; done < steps; done += perFrame){
+        uint64_t count = min(perFrame, steps - done);
+        if(wide){
+            wide->run(count);
+            wide->decrementTimers();
+        }
+        else {
+            for(unique_ptr<Emulator>& emu : emus){
+                emu->run(count);
+                emu->decrementTimers();
+            }
+        }
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+//median ns per lane-instruction over reps runs, after one warm-up
+double measureLanes(const BenchRom& rom, Profile profile, size_t lanes, uint64_t steps, int reps, WideEmulator* wide){
+    timeLanes(rom, profile, lanes, steps, wide);
+    vector<double> samples;
+    for(int r = 0; r < reps; r++)
+        samples.push_back(timeLanes(rom, profile, lanes, steps, wide)*1e9/(steps*lanes));
+    sort(samples.begin(), samples.end());
+    return samples[samples.size()/2];
+}
+
+//median ms per frame for scaler over reps runs of a lo-res and a hi-res frame, copying the
+//last output into out so the instruction sets can be compared
+double measureScaler(Scaler& scaler, const FrameBuffer* screens, int reps, vector<uint32_t>& out){
+    int pitch = scaler.textureWidth()*sizeof(uint32_t);
+    out.assign(2*scaler.textureWidth()*scaler.textureHeight(), 0);
+    vector<double> samples;
+    for(int r = 0; r <= reps; r++){
+        auto start = chrono::steady_clock::now();
+        for(int s = 0; s < 2; s++)
+            scaler.scale(screens[s], &out[s*scaler.textureWidth()*scaler.textureHeight()], pitch);
+        //the first run only warms up
+        if(r)
+            samples.push_back(chrono::duration<double>(chrono::steady_clock::now() - start).count()*1e3/2);
+    }
+    sort(samples.begin(), samples.end());
+    return samples[samples.size()/2];
+}
+
+//usage: chip8_bench [--instructions N] [--reps N] [--dispatch switch|table|block|all] [--quirks PROFILE] [--no-synthetic] [--profile] [--debugger] [--lanes N] [--scaler WxH|off] [ROM...]
+int main(int argc, char* argv[]){
+    uint64_t instructions = 2000000;
+    int reps = 10;
+    string dispatch = "all";
+    Profile profile = PROFILE_CUSTOM;
+    bool generated = true;
+    bool profiled = false; //also time every run with the profiler attached
+    bool debugged = false; //and with a debugger attached, watching memory the program doesn't touch
+    size_t lanes = 256; //instances for the lockstep comparison, 0 skips it
+    int scaleWidth = 1920, scaleHeight = 1080; //display size for the scaler timings, 0 skips them
+    vector<string> files;
+
+    for(int i = 1; i < argc; i++){
+        string arg = argv[i];
+        bool hasValue = i+1 < argc;
+        if(arg == "--instructions" && hasValue){
+            if(!parseNumber(argv[++i], instructions))
+                return 1;
+        }
+        else if(arg == "--reps" && hasValue){
+            if(!parseNumber(argv[++i], reps))
+                return 1;
+        }
+        else if(arg == "--dispatch" && hasValue)
+            dispatch = argv[++i];
+        else if(arg == "--quirks" && hasValue){
+            if(!parseProfile(argv[++i], profile))
+                return 1;
+        }
+        else if(arg == "--no-synthetic")
+            generated = false;
+        else if(arg == "--profile")
+            profiled = true;
+        else if(arg == "--debugger")
+            debugged = true;
+        else if(arg == "--lanes" && hasValue){
+            if(!parseNumber(argv[++i], lanes))
+                return 1;
+        }
+        else if(arg == "--scaler" && hasValue){
+            string size = argv[++i];
+            if(size == "off")
+                scaleWidth = scaleHeight = 0;
+            else if(sscanf(size.c_str(), "%dx%d", &scaleWidth, &scaleHeight) != 2 || scaleWidth < 1 || scaleHeight < 1){
+                cerr << "Scaler size must be WIDTHxHEIGHT or off" << endl;
+                return 1;
+            }
+        }
+        else if(arg.compare(0, 2, "--") == 0){
+            cerr << "usage: " << argv[0] << " [--instructions N] [--reps N] [--dispatch switch|table|block|all] [--quirks PROFILE] [--no-synthetic] [--profile] [--debugger] [--lanes N] [--scaler WxH|off] [ROM...]" << endl;
+            return 1;
+        }
+        else
+            files.push_back(arg);
+    }
+    if(instructions == 0 || reps < 1){
+        cerr << "Need at least one instruction and one repetition" << endl;
+        return 1;
+    }
+
+    vector<BenchDispatch> engines;
+    if(dispatch == "switch" || dispatch == "all")
+        engines.push_back({"switch", &Emulator::reference});
+    if(dispatch == "table" || dispatch == "all")
+        engines.push_back({"table", &Emulator::dispatch});
+    if(dispatch == "block" || dispatch == "all")
+        engines.push_back({"block", nullptr});
+    if(engines.empty()){
+        cerr << "Unknown dispatch " << dispatch << endl;
+        return 1;
+    }
+
+    vector<BenchRom> roms;
+    if(generated)
+        roms = syntheticRoms();
+    for(const string& file : files){
+        BenchRom rom;
+        if(!readRom(file, rom))
+            return 1;
+        roms.push_back(rom);
+    }
+
+    cout << instructions << " instructions x " << reps << " repetitions, ns/instruction" << endl;
+    cout << left << setw(20) << "rom" << setw(8) << "engine" << right
+         << setw(10) << "median" << setw(10) << "mean" << setw(10) << "stddev" << setw(10) << "min" << setw(12) << "MIPS";
+    if(profiled)
+        cout << setw(12) << "profiled" << setw(10) << "overhead";
+    if(debugged)
+        cout << setw(12) << "watched" << setw(10) << "overhead" << setw(12) << "breakpoint" << setw(10) << "overhead";
+    cout << endl << fixed << setprecision(2);
+    for(const BenchRom& rom : roms){
+        for(const BenchDispatch& engine : engines){
+            BenchResult r = measure(rom, profile, engine.decoder, instructions, reps, nullptr);
+            cout << left << setw(20) << rom.name << setw(8) << engine.name << right
+                 << setw(10) << r.median << setw(10) << r.mean << setw(10) << r.stddev << setw(10) << r.best
+                 << setw(12) << 1e3/r.median;
+            if(profiled){
+                Profiler profiler;
+                BenchResult p = measure(rom, profile, engine.decoder, instructions, reps, &profiler);
+                cout << setw(12) << p.median << setw(9) << (p.median/r.median - 1)*100 << "%";
+            }
+            //a read/write watch on the top page, then also a breakpoint there, which makes run()
+            //check PC before every instruction
+            if(debugged){
+                Debugger debugger;
+                debugger.arm(0xFF00, 16, WATCH_READ | WATCH_WRITE);
+                BenchResult w = measure(rom, profile, engine.decoder, instructions, reps, nullptr, &debugger);
+                debugger.arm(0xFFF0, 1, WATCH_EXEC);
+                BenchResult b = measure(rom, profile, engine.decoder, instructions, reps, nullptr, &debugger);
+                cout << setw(12) << w.median << setw(9) << (w.median/r.median - 1)*100 << "%"
+                     << setw(12) << b.median << setw(9) << (b.median/r.median - 1)*100 << "%";
+            }
+            cout << endl;
+        }
+    }
+
+    const int runs = 1000;
+    cout << endl << "start-up per run, us (median of " << reps << " x " << runs << " runs of 100 instructions)" << endl;
+    cout << left << setw(20) << "rom" << right << setw(10) << "load" << setw(10) << "reset" << endl;
+    for(const BenchRom& rom : roms){
+        cout << left << setw(20) << rom.name << right
+             << setw(10) << measureStartup(rom, profile, false, reps, runs)
+             << setw(10) << measureStartup(rom, profile, true, reps, runs) << endl;
+    }
+
+    //the same instruction count spread over lanes instances with different seeds
+    if(lanes){
+        uint64_t steps = max<uint64_t>(instructions/lanes, 1);
+        cout << endl << lanes << " lanes x " << steps << " instructions, ns per lane-instruction" << endl;
+        cout << left << setw(20) << "rom" << right << setw(12) << "emulators" << setw(10) << "wide"
+             << setw(10) << "speedup" << setw(12) << "together" << setw(10) << "groups" << endl;
+        for(const BenchRom& rom : roms){
+            WideEmulator wide(lanes, profile);
+            double separate = measureLanes(rom, profile, lanes, steps, reps, nullptr);
+            double lockstep = measureLanes(rom, profile, lanes, steps, reps, &wide);
+            cout << left << setw(20) << rom.name << right << setw(12) << separate;
+            //lanes that stopped on an instruction the wide engine doesn't run make the time meaningless
+            if(wide.running() < lanes){
+                cout << setw(10) << "stopped" << endl;
+                continue;
+            }
+            uint64_t total = wide.stepsTogether() + wide.stepsApart();
+            cout << setw(10) << lockstep << setw(9) << separate/lockstep << "x"
+                 << setw(11) << 100.0*wide.stepsTogether()/total << "%"
+                 << setw(10) << (wide.stepsApart() ? (double)wide.groups()/wide.stepsApart() : 0) << endl;
+        }
+    }
+
+    //every filter on every instruction set this CPU has, outputs must match the scalar kernels
+    if(scaleWidth){
+        FrameBuffer screens[2];
+        mt19937_64 random(1);
+        for(int s = 0; s < 2; s++){
+            for(int p = 0; p < PLANES; p++){
+                for(int w = 0; w < ROWWORDS; w++){
+                    //sparse enough that Scale2x/3x find edges to smooth
+                    for(int y = 0; y < HIRESHEIGHT; y++)
+                        screens[s].planes[p][w][y] = random() & random() & random();
+                }
+            }
+            screens[s].hires = s == 1;
+        }
+        const char* filters[] = {"nearest", "scale2x", "scale3x", "crt"};
+        SimdLevel best = detectSimd();
+        cout << endl << "scaler to fit " << scaleWidth << "x" << scaleHeight << ", ms per frame (median of " << reps << ")" << endl;
+        cout << left << setw(20) << "filter" << right << setw(12) << "texture" << setw(12) << "shown";
+        for(int level = SIMD_SCALAR; level <= best; level++)
+            cout << setw(10) << simdName((SimdLevel)level);
+        cout << setw(12) << "identical" << endl << setprecision(3);
+        bool identical = true;
+        for(int f = FILTER_NEAREST; f <= FILTER_CRT; f++){
+            vector<uint32_t> reference, out;
+            bool same = true;
+            cout << left << setw(20) << filters[f] << right;
+            for(int level = SIMD_SCALAR; level <= best; level++){
+                Scaler scaler((ScaleFilter)f, scaleWidth, scaleHeight, (SimdLevel)level);
+                if(level == SIMD_SCALAR){
+                    cout << setw(12) << to_string(scaler.textureWidth()) + "x" + to_string(scaler.textureHeight())
+                         << setw(12) << to_string(scaler.width()) + "x" + to_string(scaler.height());
+                }
+                double ms = measureScaler(scaler, screens, reps, level == SIMD_SCALAR ? reference : out);
+                if(level != SIMD_SCALAR)
+                    same &= out == reference;
+                cout << setw(10) << ms;
+            }
+            cout << setw(12) << (same ? "yes" : "NO") << endl;
+            identical &= same;
+        }
+        if(!identical){
+            cerr << "Vector scaler output differs from the scalar kernels" << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
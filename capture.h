@@ -0,0 +1,221 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include "emulator.h"
+#include "xordelta.h"
+
+//capture file: 12 byte header, then one record per frame: frame number, encoded length and the
+//frame XOR the previous one (the first against a blank screen), encoded by encodeXorDelta
+const char CAPTUREMAGIC[4] = {'C', '8', 'C', 'V'};
+const uint32_t CAPTUREVERSION = 1;
+const size_t CAPTUREFRAMEBYTES = sizeof(FrameBuffer::planes) + 1; //planes, then the hires flag
+const size_t CAPTUREHEADER = 12;
+
+struct CaptureHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t frameBytes; //CAPTUREFRAMEBYTES when written
+};
+
+//frame as the bytes a capture stores, independent of struct padding
+inline void captureBytes(const FrameBuffer& frame, uint8_t* out){
+    memcpy(out, frame.planes, sizeof(frame.planes));
+    out[sizeof(frame.planes)] = frame.hires;
+}
+
+inline void captureFrame(const uint8_t* bytes, FrameBuffer& frame){
+    memcpy(frame.planes, bytes, sizeof(frame.planes));
+    frame.hires = bytes[sizeof(frame.planes)] != 0;
+}
+
+//writes frames to a capture file through a memory mapping that doubles when full, so a frame
+//costs one delta encode straight into the page cache; the file is trimmed when closed
+class CaptureWriter {
+    private:
+        std::string path;
+        uint8_t* base = nullptr; //mapped file, or fallback's data where mmap isn't available
+        size_t capacity = 0;
+        size_t used = 0;
+        uint64_t count = 0;
+        uint8_t frameBytes[2][CAPTUREFRAMEBYTES] = {}; //last frame written and the one being written
+        int previous = 0;
+#ifndef _WIN32
+        int fd = -1;
+#else
+        std::vector<uint8_t> fallback;
+#endif
+
+        CaptureWriter(const std::string& filename): path(filename){}
+
+        //make room for need more bytes
+        bool reserve(size_t need){
+            if(used + need <= capacity)
+                return true;
+            size_t size = capacity ? capacity : 1 << 20;
+            while(size < used + need)
+                size *= 2;
+#ifndef _WIN32
+            if(ftruncate(fd, size) != 0)
+                return false;
+            if(base)
+                munmap(base, capacity);
+            void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if(data == MAP_FAILED){
+                base = nullptr;
+                capacity = 0;
+                return false;
+            }
+            base = static_cast<uint8_t*>(data);
+#else
+            fallback.resize(size);
+            base = fallback.data();
+#endif
+            capacity = size;
+            return true;
+        }
+
+    public:
+        CaptureWriter(const CaptureWriter&) = delete;
+        CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+        //create or truncate filename, nullptr on failure
+        static CaptureWriter* open(const std::string& filename){
+            CaptureWriter* writer = new CaptureWriter(filename);
+#ifndef _WIN32
+            writer->fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if(writer->fd < 0){
+                std::cerr << "Failed to open capture " << filename << std::endl;
+                delete writer;
+                return nullptr;
+            }
+#endif
+            if(!writer->reserve(CAPTUREHEADER)){
+                std::cerr << "Failed to map capture " << filename << std::endl;
+                delete writer;
+                return nullptr;
+            }
+            CaptureHeader header;
+            memcpy(header.magic, CAPTUREMAGIC, 4);
+            header.version = CAPTUREVERSION;
+            header.frameBytes = CAPTUREFRAMEBYTES;
+            memcpy(writer->base, &header, CAPTUREHEADER);
+            writer->used = CAPTUREHEADER;
+            return writer;
+        }
+
+        //append a frame, false if the file couldn't grow
+        bool write(uint32_t frame, const FrameBuffer& display){
+            if(!reserve(8 + 2*CAPTUREFRAMEBYTES + 16))
+                return false;
+            uint8_t* current = frameBytes[previous ^ 1];
+            captureBytes(display, current);
+            uint8_t* record = base + used;
+            uint32_t length = encodeXorDelta(current, frameBytes[previous], CAPTUREFRAMEBYTES, record + 8);
+            memcpy(record, &frame, 4);
+            memcpy(record + 4, &length, 4);
+            used += 8 + length;
+            previous ^= 1;
+            count++;
+            return true;
+        }
+
+        uint64_t frames() const {
+            return count;
+        }
+
+        uint64_t bytes() const {
+            return used;
+        }
+
+        ~CaptureWriter(){
+#ifndef _WIN32
+            if(base)
+                munmap(base, capacity);
+            if(fd >= 0){
+                if(ftruncate(fd, used) != 0)
+                    std::cerr << "Failed to trim capture " << path << std::endl;
+                close(fd);
+            }
+#else
+            std::ofstream file(path, std::ios::binary);
+            file.write(reinterpret_cast<const char*>(base), used);
+#endif
+        }
+};
+
+//reads a capture file frame by frame
+class CaptureReader {
+    private:
+        std::vector<uint8_t> data;
+        size_t offset = CAPTUREHEADER;
+        uint8_t state[CAPTUREFRAMEBYTES] = {};
+        bool damaged = false;
+
+    public:
+        //false if filename isn't a capture this version can read
+        bool open(const std::string& filename){
+            std::ifstream file(filename, std::ios::binary);
+            if(!file.is_open()){
+                std::cerr << "Failed to open capture " << filename << std::endl;
+                return false;
+            }
+            data.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            CaptureHeader header;
+            if(data.size() < CAPTUREHEADER){
+                std::cerr << "Not a capture file: " << filename << std::endl;
+                return false;
+            }
+            memcpy(&header, data.data(), CAPTUREHEADER);
+            if(memcmp(header.magic, CAPTUREMAGIC, 4) != 0){
+                std::cerr << "Not a capture file: " << filename << std::endl;
+                return false;
+            }
+            if(header.version != CAPTUREVERSION || header.frameBytes != CAPTUREFRAMEBYTES){
+                std::cerr << "Unsupported capture version " << header.version << ": " << filename << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+        //decode the next frame, false at the end of the file or on a damaged record (see error())
+        bool next(uint32_t& frame, FrameBuffer& display){
+            if(damaged || offset == data.size())
+                return false;
+            uint32_t length;
+            if(data.size() - offset < 8){
+                damaged = true;
+                return false;
+            }
+            memcpy(&frame, &data[offset], 4);
+            memcpy(&length, &data[offset + 4], 4);
+            if(data.size() - offset - 8 < length || !decodeXorDelta(&data[offset + 8], length, state, CAPTUREFRAMEBYTES)){
+                damaged = true;
+                return false;
+            }
+            offset += 8 + length;
+            captureFrame(state, display);
+            return true;
+        }
+
+        //next() stopped at a truncated record or one that didn't decode, rather than the end of the file
+        bool error() const {
+            return damaged;
+        }
+
+        uint64_t bytes() const {
+            return data.size();
+        }
+};
+
+#endif
@@ -0,0 +1,109 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <random>
+#include <cstring>
+#include "capture.h"
+using namespace std;
+
+//usage: chip8_capturecheck PREFIX
+//writes random frames to PREFIX.a.c8v, mostly a few changed words, sometimes a whole new screen
+//or a resolution change, well past the writer's first 1MB mapping, and reads them back; every
+//frame number and frame must come back as written. PREFIX.b.c8v gets the same frames and
+//PREFIX.c.c8v the same but one pixel, for ctest to run capturetool diff on. PREFIX.d.c8v is
+//PREFIX.a.c8v cut off partway through its last record, which must read as damaged, not as the end
+int main(int argc, char* argv[]){
+    if(argc != 2){
+        cerr << "usage: " << argv[0] << " PREFIX" << endl;
+        return 1;
+    }
+    string prefix = argv[1];
+
+    mt19937_64 rng(1);
+    const uint32_t FRAMES = 4000;
+    vector<FrameBuffer> frames(FRAMES);
+    vector<uint32_t> numbers(FRAMES);
+    FrameBuffer screen;
+    memset(&screen, 0, sizeof(screen));
+    uint64_t* words = &screen.planes[0][0][0];
+    const size_t WORDS = sizeof(screen.planes)/sizeof(uint64_t);
+    uint32_t number = 0;
+    for(uint32_t f = 0; f < FRAMES; f++){
+        uint64_t kind = rng() % 8;
+        if(kind < 2){
+            for(size_t w = 0; w < WORDS; w++)
+                words[w] = rng();
+        }
+        else if(kind == 2)
+            screen.hires = !screen.hires;
+        else {
+            for(uint64_t n = rng() % 6; n > 0; n--)
+                words[rng() % WORDS] ^= rng();
+        }
+        frames[f] = screen;
+        //headless writes every frame, skipped ones too, but the format doesn't require consecutive
+        //numbers, so some jump here
+        number += 1 + (rng() % 4 == 0 ? rng() % 100 : 0);
+        numbers[f] = number;
+    }
+
+    const uint32_t CHANGED = FRAMES/2;
+    for(const char* name : {".a.c8v", ".b.c8v", ".c.c8v"}){
+        unique_ptr<CaptureWriter> writer(CaptureWriter::open(prefix + name));
+        if(!writer)
+            return 1;
+        for(uint32_t f = 0; f < FRAMES; f++){
+            FrameBuffer frame = frames[f];
+            if(name[1] == 'c' && f == CHANGED)
+                frame.planes[0][0][0] ^= 1;
+            if(!writer->write(numbers[f], frame)){
+                cout << prefix << name << ": capture couldn't grow past " << writer->bytes() << " bytes" << endl;
+                return 1;
+            }
+        }
+        if(writer->frames() != FRAMES || writer->bytes() <= 1 << 20){
+            cout << prefix << name << ": " << writer->frames() << " frames in " << writer->bytes()
+                 << " bytes, the mapping never grew" << endl;
+            return 1;
+        }
+    }
+
+    CaptureReader reader;
+    if(!reader.open(prefix + ".a.c8v"))
+        return 1;
+    uint32_t read = 0;
+    uint32_t frame;
+    FrameBuffer display;
+    while(reader.next(frame, display)){
+        if(read >= FRAMES || frame != numbers[read] || display.hires != frames[read].hires
+            || memcmp(display.planes, frames[read].planes, sizeof(display.planes))){
+            cout << "frame " << read << " doesn't read back as written" << endl;
+            return 1;
+        }
+        read++;
+    }
+    if(read != FRAMES || reader.error()){
+        cout << "read " << read << " of " << FRAMES << " frames back" << (reader.error() ? ", then a damaged record" : "") << endl;
+        return 1;
+    }
+
+    {
+        ifstream in(prefix + ".a.c8v", ios::binary);
+        vector<char> bytes((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        ofstream(prefix + ".d.c8v", ios::binary).write(bytes.data(), bytes.size() - 3);
+    }
+    CaptureReader truncated;
+    if(!truncated.open(prefix + ".d.c8v"))
+        return 1;
+    uint32_t before = 0;
+    while(truncated.next(frame, display))
+        before++;
+    if(before != FRAMES - 1 || !truncated.error()){
+        cout << "a capture cut off in its last record read " << before << " frames" << (truncated.error() ? "" : " and no error") << endl;
+        return 1;
+    }
+    cout << "capture: " << FRAMES << " frames in " << reader.bytes() << " bytes read back" << endl;
+    return 0;
+}
@@ -0,0 +1,207 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "capture.h"
+using namespace std;
+
+//CRC-32 as PNG chunks use it
+uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0){
+    static uint32_t table[256] = {};
+    if(!table[1]){
+        for(uint32_t n = 0; n < 256; n++){
+            uint32_t c = n;
+            for(int k = 0; k < 8; k++)
+                c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+    }
+    crc = ~crc;
+    for(size_t i = 0; i < size; i++)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+void putBig(vector<uint8_t>& out, uint32_t value){
+    for(int shift = 24; shift >= 0; shift -= 8)
+        out.push_back(value >> shift);
+}
+
+void writeChunk(ofstream& file, const char* type, const vector<uint8_t>& data){
+    vector<uint8_t> chunk;
+    putBig(chunk, data.size());
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    putBig(chunk, crc32(&chunk[4], chunk.size() - 4));
+    file.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+}
+
+//write a frame as an indexed PNG in the window's colours, lo-res doubled to 128x64, scaled up;
+//the image data is stored in uncompressed deflate blocks, which needs no zlib
+bool writePng(const string& filename, const FrameBuffer& frame, int scale){
+    ofstream file(filename, ios::binary);
+    if(!file.is_open()){
+        cerr << "Failed to open " << filename << endl;
+        return false;
+    }
+    const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    file.write(reinterpret_cast<const char*>(signature), 8);
+
+    uint32_t width = HIRESWIDTH*scale, height = HIRESHEIGHT*scale;
+    vector<uint8_t> header;
+    putBig(header, width);
+    putBig(header, height);
+    header.insert(header.end(), {8, 3, 0, 0, 0}); //8 bit palette indices
+    writeChunk(file, "IHDR", header);
+    //black, plane 1, plane 2, both planes
+    writeChunk(file, "PLTE", {0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xAA, 0xAA, 0xAA, 0x55, 0x55, 0x55});
+
+    //scanlines, each led by filter type 0
+    vector<uint8_t> raw;
+    int shift = frame.hires ? 0 : 1;
+    for(uint32_t y = 0; y < height; y++){
+        raw.push_back(0);
+        int row = (y/scale) >> shift;
+        for(uint32_t x = 0; x < width; x++){
+            int from = (x/scale) >> shift;
+            int bit = 63 - (from & 63);
+            raw.push_back(((frame.planes[0][from >> 6][row] >> bit) & 1) | (((frame.planes[1][from >> 6][row] >> bit) & 1) << 1));
+        }
+    }
+
+    //zlib stream of stored blocks, then the Adler-32 of the raw data
+    vector<uint8_t> zlib = {0x78, 0x01};
+    for(size_t at = 0; at < raw.size(); at += 65535){
+        size_t length = min<size_t>(65535, raw.size() - at);
+        zlib.push_back(at + length == raw.size());
+        zlib.insert(zlib.end(), {(uint8_t)length, (uint8_t)(length >> 8), (uint8_t)~length, (uint8_t)(~length >> 8)});
+        zlib.insert(zlib.end(), raw.begin() + at, raw.begin() + at + length);
+    }
+    uint32_t a = 1, b = 0;
+    for(uint8_t byte : raw){
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    putBig(zlib, b << 16 | a);
+    writeChunk(file, "IDAT", zlib);
+    writeChunk(file, "IEND", {});
+    return file.good();
+}
+
+//pixels that differ between two frames, counted at hi-res resolution; a resolution change counts every pixel
+uint64_t pixelsDiffering(const FrameBuffer& a, const FrameBuffer& b){
+    if(a.hires != b.hires)
+        return HIRESWIDTH*HIRESHEIGHT;
+    uint64_t count = 0;
+    for(int p = 0; p < PLANES; p++){
+        for(int w = 0; w < ROWWORDS; w++){
+            for(int y = 0; y < HIRESHEIGHT; y++)
+                count += __builtin_popcountll(a.planes[p][w][y] ^ b.planes[p][w][y]);
+        }
+    }
+    return count;
+}
+
+int info(const string& filename){
+    CaptureReader reader;
+    if(!reader.open(filename))
+        return 1;
+    uint32_t frame, first = 0, last = 0;
+    uint64_t count = 0;
+    FrameBuffer display;
+    while(reader.next(frame, display)){
+        if(!count)
+            first = frame;
+        last = frame;
+        count++;
+    }
+    if(reader.error()){
+        cout << filename << ": damaged record after " << count << " frames" << endl;
+        return 1;
+    }
+    cout << filename << ": " << count << " frames";
+    if(count)
+        cout << " (" << first << " to " << last << ")";
+    cout << ", " << reader.bytes() << " bytes, " << (count ? (double)(reader.bytes() - CAPTUREHEADER)/count : 0) << " bytes/frame" << endl;
+    return 0;
+}
+
+int png(const string& filename, const string& prefix, int scale){
+    CaptureReader reader;
+    if(!reader.open(filename))
+        return 1;
+    uint32_t frame;
+    FrameBuffer display;
+    uint64_t written = 0;
+    while(reader.next(frame, display)){
+        char name[16];
+        snprintf(name, sizeof(name), "%06u.png", frame);
+        if(!writePng(prefix + name, display, scale))
+            return 1;
+        written++;
+    }
+    cerr << written << " frames written" << endl;
+    if(reader.error()){
+        cerr << filename << ": damaged record after " << written << " frames" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+//compare two captures frame by frame, exit status 1 if they differ anywhere or either is damaged
+int diff(const string& first, const string& second){
+    CaptureReader a, b;
+    if(!a.open(first) || !b.open(second))
+        return 1;
+    uint32_t frameA = 0, frameB = 0;
+    FrameBuffer displayA, displayB;
+    uint64_t compared = 0, differing = 0;
+    while(true){
+        bool moreA = a.next(frameA, displayA);
+        bool moreB = b.next(frameB, displayB);
+        if(!moreA || !moreB){
+            if(a.error() || b.error()){
+                cout << (a.error() ? first : second) << ": damaged record after " << compared << " frames" << endl;
+                return 1;
+            }
+            if(moreA || moreB){
+                cout << "captures end at different frames: " << (moreA ? second : first) << " ends after " << compared << " frames" << endl;
+                return 1;
+            }
+            break;
+        }
+        compared++;
+        uint64_t pixels = pixelsDiffering(displayA, displayB);
+        if(pixels || frameA != frameB){
+            if(differing < 10)
+                cout << "frame " << frameA << (frameA != frameB ? " vs " + to_string(frameB) : "") << ": " << pixels << " pixels differ" << endl;
+            differing++;
+        }
+    }
+    cout << compared << " frames compared, " << differing << " differ" << endl;
+    return differing ? 1 : 0;
+}
+
+//decode or compare captures written by headless --capture
+//usage: capturetool info FILE | png FILE PREFIX [SCALE] | diff FILE FILE
+int main(int argc, char* argv[]){
+    string command = argc > 1 ? argv[1] : "";
+    if(command == "info" && argc == 3)
+        return info(argv[2]);
+    if(command == "png" && (argc == 4 || argc == 5)){
+        int scale = 4;
+        if(argc == 5 && !parseNumber(argv[4], scale))
+            return 1;
+        if(scale < 1 || scale > 64){
+            cerr << "Scale must be 1 to 64" << endl;
+            return 1;
+        }
+        return png(argv[2], argv[3], scale);
+    }
+    if(command == "diff" && argc == 4)
+        return diff(argv[2], argv[3]);
+    cerr << "usage: capturetool info FILE | png FILE PREFIX [SCALE] | diff FILE FILE" << endl;
+    return 1;
+}
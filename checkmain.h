@@ -0,0 +1,73 @@
+#ifndef CHECKMAIN_H
+#define CHECKMAIN_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "emulator.h"
+
+//what chip8_enginecheck, chip8_idlecheck and chip8_widecheck run: how many random programs per
+//quirk profile, for how many frames, from which RNG seed
+struct CheckOptions {
+    uint32_t roms;
+    uint32_t frames;
+    uint32_t seed = 1;
+};
+
+//read [--roms N] [--frames N] [--seed N] into options, which hold the checker's defaults;
+//prints the usage line and returns false on anything else
+inline bool parseCheckOptions(int argc, char* argv[], CheckOptions& options){
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        bool hasValue = i+1 < argc;
+        if(arg == "--roms" && hasValue){
+            if(!parseNumber(argv[++i], options.roms))
+                return false;
+        }
+        else if(arg == "--frames" && hasValue){
+            if(!parseNumber(argv[++i], options.frames))
+                return false;
+        }
+        else if(arg == "--seed" && hasValue){
+            if(!parseNumber(argv[++i], options.seed))
+                return false;
+        }
+        else {
+            std::cerr << "usage: " << argv[0] << " [--roms N] [--frames N] [--seed N]" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+//random programs that store over their own code run into 0NNN, which the engines report on cerr
+inline void silenceEngineErrors(){
+    std::cerr.rdbuf(nullptr);
+}
+
+//opcode words to ROM bytes, big-endian
+inline std::vector<uint8_t> romBytes(const std::vector<uint16_t>& ops){
+    std::vector<uint8_t> bytes;
+    bytes.reserve(2*ops.size());
+    for(uint16_t op : ops){
+        bytes.push_back(op >> 8);
+        bytes.push_back(op & 0xFF);
+    }
+    return bytes;
+}
+
+//append 16 instructions that each call the next one, so however often a random program runs
+//00EE, every stack slot returns into the program at ops' current end (loaded at 0x200)
+inline void appendCallChain(std::vector<uint16_t>& ops){
+    for(int i = 0; i < 16; i++)
+        ops.push_back(0x2000 | (0x200 + 2*ops.size() + 2));
+}
+
+//append 256 bytes of 12, which read as 1212, a jump back into the program, wherever a BNNN
+//offset or a skip lands in them
+inline void appendLandingPad(std::vector<uint8_t>& bytes){
+    bytes.insert(bytes.end(), 0x100, 0x12);
+}
+
+#endif
@@ -0,0 +1,337 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <set>
+#include "aot.h"
+using namespace std;
+
+const int MAXAOTBLOCK = 8; //longest compiled block in instructions, half a 16 instruction frame
+
+//where control can go after the instruction at addr, given the bytes of the ROM
+struct Successors {
+    bool terminator; //ends the block, otherwise it only falls through
+    vector<uint32_t> targets; //other addresses it can continue at, known statically
+};
+
+class Compiler {
+    private:
+        vector<uint8_t> rom;
+        Profile profile;
+        set<uint32_t> reachable; //instruction starts found by the walk
+        set<uint32_t> leaders; //first instruction of every block
+        uint32_t interpreted = 0; //instructions left to Emulator::execute
+
+        bool inRom(uint32_t addr, uint32_t length = 2) const {
+            return addr >= 0x200 && addr + length <= 0x200 + rom.size();
+        }
+
+        uint16_t word(uint32_t addr) const {
+            return rom[addr - 0x200]*0x100 + rom[addr + 1 - 0x200];
+        }
+
+        uint32_t length(uint32_t addr) const {
+            return word(addr) == 0xF000 ? 4 : 2;
+        }
+
+        //the instruction after a skip at addr taken, F000 NNNN is skipped as a whole
+        uint32_t skipped(uint32_t addr) const {
+            return addr + 2 + (inRom(addr + 2) ? length(addr + 2) : 2);
+        }
+
+        static bool isSkip(uint16_t op){
+            switch(op >> 12){
+                case 0x3: case 0x4: case 0x9:
+                    return true;
+                case 0x5:
+                    return (op & 0xF) != 0x2 && (op & 0xF) != 0x3;
+                case 0xE:
+                    return (op & 0xFF) == 0x9E || (op & 0xFF) == 0xA1;
+            }
+            return false;
+        }
+
+        //stores to memory end a block so the runner can notice code being overwritten
+        static bool writesMemory(uint16_t op){
+            return (op & 0xF00F) == 0x5002 || (op & 0xF0FF) == 0xF033 || (op & 0xF0FF) == 0xF055;
+        }
+
+        Successors successors(uint32_t addr) const {
+            uint16_t op = word(addr);
+            if(op == 0x00EE || op == 0x00FD || (op >> 12) == 0xB)
+                return {true, {}}; //return address or jump target only known at run time
+            if((op >> 12) == 0x1)
+                return {true, {(uint32_t)(op & 0xFFF)}};
+            if((op >> 12) == 0x2)
+                return {true, {(uint32_t)(op & 0xFFF), addr + 2}};
+            if(isSkip(op))
+                return {true, {addr + 2, skipped(addr)}};
+            if((op & 0xF0FF) == 0xF00A || writesMemory(op))
+                return {true, {addr + 2}};
+            return {false, {addr + length(addr)}};
+        }
+
+        //find every instruction reachable from 0x200 and the blocks they fall into
+        void walk(){
+            vector<uint32_t> work = {0x200};
+            leaders.insert(0x200);
+            while(!work.empty()){
+                uint32_t addr = work.back();
+                work.pop_back();
+                if(!inRom(addr) || (word(addr) == 0xF000 && !inRom(addr, 4)) || !reachable.insert(addr).second)
+                    continue;
+                Successors next = successors(addr);
+                for(uint32_t target : next.targets){
+                    if(next.terminator)
+                        leaders.insert(target);
+                    work.push_back(target);
+                }
+            }
+        }
+
+        //C++ statement for an instruction run in line, or an empty string to leave it to execute()
+        static string inlined(uint16_t op, uint16_t operand){
+            char line[256];
+            int X = (op >> 8) & 0xF, Y = (op >> 4) & 0xF;
+            int NN = op & 0xFF, NNN = op & 0xFFF;
+            switch(op >> 12){
+                case 0x6:
+                    snprintf(line, sizeof(line), "s.registers[%d] = 0x%02X;", X, NN);
+                    return line;
+                case 0x7:
+                    snprintf(line, sizeof(line), "s.registers[%d] += 0x%02X;", X, NN);
+                    return line;
+                case 0x8:
+                    switch(op & 0xF){
+                        case 0x0:
+                            snprintf(line, sizeof(line), "s.registers[%d] = s.registers[%d];", X, Y);
+                            return line;
+                        case 0x1: case 0x2: case 0x3: {
+                            const char* logic = (op & 0xF) == 1 ? "|" : (op & 0xF) == 2 ? "&" : "^";
+                            snprintf(line, sizeof(line), "s.registers[%d] %s= s.registers[%d]; if(Q::vfReset) s.registers[15] = 0;", X, logic, Y);
+                            return line;
+                        }
+                        case 0x4:
+                            snprintf(line, sizeof(line), "{ int sum = s.registers[%d] + s.registers[%d]; s.registers[%d] = sum; s.registers[15] = sum > 255; }", X, Y, X);
+                            return line;
+                        case 0x5: case 0x7: {
+                            int a = (op & 0xF) == 5 ? X : Y, b = (op & 0xF) == 5 ? Y : X;
+                            snprintf(line, sizeof(line), "{ uint8_t a = s.registers[%d], b = s.registers[%d]; s.registers[%d] = a - b; s.registers[15] = a >= b; }", a, b, X);
+                            return line;
+                        }
+                        case 0x6: case 0xE: {
+                            const char* shifted = (op & 0xF) == 6 ? "v >> 1" : "v << 1";
+                            const char* out = (op & 0xF) == 6 ? "v & 1" : "v >> 7";
+                            snprintf(line, sizeof(line), "{ uint8_t v = s.registers[Q::shift ? %d : %d]; s.registers[%d] = %s; s.registers[15] = %s; }", X, Y, X, shifted, out);
+                            return line;
+                        }
+                    }
+                    return "";
+                case 0xA:
+                    snprintf(line, sizeof(line), "s.I = 0x%03X;", NNN);
+                    return line;
+                case 0xF:
+                    if(op == 0xF000){
+                        snprintf(line, sizeof(line), "s.I = 0x%04X;", operand);
+                        return line;
+                    }
+                    if(op == 0xF002)
+                        return "";
+                    switch(op & 0xFF){
+                        case 0x01:
+                            snprintf(line, sizeof(line), "s.planes = %d;", X & 3);
+                            return line;
+                        case 0x07:
+                            snprintf(line, sizeof(line), "s.registers[%d] = s.delay;", X);
+                            return line;
+                        case 0x15:
+                            snprintf(line, sizeof(line), "s.delay = s.registers[%d];", X);
+                            return line;
+                        case 0x18:
+                            snprintf(line, sizeof(line), "s.sound = s.registers[%d];", X);
+                            return line;
+                        case 0x1E:
+                            snprintf(line, sizeof(line), "if(s.I + s.registers[%d] > 255) s.registers[15] = 1; s.I += s.registers[%d];", X, X);
+                            return line;
+                        case 0x29:
+                            snprintf(line, sizeof(line), "s.I = 0x50 + s.registers[%d]*5;", X);
+                            return line;
+                        case 0x30:
+                            snprintf(line, sizeof(line), "s.I = 0xA0 + (s.registers[%d] & 0xF)*10;", X);
+                            return line;
+                        case 0x3A:
+                            snprintf(line, sizeof(line), "s.pitch = s.registers[%d];", X);
+                            return line;
+                        case 0x65:
+                            snprintf(line, sizeof(line), "for(int i = 0; i <= %d; i++){ s.registers[i] = s.memory[(uint16_t)(s.I + i)]; } "
+                                "if(Q::memory == MEMORY_INCREMENT) s.I += %d; else if(Q::memory == MEMORY_INCREMENT_X) s.I += %d;", X, X + 1, X);
+                            return line;
+                    }
+                    return "";
+            }
+            return "";
+        }
+
+        //C++ statements ending a block with the control flow instruction at addr
+        string branch(uint16_t op, uint32_t addr) const {
+            char line[200];
+            int X = (op >> 8) & 0xF, Y = (op >> 4) & 0xF;
+            int NN = op & 0xFF, NNN = op & 0xFFF;
+            if(op == 0x00EE)
+                return "s.SP = (s.SP - 1) & 15; s.PC = s.stack[s.SP];";
+            switch(op >> 12){
+                case 0x1:
+                    snprintf(line, sizeof(line), "s.PC = 0x%03X;", NNN);
+                    return line;
+                case 0x2:
+                    snprintf(line, sizeof(line), "s.stack[s.SP] = 0x%03X; s.SP = (s.SP + 1) & 15; s.PC = 0x%03X;", addr + 2, NNN);
+                    return line;
+                case 0x3: case 0x4:
+                    snprintf(line, sizeof(line), "s.PC = s.registers[%d] %s 0x%02X ? aotSkip(s, 0x%03X) : 0x%03X;",
+                        X, (op >> 12) == 0x3 ? "==" : "!=", NN, addr + 2, addr + 2);
+                    return line;
+                case 0x5: case 0x9:
+                    if((op >> 12) == 0x5 && (op & 0xF) == 0x2)
+                        break;
+                    snprintf(line, sizeof(line), "s.PC = s.registers[%d] %s s.registers[%d] ? aotSkip(s, 0x%03X) : 0x%03X;",
+                        X, (op >> 12) == 0x5 ? "==" : "!=", Y, addr + 2, addr + 2);
+                    return line;
+            }
+            //key skips, BNNN, FX0A, 00FD and stores: the handler leaves PC where it belongs
+            snprintf(line, sizeof(line), "s.PC = 0x%03X; e.execute(0x%04X);", addr + 2, op);
+            return line;
+        }
+
+        //emit one block, returns the address after its last instruction
+        uint32_t block(ostream& out, uint32_t start, uint16_t& count){
+            out << "void block" << hex << uppercase << start << "(Emulator& e, MachineState& s){\n";
+            uint32_t addr = start;
+            count = 0;
+            bool ended = false;
+            while(!ended && count < MAXAOTBLOCK && reachable.count(addr) && (addr == start || !leaders.count(addr))){
+                uint16_t op = word(addr);
+                Successors next = successors(addr);
+                char comment[32];
+                snprintf(comment, sizeof(comment), "    //%03X: %04X\n", addr, op);
+                out << comment;
+                if(next.terminator){
+                    string code = branch(op, addr);
+                    out << "    " << code << "\n";
+                    if(code.find("execute") != string::npos)
+                        interpreted++;
+                    ended = true;
+                }
+                else {
+                    string code = inlined(op, op == 0xF000 ? word(addr + 2) : 0);
+                    if(code.empty()){
+                        char call[64];
+                        snprintf(call, sizeof(call), "s.PC = 0x%03X; e.execute(0x%04X);", addr + 2, op);
+                        code = call;
+                        interpreted++;
+                    }
+                    out << "    " << code << "\n";
+                }
+                addr += length(addr);
+                count++;
+            }
+            if(!ended){
+                char fall[32];
+                snprintf(fall, sizeof(fall), "    s.PC = 0x%03X;\n", addr);
+                out << fall;
+            }
+            out << "}\n\n" << dec;
+            return addr;
+        }
+
+    public:
+        Compiler(const vector<uint8_t>& bytes, Profile quirks): rom(bytes), profile(quirks){}
+
+        bool write(ostream& out, const string& name){
+            walk();
+            static const char* quirkNames[] = {"QuirksCustom", "QuirksVip", "QuirksChip48", "QuirksSuperChip", "QuirksXoChip"};
+            static const char* profileNames[] = {"PROFILE_CUSTOM", "PROFILE_VIP", "PROFILE_CHIP48", "PROFILE_SUPERCHIP", "PROFILE_XOCHIP"};
+
+            out << "//generated by chip8aot from " << name << ", do not edit\n";
+            out << "#include \"aot.h\"\n\n";
+            out << "namespace {\n\n";
+            out << "typedef " << quirkNames[profile] << " Q;\n\n";
+
+            vector<AotBlock> blocks;
+            set<uint32_t> pending(leaders.begin(), leaders.end()), done;
+            while(!pending.empty()){
+                uint32_t start = *pending.begin();
+                pending.erase(pending.begin());
+                if(!reachable.count(start) || !done.insert(start).second)
+                    continue;
+                uint16_t count;
+                uint32_t end = block(out, start, count);
+                blocks.push_back({(uint16_t)start, (uint16_t)end, count, nullptr});
+                //a block also starts wherever a capped one stops
+                if(reachable.count(end) && !leaders.count(end))
+                    pending.insert(end);
+            }
+
+            out << "const uint8_t rom[" << rom.size() << "] = {";
+            for(size_t i = 0; i < rom.size(); i++)
+                out << (i % 16 ? " " : "\n    ") << (int)rom[i] << (i + 1 < rom.size() ? "," : "");
+            out << "\n};\n\n";
+
+            out << "const AotBlock blocks[" << blocks.size() << "] = {\n" << hex << uppercase;
+            for(const AotBlock& b : blocks)
+                out << "    {0x" << b.start << ", 0x" << b.end << ", " << dec << b.length << hex << ", block" << b.start << "},\n";
+            out << dec << "};\n\n";
+            out << "}\n\n";
+            out << "extern const AotProgram aotProgram = {\"" << name << "\", " << profileNames[profile] << ", rom, " << rom.size()
+                << ", blocks, " << blocks.size() << "};\n";
+
+            uint64_t instructions = 0;
+            for(const AotBlock& b : blocks)
+                instructions += b.length;
+            cerr << name << ": " << blocks.size() << " blocks, " << instructions << " instructions, "
+                << interpreted << " left to the interpreter" << endl;
+            return (bool)out;
+        }
+};
+
+//usage: chip8aot ROM OUT.cpp [--quirks PROFILE]
+int main(int argc, char* argv[]){
+    Profile profile = PROFILE_CUSTOM;
+    vector<string> files;
+    for(int i = 1; i < argc; i++){
+        string arg = argv[i];
+        if(arg == "--quirks" && i+1 < argc){
+            if(!parseProfile(argv[++i], profile))
+                return 1;
+        }
+        else
+            files.push_back(arg);
+    }
+    if(files.size() != 2){
+        cerr << "usage: chip8aot ROM OUT.cpp [--quirks custom|vip|chip48|schip|xochip]" << endl;
+        return 1;
+    }
+
+    ifstream file(files[0], ios::binary);
+    if(!file.is_open()){
+        cerr << "Failed to open " << files[0] << endl;
+        return 1;
+    }
+    vector<uint8_t> rom((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    if(rom.empty() || rom.size() > MEMORYSIZE - 0x200){
+        cerr << "ROM must be 1 to " << MEMORYSIZE - 0x200 << " bytes" << endl;
+        return 1;
+    }
+
+    ofstream out(files[1]);
+    if(!out.is_open()){
+        cerr << "Failed to open " << files[1] << endl;
+        return 1;
+    }
+    string name = files[0].substr(files[0].find_last_of("/\\") + 1);
+    if(!Compiler(rom, profile).write(out, name)){
+        cerr << "Failed to write " << files[1] << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include <iostream>
+#include <vector>
+#include <memory>
+#include "env.h"
+using namespace std;
+
+//the opaque C handles are the C++ classes
+struct Chip8Env: Env {
+    using Env::Env;
+};
+
+struct Chip8EnvPool: EnvPool {
+    vector<EnvStep> results; //allocated once, so stepping allocates nothing
+    vector<uint16_t> noKeys; //keymasks for a step passed none
+
+    Chip8EnvPool(shared_ptr<const RomImage> rom, const Chip8EnvConfig& config, size_t count, size_t threads):
+        EnvPool(rom, config, count, threads), results(count), noKeys(count){}
+};
+
+static const uint64_t* screenWords(const FrameBuffer& screen){
+    return &screen.planes[0][0][0];
+}
+
+//null if the ROM can't be loaded or the config is unusable
+static shared_ptr<const RomImage> loadEnvRom(const char* rom, const Chip8EnvConfig* config){
+    if(!rom || !config)
+        return nullptr;
+    //a 2-byte score reads reward_address + 1 too, and both must be inside the 64KB of memory
+    if(config->profile > PROFILE_XOCHIP || (config->reward_bytes != 1 && config->reward_bytes != 2)
+        || config->reward_address > 0x10000 - (int32_t)config->reward_bytes || config->done_address > 0xFFFF){
+        cerr << "Bad environment config" << endl;
+        return nullptr;
+    }
+    return RomCache::global().get(rom);
+}
+
+void chip8_env_default_config(Chip8EnvConfig* config){
+    config->reward_address = -1;
+    config->reward_bytes = 1;
+    config->done_address = -1;
+    config->done_value = 0;
+    config->max_frames = 0;
+    config->profile = PROFILE_CUSTOM;
+}
+
+Chip8Env* chip8_env_create(const char* rom, const Chip8EnvConfig* config){
+    shared_ptr<const RomImage> image = loadEnvRom(rom, config);
+    return image ? new Chip8Env(image, *config) : nullptr;
+}
+
+void chip8_env_destroy(Chip8Env* env){
+    delete env;
+}
+
+const uint64_t* chip8_env_reset(Chip8Env* env, uint32_t seed){
+    return screenWords(env->reset(seed));
+}
+
+int32_t chip8_env_step(Chip8Env* env, uint16_t keymask, uint32_t frames, uint8_t* done){
+    EnvStep result = env->step(keymask, frames);
+    if(done)
+        *done = result.done;
+    return result.reward;
+}
+
+const uint64_t* chip8_env_screen(const Chip8Env* env){
+    return screenWords(env->screen());
+}
+
+uint8_t chip8_env_peek(const Chip8Env* env, uint16_t addr){
+    return env->peek(addr);
+}
+
+Chip8EnvPool* chip8_pool_create(const char* rom, const Chip8EnvConfig* config, uint32_t count, uint32_t threads){
+    shared_ptr<const RomImage> image = loadEnvRom(rom, config);
+    return image && count ? new Chip8EnvPool(image, *config, count, threads) : nullptr;
+}
+
+void chip8_pool_destroy(Chip8EnvPool* pool){
+    delete pool;
+}
+
+uint32_t chip8_pool_size(const Chip8EnvPool* pool){
+    return pool->size();
+}
+
+void chip8_pool_reset(Chip8EnvPool* pool, int32_t index, uint32_t seed){
+    if(index >= 0){
+        if((size_t)index < pool->size())
+            (*pool)[index].reset(seed + index);
+        return;
+    }
+    for(size_t i = 0; i < pool->size(); i++)
+        (*pool)[i].reset(seed + i);
+}
+
+void chip8_pool_step(Chip8EnvPool* pool, const uint16_t* keymasks, uint32_t frames, int32_t* rewards, uint8_t* dones){
+    pool->step(keymasks ? keymasks : pool->noKeys.data(), frames, pool->results.data());
+    for(size_t i = 0; i < pool->size(); i++){
+        if(rewards)
+            rewards[i] = pool->results[i].reward;
+        if(dones)
+            dones[i] = pool->results[i].done;
+    }
+}
+
+const uint64_t* chip8_pool_screen(const Chip8EnvPool* pool, uint32_t index){
+    return index < pool->size() ? screenWords((*pool)[index].screen()) : nullptr;
+}
@@ -0,0 +1,72 @@
+#ifndef CHIP8ENV_H
+#define CHIP8ENV_H
+
+#include <stdint.h>
+
+/*
+ * C interface to the emulator as a training environment, for ctypes and other FFIs.
+ * Nothing here allocates after create: step writes into arrays the caller owns, and the
+ * screen pointers stay valid, and are updated in place, until the environment is destroyed.
+ *
+ * A screen is the emulator's packed framebuffer: uint64_t planes[2][2][64] (plane, 64 pixel
+ * column word, row) followed by a hires byte. In lo-res only planes[0][0][0..31] is used,
+ * one word per row with the leftmost pixel in the top bit.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_WIN32)
+#define CHIP8_API __declspec(dllexport)
+#else
+#define CHIP8_API __attribute__((visibility("default")))
+#endif
+
+/* what each step reports in done */
+#define CHIP8_RUNNING 0
+#define CHIP8_TERMINATED 1 /* byte at done_address equals done_value */
+#define CHIP8_TRUNCATED 2 /* max_frames reached */
+
+/* where the program keeps its score and game-over state */
+typedef struct Chip8EnvConfig {
+    int32_t reward_address; /* score in memory, -1 for none; the reward is how much it changed */
+    uint32_t reward_bytes; /* 1 or 2, big-endian */
+    int32_t done_address; /* -1 for none */
+    uint32_t done_value; /* the episode ends when the byte at done_address equals it */
+    uint32_t max_frames; /* frames per episode, 0 for no limit */
+    uint32_t profile; /* quirk profile: 0 custom, 1 vip, 2 chip48, 3 schip, 4 xochip */
+} Chip8EnvConfig;
+
+typedef struct Chip8Env Chip8Env;
+typedef struct Chip8EnvPool Chip8EnvPool;
+
+/* config that reads no reward, never ends and uses the custom profile */
+CHIP8_API void chip8_env_default_config(Chip8EnvConfig* config);
+
+/* null if the ROM can't be loaded or the config is unusable, e.g. an address past 0xFFFF */
+CHIP8_API Chip8Env* chip8_env_create(const char* rom, const Chip8EnvConfig* config);
+CHIP8_API void chip8_env_destroy(Chip8Env* env);
+/* start an episode, returns the screen */
+CHIP8_API const uint64_t* chip8_env_reset(Chip8Env* env, uint32_t seed);
+/* hold the keys in keymask (bit n for key n) for frames frames; returns the reward, and done if not null */
+CHIP8_API int32_t chip8_env_step(Chip8Env* env, uint16_t keymask, uint32_t frames, uint8_t* done);
+CHIP8_API const uint64_t* chip8_env_screen(const Chip8Env* env);
+CHIP8_API uint8_t chip8_env_peek(const Chip8Env* env, uint16_t addr);
+
+/* count environments on one ROM stepped by threads worker threads (0 for one per core) */
+CHIP8_API Chip8EnvPool* chip8_pool_create(const char* rom, const Chip8EnvConfig* config, uint32_t count, uint32_t threads);
+CHIP8_API void chip8_pool_destroy(Chip8EnvPool* pool);
+CHIP8_API uint32_t chip8_pool_size(const Chip8EnvPool* pool);
+/* reset environment index, or every one when index is -1, seeded seed + index */
+CHIP8_API void chip8_pool_reset(Chip8EnvPool* pool, int32_t index, uint32_t seed);
+/* step every environment with its keymask, or no keys if keymasks is null; rewards and dones hold
+   one entry per environment and are filled if not null */
+CHIP8_API void chip8_pool_step(Chip8EnvPool* pool, const uint16_t* keymasks, uint32_t frames, int32_t* rewards, uint8_t* dones);
+CHIP8_API const uint64_t* chip8_pool_screen(const Chip8EnvPool* pool, uint32_t index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,219 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <vector>
+#include <string>
+#include <cstdlib>
+
+const uint32_t WATCHADDRESSES = 0x10000; //watchpoints cover the whole address space
+const uint32_t WATCHPAGE = 256; //bytes summarized by one entry of the page bitmap
+
+//what a watchpoint catches, combined as bits
+enum WatchKind : uint8_t {
+    WATCH_EXEC = 1, //breakpoint: an instruction with either byte at the address is about to run
+    WATCH_READ = 2, //instruction fetch, FX65, 5XY3, F002 and DXYN sprite data
+    WATCH_WRITE = 4 //FX33, FX55 and 5XY2
+};
+
+//one access that hit an armed address
+struct WatchHit {
+    uint8_t kind; //a single WatchKind
+    uint16_t addr; //first armed byte touched, PC or PC+1 for a breakpoint
+    uint16_t pc; //address of the instruction
+    uint16_t instruct;
+};
+
+//name of a single kind for messages
+inline const char* watchKindName(uint8_t kind){
+    return kind == WATCH_EXEC ? "break" : kind == WATCH_READ ? "read" : "write";
+}
+
+//watchpoint from ADDR[+LEN][:KINDS], hex address and decimal length, KINDS made of r, w and x;
+//kinds is left alone when the spec doesn't give any. Returns false if it doesn't parse
+inline bool parseWatch(const std::string& spec, uint16_t& addr, uint32_t& length, uint8_t& kinds){
+    const char* text = spec.c_str();
+    char* end;
+    unsigned long a = strtoul(text, &end, 16);
+    if(end == text || a >= WATCHADDRESSES)
+        return false;
+    addr = a;
+    length = 1;
+    if(*end == '+'){
+        text = end + 1;
+        length = strtoul(text, &end, 10);
+        if(end == text || length == 0 || length > WATCHADDRESSES)
+            return false;
+    }
+    if(*end == ':'){
+        uint8_t given = 0;
+        for(end++; *end; end++){
+            if(*end == 'r') given |= WATCH_READ;
+            else if(*end == 'w') given |= WATCH_WRITE;
+            else if(*end == 'x') given |= WATCH_EXEC;
+            else return false;
+        }
+        if(!given)
+            return false;
+        kinds = given;
+    }
+    return *end == 0;
+}
+
+//breakpoints and memory watchpoints, armed and disarmed at any time from the thread running
+//the emulator. Emulator only looks at them when one is attached (setDebugger), and then only
+//on the memory-touching paths: a page whose bitmap entry is clear costs one test. A hit goes
+//to the callback, which returns whether to pause; without a callback every hit pauses.
+//A paused emulator runs nothing until resume()
+class Debugger {
+    private:
+        uint8_t pages[WATCHADDRESSES/WATCHPAGE] = {}; //kinds armed anywhere in each page
+        uint8_t kinds[WATCHADDRESSES] = {}; //kinds armed on each byte
+        uint32_t breakpoints = 0; //addresses armed with WATCH_EXEC
+        std::function<bool(const WatchHit&)> onHit;
+        bool stopped = false;
+        bool atBreakpoint = false; //stopped before the instruction at last.pc
+        bool resuming = false; //let that instruction run once
+        WatchHit last = {};
+        uint64_t hitCount = 0;
+        uint64_t changes = 0; //arm, disarm and clear calls
+
+        void summarize(uint32_t page){
+            uint8_t all = 0;
+            for(uint32_t a = page*WATCHPAGE; a < (page + 1)*WATCHPAGE; a++)
+                all |= kinds[a];
+            pages[page] = all;
+        }
+
+    public:
+        Debugger(std::function<bool(const WatchHit&)> callback = nullptr): onHit(callback){}
+
+        Debugger(const Debugger&) = delete;
+        Debugger& operator=(const Debugger&) = delete;
+
+        //watch length bytes from addr for the given kinds
+        void arm(uint16_t addr, uint32_t length, uint8_t kind){
+            for(uint32_t i = 0; i < length; i++){
+                uint16_t a = addr + i;
+                if(kind & WATCH_EXEC && !(kinds[a] & WATCH_EXEC))
+                    breakpoints++;
+                kinds[a] |= kind;
+                pages[a/WATCHPAGE] |= kind;
+            }
+            changes++;
+        }
+
+        void disarm(uint16_t addr, uint32_t length, uint8_t kind = WATCH_EXEC | WATCH_READ | WATCH_WRITE){
+            for(uint32_t i = 0; i < length; i++){
+                uint16_t a = addr + i;
+                if(kind & kinds[a] & WATCH_EXEC)
+                    breakpoints--;
+                kinds[a] &= ~kind;
+                summarize(a/WATCHPAGE);
+            }
+            changes++;
+        }
+
+        void clear(){
+            memset(pages, 0, sizeof(pages));
+            memset(kinds, 0, sizeof(kinds));
+            breakpoints = 0;
+            changes++;
+        }
+
+        //kinds armed at addr
+        uint8_t armed(uint16_t addr) const {
+            return kinds[addr];
+        }
+
+        //every armed address with its kinds, in address order
+        std::vector<std::pair<uint16_t, uint8_t>> list() const {
+            std::vector<std::pair<uint16_t, uint8_t>> out;
+            for(uint32_t page = 0; page < WATCHADDRESSES/WATCHPAGE; page++){
+                for(uint32_t a = page*WATCHPAGE; pages[page] && a < (page + 1)*WATCHPAGE; a++){
+                    if(kinds[a])
+                        out.push_back({(uint16_t)a, kinds[a]});
+                }
+            }
+            return out;
+        }
+
+        //changes whenever what is armed does
+        uint64_t version() const {
+            return changes;
+        }
+
+        //any of kind armed in length bytes from addr, without reporting a hit
+        bool watching(uint32_t addr, uint32_t length, uint8_t kind) const {
+            for(uint32_t i = 0; i < length; i++){
+                uint16_t a = addr + i;
+                if(!(pages[a/WATCHPAGE] & kind))
+                    i += WATCHPAGE - 1 - a % WATCHPAGE; //skip the rest of the page
+                else if(kinds[a] & kind)
+                    return true;
+            }
+            return false;
+        }
+
+        //any breakpoint armed, the emulator then checks PC before every instruction
+        bool breaking() const {
+            return breakpoints != 0;
+        }
+
+        //report an access of length bytes from addr (wrapping like memory does); returns true
+        //if it paused
+        bool check(uint32_t addr, uint32_t length, uint8_t kind, uint16_t pc, uint16_t instruct){
+            for(uint32_t i = 0; i < length; i++){
+                uint16_t a = addr + i;
+                if(!(pages[a/WATCHPAGE] & kind)){
+                    i += WATCHPAGE - 1 - a % WATCHPAGE; //skip the rest of the page
+                    continue;
+                }
+                if(!(kinds[a] & kind))
+                    continue;
+                if(kind == WATCH_EXEC && resuming && pc == last.pc){
+                    resuming = false;
+                    return false;
+                }
+                last = {kind, a, pc, instruct};
+                hitCount++;
+                if(!onHit || onHit(last)){
+                    stopped = true;
+                    atBreakpoint = kind == WATCH_EXEC;
+                }
+                return stopped;
+            }
+            if(kind == WATCH_EXEC)
+                resuming = false;
+            return false;
+        }
+
+        bool paused() const {
+            return stopped;
+        }
+
+        //stop before the next instruction, e.g. after single-stepping
+        void pause(){
+            stopped = true;
+            atBreakpoint = false;
+        }
+
+        //carry on, starting with the instruction a breakpoint paused at
+        void resume(){
+            resuming = stopped && atBreakpoint;
+            stopped = atBreakpoint = false;
+        }
+
+        //the hit that last paused or was reported
+        const WatchHit& lastHit() const {
+            return last;
+        }
+
+        uint64_t hits() const {
+            return hitCount;
+        }
+};
+
+#endif
@@ -2,539 +2,77 @@
 #undef main
 #include <iostream>
 #include <cstdint>
-#include <stack>
-#include <fstream>
 #include <thread>
-#include <random>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <algorithm>
+#include <memory>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include "emulator.h"
+#include "headless.h"
+#include "rewind.h"
+#include "input.h"
+#include "audio.h"
+#include "scaler.h"
+#include "romcache.h"
+#include "replay.h"
 using namespace std;
 
-const int WIDTH = 64;
-const int HEIGHT = 32;
 const int DISPLAYSCALE = 10;
-const char* FILENAME = "br8kout.ch8";
-const int INSTFREQ = 1000;
-
-//modifiable instructions
-const bool newShift = false;
-const bool newJump = false;
-const bool newMemory = false;
-
-//class to handle main emulation
-class Emulator {
+const char* FILENAME = "br8kout.ch8"; //ROM run when none is given on the command line
+
+//triple-buffered handoff of whole frames from the emu thread to the display thread,
+//neither side ever waits: the producer fills its own slot and swaps it into the middle,
+//the consumer swaps the middle out only when it holds a frame it hasn't seen.
+//each frame carries the time of the oldest key event it is the first to show, so
+//key-to-present latency can be measured; a frame replaced unseen passes it on
+class FrameExchange {
     private:
-        uint8_t memory [4096]; //4KB of RAM memory
-        bool display [WIDTH*HEIGHT]; //current state of display (64x32 monochrome)
-        uint16_t PC; //program counter
-        uint16_t I; //index register
-        std::stack<uint16_t> stack; //address stack
-        uint8_t delay; //delay timer
-        uint8_t sound; //sound timer
-        uint8_t registers[16]; //general purpose variable registers
-        uint8_t keyPress; //stores last pressed key
-        random_device rd; //random generator
-        mt19937 gen;
-        uniform_int_distribution<uint8_t> distrib;
+        static const int FRESH = 4; //set on middle when it holds an unread frame
+        FrameBuffer buffers[3];
+        uint64_t inputs[3] = {}; //KeyEvent time shown first by each slot's frame, 0 if none
+        int back = 0; //slot the producer writes
+        int front = 1; //slot the consumer reads
+        atomic<int> middle{2};
+        uint64_t carried = 0; //input of a frame that was replaced before being read
 
     public:
-        Emulator(): gen(rd()), distrib(0, 255){
-            //store font data in memory from 050-09F
-            uint8_t font[80] = {
-                0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-                0x20, 0x60, 0x20, 0x20, 0x70, // 1
-                0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-                0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-                0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-                0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-                0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-                0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-                0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-                0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-                0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-                0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-                0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-                0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-                0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-                0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-            };
-            for(int i = 0; i < 80; i++){
-                memory[0x50+i] = font[i];
-            }
-
-            //load timers at max
-            delay = 255;
-            sound = 255;
-
-            //load empty screen
-            for(int i = 0; i<WIDTH*HEIGHT; i++)
-                display[i] = false;
-
-            //initialize pointers
-            PC = 0x200;
-            I = 0x0;
-            for(int i = 0; i<16; i++)
-                registers[i] = 0x0;
-            
-            //initialize keyPress as unpressed
-            keyPress = 0xFF;
-        }
-
-        //load ROM from file into memory
-        bool load(const char* filename){
-            //create file object
-            ifstream file(filename, ios::binary | ios::ate);
-            if(!file.is_open()){
-                cerr << "Failed to open File" << endl;
-                return false;
-            }
-            
-            // get file size and navigate to beginning
-            streamsize size = file.tellg();
-            file.seekg(0, ios::beg);
-
-            //check if size fits in memory
-            if (size > (4096 - 0x200)){
-                cerr << "File too big for memory" << endl;
-                return false;
-            }
-
-            //read into memory
-            file.read(reinterpret_cast<char*>(&memory[0x200]), size);
+        FrameExchange(){
+            memset(buffers, 0, sizeof(buffers));
+        }
 
-            return true;
+        //emu thread: hand over a copy of the framebuffer, with the time of the oldest key event
+        //applied since the last publish (0 if none)
+        void publish(const FrameBuffer& frame, uint64_t input){
+            buffers[back] = frame;
+            inputs[back] = carried && (!input || carried < input) ? carried : input;
+            int old = middle.exchange(back | FRESH, memory_order_acq_rel);
+            back = old & 3;
+            carried = (old & FRESH) ? inputs[back] : 0;
         }
 
-        bool* getDisplay(){
-            return display;
-        }
-
-        void decrementTimers(){
-            if (delay > 0) delay--;
-            if (sound > 0) sound--;
-        }
-
-        //read instruction that PC is currently pointing at
-        uint16_t fetch(){
-            uint16_t instruct;
-            instruct = memory[PC]*0x100 + memory[PC+1];
-            PC += 2;
-            return instruct;
-        }
-
-        //decode instruction (without executing)
-        void debugDecode(uint16_t instruct){
-            //extract bytes and nibbles
-            uint8_t first   = (instruct & 0xF000) >> 12;
-            uint8_t X       = (instruct & 0x0F00) >> 8;
-            uint8_t Y       = (instruct & 0x00F0) >> 4;
-            uint8_t N       = (instruct & 0x000F);
-            uint8_t NN      = (instruct & 0x00FF);
-            uint8_t NNN     = (instruct & 0x0FFF);
-
-            /*
-            std::cout << std::hex << "Instruction: " << instruct << std::dec << endl;
-            std::cout << std::hex << "Masked: " << (instruct & 0xF000) << std::dec << endl;
-            std::cout << std::hex << "Shifted: " << ((instruct & 0xF000) >> 12) << std::dec << endl;
-            std::cout << std::hex << "Broken down: " << (int)first << " " << (int)X << " " << (int)Y << " " << (int)N << std::dec << endl;
-            */
-        
-            //decode based on nibbles/bytes
-            switch(first){
-                case 0x0:
-                    switch(NNN){
-                        //clear screen
-                        case 0x0E0:
-                            cout << "clear screen" << endl;
-                            break;
-
-                        //return from subroutine
-                        case 0x0EE:
-                            cout << "return from subroutine" << endl;
-                            break;
-
-                        //otherwise print error message
-                        default:
-                            std::cerr << std::hex << "Unrecongized instruction " << (int)first << " " << (int)X << " " << (int)Y << " " << (int)N << std::dec << endl;
-                    }
-                    break;
-                
-                //jump PC to NNN
-                case 0x1:
-                    cout << "jump to " << NNN << endl;
-                    break;
-                
-                //jump PC to NNN and push old PC to stack
-                case 0x2:
-                    cout << "execute subroutine at " << NNN << endl;
-                    break;
-
-                //set register VX to value NN
-                case 0x6:
-                    cout << "set register" << endl;
-                    break;
-                
-                //add value NN to register VX
-                case 0x7:
-                    cout << "add to register" << endl;
-                    break;
-                
-                //set index register to value NNN
-                case 0xA:
-                    cout << "set index register" << endl;
-                    break;
-                
-                //draw sprite
-                case 0xD:
-                    cout << "draw sprite" << endl;
-                    break;
-
-                default:
-                    std::cerr << std::hex << "Unrecongized instruction " << (int)first << " " << (int)X << " " << (int)Y << " " << (int)N << std::dec << endl;
-            }
+        //display thread: switch to the newest frame, returns false if nothing new was published
+        bool acquire(){
+            if(!(middle.load(memory_order_relaxed) & FRESH))
+                return false;
+            front = middle.exchange(front, memory_order_acq_rel) & 3;
+            return true;
         }
 
-        //decode instruction
-        void decode(uint16_t instruct){
-            //extract bytes and nibbles
-            uint8_t first   = (instruct & 0xF000) >> 12;
-            uint8_t X       = (instruct & 0x0F00) >> 8;
-            uint8_t Y       = (instruct & 0x00F0) >> 4;
-            uint8_t N       = (instruct & 0x000F);
-            uint8_t NN      = (instruct & 0x00FF);
-            uint16_t NNN    = (instruct & 0x0FFF);
-            
-            //decode based on nibbles/bytes
-            switch(first){
-                case 0x0:
-                    switch(NNN){
-                        //clear screen
-                        case 0x0E0:
-                            cout << "clear screen" << endl;
-                            for(int i = 0; i<WIDTH*HEIGHT; i++)
-                                display[i] = false;
-                            break;
-
-                        //return from subroutine
-                        case 0x0EE:
-                            cout << "return from subroutine" << endl;
-                            PC = stack.top();
-                            stack.pop();
-                            break;
-
-                        //otherwise print error message
-                        default:
-                            std::cerr << std::hex << "Unrecongized instruction " << (int)first << " " << (int)X << " " << (int)Y << " " << (int)N << std::dec << endl;
-                    }
-                    break;
-                
-                //jump PC to NNN
-                case 0x1:
-                    cout <<  std::hex << "jump to " << (int)NNN << std::dec << endl;
-                    PC = NNN;
-                    break;
-                
-                //jump PC to NNN and push old PC to stack
-                case 0x2:
-                    cout << "execute subroutine" << endl;
-                    stack.push(PC);
-                    PC = NNN;
-                    break;
-                
-                //skip next instruction if VX is equal to NN
-                case 0x3:
-                    cout << "skip next instruction if VX is equal to NN" << endl;
-                    if(registers[X] == NN){
-                        PC += 2;
-                    }
-                    break;
-
-                //skip next instruction if VX isn't equal to NN
-                case 0x4:
-                    cout << "skip next instruction if VX isn't equal to NN" << endl;
-                    if(registers[X] != NN){
-                        PC += 2;
-                    }
-                    break;
-                
-                //skip next instruction if VX equals VY
-                case 0x5:
-                    cout << "skip next instruction if VX equals VY" << endl;
-                    if(registers[X] == registers[Y]){
-                        PC += 2;
-                    }
-                    break;
-
-                //set register VX to value NN
-                case 0x6:
-                    cout << "set register" << endl;
-                    registers[X] = NN;
-                    break;
-                
-                //add value NN to register VX
-                case 0x7:
-                    cout << "add to register" << endl;    
-                    registers[X] += NN;
-                    break;
-                
-                //logic and arithmetic
-                case 0x8:
-                    switch(N){
-                        //set VX to VY
-                        case 0x0:
-                            cout << "set VX to VY" << endl;
-                            registers[X] = registers[Y];
-                            break;
-                        
-                        //binary OR
-                        case 0x1:
-                            cout << "binary OR" << endl;
-                            registers[X] = registers[X] | registers[Y];
-                            break;
-
-                        //binary AND
-                        case 0x2:
-                            cout << "binary AND" << endl;
-                            registers[X] = registers[X] & registers[Y];
-                            break;
-
-                        //binary XOR
-                        case 0x3:
-                            cout << "binary XOR" << endl;
-                            registers[X] = registers[X] ^ registers[Y];
-                            break;
-
-                        //Add
-                        case 0x4: {
-                            cout << "add" << endl;
-                            uint8_t vx = registers[X];
-                            uint8_t vy = registers[Y];
-
-                            registers[X] = vx + vy;
-
-                            if ((int)vx + (int)vy > 255){registers[0xF] = 1;} 
-                            else {registers[0xF] = 0;}
-                            
-                            break;
-                        }
-
-                        //Subtract VX-VY
-                        case 0x5: {
-                            cout << "subtract VX-VY" << endl; 
-
-                            uint8_t vx = registers[X];
-                            uint8_t vy = registers[Y];
-
-                            registers[X] = vx - vy;
-
-                            if ((int)vx >= (int)vy){registers[0xF] = 1;} 
-                            else {registers[0xF] = 0;}
-                            
-                            break;
-                        }
-                        
-                        //Shift right
-                        case 0x6: {
-                            cout << "shift right" << endl;
-                            if(!newShift){
-                                registers[X] = registers[Y];
-                            }
-                            uint8_t vx = registers[X];
-                            registers[X] = vx >> 1;
-                            registers[0xF] = vx & 0x01;
-                            break;
-                        }
-
-                        //Subtract VY-VX
-                        case 0x7: {
-                            cout << "subtract VY-VX" << endl;
-
-                            uint8_t vx = registers[X];
-                            uint8_t vy = registers[Y];
-
-                            registers[X] = vy - vx;
-
-                            if ((int)vy >= (int)vx){registers[0xF] = 1;} 
-                            else {registers[0xF] = 0;}
-
-                            break;
-                        }
-
-                        //Shift left
-                        case 0xE: {
-                            cout << "shift left" << endl;
-                            if(!newShift){
-                                registers[X] = registers[Y];
-                            }
-                            uint8_t vx = registers[X];
-                            registers[X] = vx << 1;
-                            registers[0xF] = (vx & 0x80) >> 7;
-                            break;
-                        }
-                    }
-                    break;
-
-                //skip next instruction if VX doesn't equal VY
-                case 0x9:
-                    cout << "skip next instruction if VX doesn't equal VY" << endl;
-                    if(registers[X] != registers[Y]){
-                        PC += 2;
-                    }
-                    break;
-
-                //set index register to value NNN
-                case 0xA:
-                    cout << "set index register" << endl;
-                    I = NNN;
-                    break;
-                
-                //jump with offset
-                case 0xB:
-                    cout << "jump with offset" << endl;
-                    PC = NNN;
-                    if (newJump){
-                        PC += registers[X];
-                    }
-                    break;
-
-                //random
-                case 0xC:
-                    cout << "random" << endl;
-                    registers[X] = distrib(gen) & NN;
-                    break;
-
-                //draw sprite
-                case 0xD: {
-                    cout << "draw sprite" << endl;
-                    uint8_t yCor = registers[Y]%HEIGHT;
-                    registers[0xF] = 0;
-
-                    for(int i = 0; i<N; i++){
-                        uint8_t xCor = registers[X]%WIDTH;
-                        uint8_t rowData = memory[I+i];
-                        for(int j = 0; j<8; j++){
-                            uint8_t pixel = rowData & (0x80 >> j);
-                            if(pixel){
-                                if(display[yCor*WIDTH + xCor]){
-                                    registers[0xF] = 1;
-                                }
-                                display[yCor*WIDTH + xCor] ^= 1;
-                            }
-                            
-                            xCor++;
-                            if (xCor >= WIDTH){
-                                break;
-                            }
-                        }
-                        yCor++;
-                        if (yCor >= HEIGHT){
-                            break;
-                        }
-                    }
-                    break;
-                }
-
-                //skip if key
-                case 0xE:
-                    switch(NN){
-                        //skip if key is pressed
-                        case 0x9E:
-                            if(registers[X] == keyPress)
-                                PC += 2;
-                            break;
-                        
-                        //skip if key isn't pressed
-                        case 0xA1:
-                            if(registers[X] != keyPress)
-                                PC += 2;
-                            break;
-                    }
-                    break;
-                
-                //timers
-                case 0xF:
-                    switch(NN){
-                        //set VX to delay timer value
-                        case 0x07:
-                            registers[X] = delay;
-                            break;
-
-                        //set delay timer to VX
-                        case 0x15:
-                            delay = registers[X];
-                            break;
-
-                        //set sound timer to VX
-                        case 0x18:
-                            sound = registers[X];
-                            break;
-                        
-                        //add to index
-                        case 0x1E: {
-                            uint8_t vx = registers[X];
-                            if((int)I+vx > 255)
-                                registers[0xF] = 1;
-                            I = I + vx;
-                            break;
-                        }
-
-                        //get key
-                        case 0x0A:
-                            if(keyPress > 0x0F){
-                                PC -= 2;
-                            }
-                            break;
-
-                        //font char
-                        case 0x29:
-                            I = 0x50 + (registers[X])*5;
-                            break;
-                        
-                        //decimal conversion
-                        case 0x33:
-                            int first,second,third;
-
-                            first = registers[X]/100;
-                            second = (registers[X]/10)%10;
-                            third = registers[X]%10;
-
-                            memory[I] = first;
-                            memory[I+1] = second;
-                            memory[I+2] = third;
-                            break;
-                        
-                        //store memory
-                        case 0x55:
-                            for(int i = 0; i <= X; i++){
-                                memory[I+i] = registers[i];
-                            }
-                            if(!newMemory){
-                                I = I+X+1;
-                            }
-                            break;
-
-                        //load memory
-                        case 0x65:
-                            for(int i = 0; i <= X; i++){
-                                registers[i] = memory[I+i];
-                            }
-                            if(!newMemory){
-                                I = I+X+1;
-                            }
-                            break;
-
-                        default:
-                            std::cerr << std::hex << "Unrecongized instruction " << (int)first << " " << (int)X << " " << (int)Y << " " << (int)N << std::dec << endl;
-
-                    }
-
-                default:
-                    std::cerr << std::hex << "Unrecongized instruction " << (int)first << " " << (int)X << " " << (int)Y << " " << (int)N << std::dec << endl;
-            }
+        //display thread: frame taken by the last acquire
+        const FrameBuffer& latest() const {
+            return buffers[front];
         }
 
-        //store last pressed key
-        void keyPressed(uint8_t key){
-            keyPress = key;
-            cout << "key pressed: " << key << endl;
+        //display thread: key event time carried by the frame taken by the last acquire
+        uint64_t latestInput() const {
+            return inputs[front];
         }
 };
 
@@ -543,124 +81,561 @@ class Display {
     private:
         SDL_Window* window;
         SDL_Renderer* renderer;
+        SDL_Texture* texture; //streaming texture the size of the scaler's output
+        Scaler scaler;
+        SDL_Rect placed; //texture enlarged by a whole number, centered in the window
+
+        //timing of presented frames, in seconds
+        uint64_t presented = 0;
+        uint64_t skipped = 0;
+        double frameTotal = 0, frameMax = 0;
+        double uploadTotal = 0, uploadMax = 0;
+        vector<double> latencies; //key event to present of the first frame showing it, in seconds
 
     public:
-        //initialize display
-        Display(){
+        //initialize display, the screen is filtered on the CPU at a small multiple and the renderer
+        //enlarges it, nearest pixel, to the largest whole multiple fitting the window
+        Display(ScaleFilter filter, int windowWidth, int windowHeight): scaler(filter, windowWidth, windowHeight){
             if (SDL_Init(SDL_INIT_VIDEO) < 0)
                 std::cerr << "SDL_Init failed: " << SDL_GetError() << std::endl;
-            window = SDL_CreateWindow("chip 8 window", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, WIDTH*DISPLAYSCALE, HEIGHT*DISPLAYSCALE, SDL_WINDOW_SHOWN);
+            window = SDL_CreateWindow("chip 8 window", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, windowWidth, windowHeight, SDL_WINDOW_SHOWN);
             renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+            SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
+            texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, scaler.textureWidth(), scaler.textureHeight());
+            placed = {(windowWidth - scaler.width())/2, (windowHeight - scaler.height())/2, scaler.width(), scaler.height()};
         }
 
-        //update screen using framebuffer
-        void drawScreen(bool display[]){
-            SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);         // black
-            SDL_RenderClear(renderer);                              // set background black
+        //update screen using framebuffer: the scaler writes the filtered image straight into the
+        //locked texture, so each changed frame is uploaded once, and the renderer enlarges it
+        void drawScreen(const FrameBuffer& display){
+            auto start = chrono::steady_clock::now();
 
-            SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);         // white
-            for (int y = 0; y<HEIGHT; y++){                         // iterate through pixels, if filled draw a white rectangle
-                for (int x = 0; x<WIDTH; x++){
-                    if(display[y*WIDTH+x]){
-                        SDL_Rect rect = {x*DISPLAYSCALE, y*DISPLAYSCALE, DISPLAYSCALE, DISPLAYSCALE};
-                        SDL_RenderFillRect(renderer, &rect);
-                    }
-                }
+            void* pixels;
+            int pitch;
+            if(SDL_LockTexture(texture, nullptr, &pixels, &pitch) == 0){
+                scaler.scale(display, static_cast<uint32_t*>(pixels), pitch);
+                SDL_UnlockTexture(texture);
             }
+            auto uploaded = chrono::steady_clock::now();
 
+            SDL_RenderClear(renderer);
+            SDL_RenderCopy(renderer, texture, nullptr, &placed);
             SDL_RenderPresent(renderer);    //render the frame
+
+            double upload = chrono::duration<double>(uploaded - start).count();
+            double frame = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            presented++;
+            uploadTotal += upload;
+            uploadMax = max(uploadMax, upload);
+            frameTotal += frame;
+            frameMax = max(frameMax, frame);
+        }
+
+        //count a display tick where nothing changed and nothing was drawn
+        void skipFrame(){
+            skipped++;
+        }
+
+        //a frame showing a key event stamped at input (inputClock time) was just presented
+        void inputPresented(uint64_t input){
+            latencies.push_back((inputClock() - input)*1e-9);
+        }
+
+        //print frame and upload timings, and key-to-present latency percentiles
+        void printStats(ostream& out) const {
+            out << "display: " << presented << " frames presented, " << skipped << " unchanged ticks skipped, "
+                << scaler.textureWidth() << "x" << scaler.textureHeight() << " filtered with " << simdName(scaler.level())
+                << ", shown at " << scaler.width() << "x" << scaler.height() << endl;
+            if(presented){
+                out << "frame time avg " << frameTotal/presented*1000 << "ms max " << frameMax*1000 << "ms, "
+                    << "upload time avg " << uploadTotal/presented*1000 << "ms max " << uploadMax*1000 << "ms" << endl;
+            }
+            if(!latencies.empty()){
+                vector<double> sorted = latencies;
+                sort(sorted.begin(), sorted.end());
+                double total = 0;
+                for(double l : sorted)
+                    total += l;
+                out << "input latency over " << sorted.size() << " frames: avg " << total/sorted.size()*1000
+                    << "ms p50 " << sorted[sorted.size()/2]*1000 << "ms p99 " << sorted[sorted.size()*99/100]*1000
+                    << "ms max " << sorted.back()*1000 << "ms" << endl;
+            }
+        }
+
+        //one key-to-present latency in milliseconds per line
+        bool writeLatencies(const string& filename) const {
+            ofstream out(filename);
+            if(!out.is_open()){
+                cerr << "Failed to open latency log " << filename << endl;
+                return false;
+            }
+            for(double l : latencies)
+                out << l*1000 << "\n";
+            return out.good();
         }
 
         //close display
         ~Display(){
+            SDL_DestroyTexture(texture);
             SDL_DestroyRenderer(renderer);
             SDL_DestroyWindow(window);
             SDL_Quit();
         }
 };
 
-void emuLoop(Emulator* emu, bool* running){
-    
-    while(*running){
-        emu->decode(emu->fetch());
-        SDL_Delay(1);
+//SDL audio device playing the beeper. The emu thread only pushes each frame's sound state
+//onto the queue; the device's callback turns it into samples, so neither side waits on the other
+class Audio {
+    private:
+        SDL_AudioDeviceID device = 0;
+        AudioQueue queue;
+        unique_ptr<AudioSynth> synth;
+        double bufferDelay = 0; //seconds of samples the device buffers
+
+        static void callback(void* userdata, Uint8* stream, int length){
+            Audio* audio = static_cast<Audio*>(userdata);
+            audio->synth->fill(reinterpret_cast<int16_t*>(stream), length/sizeof(int16_t), audio->queue, inputClock(), audio->bufferDelay);
+        }
+
+    public:
+        //open the default device (SDL_AUDIODRIVER=dummy works without sound hardware),
+        //on failure the emulator runs silent
+        Audio(){
+            if(SDL_InitSubSystem(SDL_INIT_AUDIO) < 0){
+                std::cerr << "Audio unavailable: " << SDL_GetError() << std::endl;
+                return;
+            }
+            SDL_AudioSpec want, have;
+            memset(&want, 0, sizeof(want));
+            want.freq = 48000;
+            want.format = AUDIO_S16SYS;
+            want.channels = 1;
+            want.samples = 512; //about 10ms
+            want.callback = callback;
+            want.userdata = this;
+            device = SDL_OpenAudioDevice(nullptr, 0, &want, &have, 0);
+            if(!device){
+                std::cerr << "Failed to open audio: " << SDL_GetError() << std::endl;
+                return;
+            }
+            synth.reset(new AudioSynth(have.freq));
+            bufferDelay = (double)have.samples/have.freq;
+            SDL_PauseAudioDevice(device, 0);
+        }
+
+        //where the emu thread publishes frames, null if there is no device
+        AudioQueue* frames(){
+            return device ? &queue : nullptr;
+        }
+
+        //stop the callback, after which the statistics can be read
+        void close(){
+            if(device)
+                SDL_CloseAudioDevice(device);
+            device = 0;
+        }
+
+        void printStats(ostream& out) const {
+            if(!synth)
+                return;
+            out << "audio (" << SDL_GetCurrentAudioDriver() << "): " << synth->framesPlayed() << " frames played, "
+                << synth->underrunCount() << " underruns, " << synth->skippedCount() << " skipped, "
+                << queue.dropped() << " dropped, latency avg " << synth->latencyAverage()*1000
+                << "ms max " << synth->latencyWorst()*1000 << "ms" << endl;
+        }
+
+        ~Audio(){
+            close();
+            SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        }
+};
+
+//settings for the real-time scheduler
+struct SchedulerConfig {
+    uint32_t ips = INSTFREQ; //instructions per second
+    bool turbo = false; //run frames back to back without sleeping
+    uint32_t rewindSeconds = 10; //history kept for rewinding, 0 turns it off
+    size_t rewindBytes = 8 << 20; //memory cap for the rewind history
+};
+
+//what the scheduler measured over a run
+struct SchedulerStats {
+    uint64_t instructions = 0;
+    uint64_t frames = 0;
+    double seconds = 0;
+    double driftTotal = 0, driftMax = 0; //how late frames started, in seconds
+    uint64_t resyncs = 0; //times the schedule was reset after falling too far behind
+    uint64_t idleFrames = 0; //frames that ended in a spin-wait, skipped rather than executed
+
+    void print(ostream& out, const SchedulerConfig& config) const {
+        out << "emulation: " << instructions << " instructions in " << frames << " frames over " << seconds << "s, "
+            << (seconds > 0 ? instructions/seconds : 0) << " instructions/s measured (target " << (config.turbo ? string("turbo") : to_string(config.ips)) << ")" << endl;
+        if(frames){
+            out << "frame drift avg " << driftTotal/frames*1000 << "ms max " << driftMax*1000 << "ms, "
+                << resyncs << " resyncs, " << idleFrames << " frames idle" << endl;
+        }
+    }
+};
+
+//registers, timers and the instruction at PC
+void printMachine(ostream& out, const MachineState& s){
+    out << hex << uppercase << setfill('0');
+    for(int r = 0; r < 16; r++)
+        out << "V" << r << "=" << setw(2) << (int)s.registers[r] << (r % 8 == 7 ? "\n" : " ");
+    out << "PC=" << setw(4) << s.PC << " [" << setw(4) << (s.memory[s.PC]*0x100 + s.memory[(uint16_t)(s.PC + 1)]) << "]"
+        << " I=" << setw(4) << s.I << " SP=" << (int)s.SP << " DT=" << setw(2) << (int)s.delay << " ST=" << setw(2) << (int)s.sound << endl;
+    out << dec << nouppercase << setfill(' ');
+}
+
+//paused debugger prompt on stdin, run on the emu thread so the machine can't change under it;
+//returns false to quit
+bool debugConsole(Emulator* emu, Debugger* debugger){
+    const WatchHit& hit = debugger->lastHit();
+    if(hit.kind){
+        cout << hex << uppercase << setfill('0') << watchKindName(hit.kind) << " at " << setw(4) << hit.addr
+             << " by " << setw(4) << hit.pc << " " << setw(4) << hit.instruct << dec << nouppercase << setfill(' ') << endl;
     }
+    printMachine(cout, emu->machine());
+    string line;
+    while(cout << "debug> " << flush && getline(cin, line)){
+        istringstream words(line);
+        string command, arg;
+        words >> command >> arg;
+        uint16_t addr;
+        uint32_t length;
+        uint8_t kinds = WATCH_READ | WATCH_WRITE;
+        if(command == "c"){
+            debugger->resume();
+            return true;
+        }
+        else if(command == "s"){
+            uint32_t steps = 1;
+            if(!arg.empty() && !parseNumber(arg, steps))
+                continue;
+            debugger->resume();
+            for(uint32_t i = 0; i < steps && !debugger->paused(); i++)
+                emu->step();
+            if(!debugger->paused())
+                debugger->pause();
+            printMachine(cout, emu->machine());
+        }
+        else if(command == "r")
+            printMachine(cout, emu->machine());
+        else if(command == "m" && parseWatch(arg, addr, length, kinds)){
+            length = length > 1 ? length : 16;
+            cout << hex << uppercase << setfill('0');
+            for(uint32_t i = 0; i < length; i++){
+                uint16_t a = addr + i;
+                if(i % 16 == 0)
+                    cout << (i ? "\n" : "") << setw(4) << a << ":";
+                cout << " " << setw(2) << (int)emu->peek(a);
+            }
+            cout << dec << nouppercase << setfill(' ') << endl;
+        }
+        else if(command == "b" && parseWatch(arg, addr, length, kinds))
+            debugger->arm(addr, 1, WATCH_EXEC);
+        else if(command == "w" && parseWatch(arg, addr, length, kinds))
+            debugger->arm(addr, length, kinds);
+        else if(command == "d" && parseWatch(arg, addr, length, kinds))
+            debugger->disarm(addr, length);
+        else if(command == "l"){
+            for(const pair<uint16_t, uint8_t>& entry : debugger->list()){
+                cout << hex << uppercase << setfill('0') << setw(4) << entry.first << dec << nouppercase << setfill(' ')
+                     << (entry.second & WATCH_EXEC ? " break" : "") << (entry.second & WATCH_READ ? " read" : "")
+                     << (entry.second & WATCH_WRITE ? " write" : "") << endl;
+            }
+        }
+        else if(command == "q")
+            return false;
+        else {
+            cout << "c continue, s [N] step, r registers, m ADDR[+LEN] memory, b ADDR break, "
+                    "w ADDR[+LEN][:rwx] watch, d ADDR[+LEN] delete, l list, q quit" << endl;
+        }
+    }
+    return false;
 }
 
-void disLoop(Emulator* emu, Display* dis, bool* running){
+//run instructions in per-frame batches on a steady clock, ticking timers on frame boundaries;
+//each frame is recorded into history, and while rewinding is held frames are played back from it instead.
+//key events queued by the display thread are applied before each frame's batch, and the sound
+//state after each tick is pushed to audio unless it is null. When a breakpoint or watchpoint
+//pauses debugger, the thread sits in the console until told to continue. Every change to the
+//held keys goes into recording, if there is one, with the instruction count it was applied at.
+//profiler, if not null, is attached here and detached on return, since its counters belong to this thread
+void emuLoop(Emulator* emu, FrameExchange* frames, InputQueue* input, AudioQueue* audio, atomic<bool>* running, atomic<bool>* rewinding, RewindBuffer* history, Debugger* debugger, Recording* recording, Profiler* profiler, SchedulerConfig config, SchedulerStats* stats){
+    if(profiler)
+        emu->setProfiler(profiler);
+    typedef chrono::steady_clock Clock;
+    const Clock::duration frameLength = chrono::duration_cast<Clock::duration>(chrono::duration<double>(1.0/TIMERFREQ));
+    const Clock::duration maxLag = frameLength*15;
+
+    Clock::time_point start = Clock::now();
+    Clock::time_point epoch = start; //frame 0 of the current schedule
+    uint64_t epochFrame = 0;
+    uint64_t done = 0; //instructions owed by the schedule so far
+    MachineState snapshot;
+    uint64_t unshown = 0; //oldest key event applied since the last published frame
+
+    while(running->load()){
+        uint64_t applied = recording ? emu->applyInput(*input, [&](uint16_t keys){ recording->record(stats->instructions, keys); })
+                                     : emu->applyInput(*input);
+        if(applied && !unshown)
+            unshown = applied;
+
+        //spread ips over frames without losing the remainder
+        uint64_t frame = stats->frames + 1;
+        uint64_t target = frame*config.ips/TIMERFREQ;
+        if(history && rewinding->load(memory_order_relaxed)){
+            if(history->pop(&snapshot))
+                emu->restore(snapshot);
+        }
+        else {
+            //a frame spent polling the delay timer or waiting for a key costs O(1) here,
+            //and the thread sleeps until the tick that can change the outcome
+            emu->run(target - done);
+            stats->instructions += target - done;
+            //the schedule resyncs after the console, the frame just ends early
+            if(debugger && debugger->paused() && !debugConsole(emu, debugger)){
+                running->store(false);
+                break;
+            }
+            if(emu->idle())
+                stats->idleFrames++;
+            emu->decrementTimers();
+            if(history){
+                emu->save(snapshot);
+                history->push(&snapshot);
+            }
+        }
+        done = target;
+
+        if(audio){
+            AudioFrame sound = {inputClock(), emu->soundTimer(), emu->audioPitch(), {}, emu->audioPatternLoaded()};
+            memcpy(sound.pattern, emu->audioPattern(), sizeof(sound.pattern));
+            audio->push(sound);
+        }
+
+        //a frame is published after input even if unchanged, so its latency is measured
+        if(emu->takeDirty() || unshown){
+            frames->publish(emu->getDisplay(), unshown);
+            unshown = 0;
+        }
+        stats->frames = frame;
+
+        if(config.turbo)
+            continue;
+
+        Clock::time_point deadline = epoch + (frame - epochFrame)*frameLength;
+        Clock::time_point now = Clock::now();
+        if(now < deadline){
+            this_thread::sleep_until(deadline);
+            now = Clock::now();
+        }
+
+        double drift = chrono::duration<double>(now - deadline).count();
+        stats->driftTotal += drift;
+        stats->driftMax = max(stats->driftMax, drift);
+
+        //after a stall, start a new schedule rather than running a burst of catch-up frames
+        if(now - deadline > maxLag){
+            epoch = now;
+            epochFrame = frame;
+            stats->resyncs++;
+        }
+    }
+    stats->seconds = chrono::duration<double>(Clock::now() - start).count();
+    emu->setProfiler(nullptr);
+}
+
+//CHIP-8 key for a keyboard key (0-9, A-F), -1 for keys the machine doesn't have
+int chipKey(SDL_Keycode sym){
+    if(sym >= SDLK_0 && sym <= SDLK_9)
+        return sym - SDLK_0;
+    if(sym >= SDLK_a && sym <= SDLK_f)
+        return sym - SDLK_a + 10;
+    return -1;
+}
+
+void disLoop(FrameExchange* frames, InputQueue* input, Display* dis, atomic<bool>* running, atomic<bool>* rewinding){
     SDL_Event e;
-    while(*running){
+    bool redraw = true; //window contents need repainting even if the frame is unchanged
+    while(running->load()){
         while(SDL_PollEvent(&e)){
             if(e.type == SDL_QUIT){
-                *running = false;
+                running->store(false);
+            }
+            else if (e.type == SDL_WINDOWEVENT){
+                redraw = true;
             }
-            else if (e.type == SDL_KEYDOWN){
-                switch(e.key.keysym.sym){
-                    case SDLK_a:
-                        emu->keyPressed(10);
-                        break;
-                    case SDLK_b:
-                        emu->keyPressed(11);
-                        break;
-                    case SDLK_c:
-                        emu->keyPressed(12);
-                        break;
-                    case SDLK_d:
-                        emu->keyPressed(13);
-                        break;
-                    case SDLK_e:
-                        emu->keyPressed(14);
-                        break;
-                    case SDLK_f:
-                        emu->keyPressed(15);
-                        break;
-                    case SDLK_0:
-                        emu->keyPressed(0);
-                        break;
-                    case SDLK_1:
-                        emu->keyPressed(1);
-                        break;
-                    case SDLK_2:
-                        emu->keyPressed(2);
-                        break;
-                    case SDLK_3:
-                        emu->keyPressed(3);
-                        break;
-                    case SDLK_4:
-                        emu->keyPressed(4);
-                        break;
-                    case SDLK_5:
-                        emu->keyPressed(5);
-                        break;
-                    case SDLK_6:
-                        emu->keyPressed(6);
-                        break;
-                    case SDLK_7:
-                        emu->keyPressed(7);
-                        break;
-                    case SDLK_8:
-                        emu->keyPressed(8);
-                        break;
-                    case SDLK_9:
-                        emu->keyPressed(9);
-                        break;
-                }
+            //hold backspace to rewind
+            else if ((e.type == SDL_KEYDOWN || e.type == SDL_KEYUP) && e.key.keysym.sym == SDLK_BACKSPACE){
+                rewinding->store(e.type == SDL_KEYDOWN, memory_order_relaxed);
             }
-            else if (e.type == SDL_KEYUP) {
-                emu->keyPressed(0xFF);   // no key pressed
+            //queue presses and releases for the emu thread, ignoring auto-repeat
+            else if ((e.type == SDL_KEYDOWN || e.type == SDL_KEYUP) && !e.key.repeat){
+                int key = chipKey(e.key.keysym.sym);
+                if(key >= 0)
+                    input->push({inputClock(), (uint8_t)key, e.type == SDL_KEYDOWN});
             }
         }
-        dis->drawScreen(emu->getDisplay());
-        emu->decrementTimers();
+        bool fresh = frames->acquire();
+        if(fresh || redraw){
+            dis->drawScreen(frames->latest());
+            if(fresh && frames->latestInput())
+                dis->inputPresented(frames->latestInput());
+            redraw = false;
+        }
+        else
+            dis->skipFrame();
         SDL_Delay(16);
     }
 }
 
 
 int main (int argc, char* argv[]){
-    Emulator emu = Emulator();
-    Display dis = Display();
-    emu.load(FILENAME);
+    if(argc > 1 && string(argv[1]) == "--headless")
+        return runHeadless(argc - 1, argv + 1);
+
+    SchedulerConfig config;
+    Profile profile = PROFILE_CUSTOM;
+    string loadSnapshot, saveSnapshot, traceFile, profilePrefix, latencyLog;
+    bool mute = false;
+    unique_ptr<Debugger> debugger;
+    string recordFile;
+    string romFile = FILENAME;
+    bool romGiven = false;
+    uint32_t seed = random_device{}();
+    ScaleFilter filter = FILTER_NEAREST;
+    int windowWidth = WIDTH*DISPLAYSCALE, windowHeight = HEIGHT*DISPLAYSCALE;
+
+    for(int i = 1; i < argc; i++){
+        string arg = argv[i];
+        bool hasValue = i+1 < argc;
+        if(arg == "--trace" && hasValue){
+            if(!traceSupported())
+                return 1;
+            traceFile = argv[++i];
+        }
+        else if(arg == "--ips" && hasValue){
+            if(!parseNumber(argv[++i], config.ips))
+                return 1;
+        }
+        else if(arg == "--turbo")
+            config.turbo = true;
+        else if(arg == "--quirks" && hasValue){
+            if(!parseProfile(argv[++i], profile))
+                return 1;
+        }
+        else if(arg == "--rewind" && hasValue){
+            if(!parseNumber(argv[++i], config.rewindSeconds))
+                return 1;
+        }
+        else if(arg == "--rewind-mb" && hasValue){
+            if(!parseNumber(argv[++i], config.rewindBytes))
+                return 1;
+            config.rewindBytes <<= 20;
+        }
+        else if(arg == "--load-snapshot" && hasValue)
+            loadSnapshot = argv[++i];
+        else if(arg == "--save-snapshot" && hasValue)
+            saveSnapshot = argv[++i];
+        else if(arg == "--profile" && hasValue)
+            profilePrefix = argv[++i];
+        else if(arg == "--latency-log" && hasValue)
+            latencyLog = argv[++i];
+        else if(arg == "--mute")
+            mute = true;
+        else if(arg == "--seed" && hasValue){
+            if(!parseNumber(argv[++i], seed))
+                return 1;
+        }
+        else if(arg == "--record" && hasValue)
+            recordFile = argv[++i];
+        else if((arg == "--break" || arg == "--watch") && hasValue){
+            uint16_t addr;
+            uint32_t length;
+            uint8_t kinds = arg == "--break" ? WATCH_EXEC : WATCH_READ | WATCH_WRITE;
+            if(!parseWatch(argv[++i], addr, length, kinds)){
+                cerr << "Watchpoints are ADDR[+LEN][:rwx], ADDR in hex" << endl;
+                return 1;
+            }
+            if(!debugger)
+                debugger.reset(new Debugger());
+            debugger->arm(addr, length, kinds);
+        }
+        else if(arg == "--debug"){
+            if(!debugger)
+                debugger.reset(new Debugger());
+            debugger->pause();
+        }
+        else if(arg == "--filter" && hasValue){
+            if(!parseScaleFilter(argv[++i], filter))
+                return 1;
+        }
+        else if(arg == "--window" && hasValue){
+            if(sscanf(argv[++i], "%dx%d", &windowWidth, &windowHeight) != 2 || windowWidth < 1 || windowHeight < 1){
+                cerr << "Window size must be WIDTHxHEIGHT" << endl;
+                return 1;
+            }
+        }
+        else if(arg.compare(0, 2, "--") != 0 && !romGiven){
+            romFile = arg;
+            romGiven = true;
+        }
+        else {
+            cerr << "Unknown option " << arg << endl;
+            return 1;
+        }
+    }
+
+    //a recording has to be replayable from the ROM and seed alone: rewinding restores old
+    //states, and the debugger can pause or step the machine off the frame schedule
+    unique_ptr<Recording> recording;
+    if(!recordFile.empty()){
+        if(debugger || !loadSnapshot.empty()){
+            cerr << "--record can't be combined with the debugger or --load-snapshot" << endl;
+            return 1;
+        }
+        shared_ptr<const RomImage> rom = RomCache::global().get(romFile);
+        if(!rom)
+            return 1;
+        recording.reset(new Recording());
+        recording->rom = romFile;
+        recording->romHash = rom->hash();
+        recording->seed = seed;
+        recording->profile = profile;
+        recording->ips = config.ips;
+        config.rewindSeconds = 0;
+    }
+
+    Emulator emu(seed, profile);
+
+#ifdef CHIP8_TRACE
+    unique_ptr<Tracer> tracer;
+    if(!traceFile.empty()){
+        tracer.reset(Tracer::open(traceFile.c_str()));
+        if(!tracer){
+            cerr << "Failed to open trace file " << traceFile << endl;
+            return 1;
+        }
+        emu.setTracer(tracer.get());
+    }
+#endif
+
+    unique_ptr<Profiler> profiler;
+    if(!profilePrefix.empty())
+        profiler.reset(new Profiler());
+
+    emu.setDebugger(debugger.get());
+
+    Display dis(filter, windowWidth, windowHeight);
+    unique_ptr<Audio> audio;
+    if(!mute)
+        audio.reset(new Audio());
+    if(!emu.load(romFile.c_str()))
+        return 1;
+    if(!loadSnapshot.empty() && !emu.loadSnapshot(loadSnapshot.c_str()))
+        return 1;
 
     /*
     uint16_t instruct;
@@ -672,13 +647,43 @@ int main (int argc, char* argv[]){
     */
 
     
-    bool running = true;
-
-    thread emuThread(emuLoop, &emu, &running);
+    atomic<bool> running(true);
+    atomic<bool> rewinding(false);
+    SchedulerStats stats;
+    FrameExchange frames;
+    InputQueue input;
+    unique_ptr<RewindBuffer> history;
+    if(config.rewindSeconds)
+        history.reset(new RewindBuffer(sizeof(MachineState), config.rewindBytes, config.rewindSeconds*TIMERFREQ));
+
+    thread emuThread(emuLoop, &emu, &frames, &input, audio ? audio->frames() : nullptr, &running, &rewinding, history.get(), debugger.get(), recording.get(), profiler.get(), config, &stats);
     
-    disLoop(&emu, &dis, &running);
+    disLoop(&frames, &input, &dis, &running, &rewinding);
     
     emuThread.join();
+    if(audio)
+        audio->close();
+    if(!saveSnapshot.empty())
+        emu.saveSnapshot(saveSnapshot.c_str());
+    if(recording){
+        recording->frames = stats.frames;
+        recording->instructions = stats.instructions;
+        recording->stateHash = hashMachine(emu);
+        if(!writeRecording(recordFile, *recording))
+            return 1;
+        cout << "recorded " << recording->events.size() << " key changes over " << stats.frames << " frames to " << recordFile
+             << ", state " << hex << recording->stateHash << dec << endl;
+    }
+    stats.print(cout, config);
+    dis.printStats(cout);
+    if(audio)
+        audio->printStats(cout);
+    if(input.dropped())
+        cout << input.dropped() << " key events dropped, input queue full" << endl;
+    if(!latencyLog.empty() && !dis.writeLatencies(latencyLog))
+        return 1;
+    if(profiler && !writeProfile(*profiler, profilePrefix))
+        return 1;
     
 
     return 0;
@@ -0,0 +1,2530 @@
+#ifndef EMULATOR_H
+#define EMULATOR_H
+
+#include <iostream>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <limits>
+#include <fstream>
+#include <random>
+#include <vector>
+#include <atomic>
+#include <string>
+#include <algorithm>
+#include <bitset>
+#include <type_traits>
+#include <chrono>
+#include "trace.h"
+#include "profile.h"
+#include "debugger.h"
+#include "input.h"
+
+const int WIDTH = 64; //lo-res screen
+const int HEIGHT = 32;
+const int HIRESWIDTH = 128; //SUPER-CHIP hi-res screen
+const int HIRESHEIGHT = 64;
+const int ROWWORDS = HIRESWIDTH/64; //words per packed screen row
+const int PLANES = 2; //XO-CHIP bitplanes
+const int MEMORYSIZE = 0x10000; //XO-CHIP address space
+const int INSTFREQ = 1000;
+const int TIMERFREQ = 60; //delay and sound timers tick once per frame
+
+//modifiable instructions (the custom quirk profile)
+const bool newShift = false;
+const bool newJump = false;
+const bool newMemory = false;
+
+//what FX55/FX65 leave in I
+enum MemoryQuirk {
+    MEMORY_INCREMENT, //I = I+X+1 (COSMAC VIP)
+    MEMORY_INCREMENT_X, //I = I+X (CHIP-48)
+    MEMORY_UNCHANGED //I stays put (SUPER-CHIP)
+};
+
+//quirk profiles, each one instantiates its own set of handlers so the inner loop never checks them
+struct QuirksVip {
+    static constexpr bool shift = false; //8XY6/8XYE shift VY into VX
+    static constexpr bool jump = false; //BNNN jumps to NNN+V0
+    static constexpr MemoryQuirk memory = MEMORY_INCREMENT;
+    static constexpr bool vfReset = true; //8XY1/8XY2/8XY3 clear VF
+    static constexpr bool wrap = false; //sprites are clipped at the screen edges
+};
+
+struct QuirksChip48 {
+    static constexpr bool shift = true; //8XY6/8XYE shift VX in place
+    static constexpr bool jump = true; //BXNN jumps to XNN+VX
+    static constexpr MemoryQuirk memory = MEMORY_INCREMENT_X;
+    static constexpr bool vfReset = false;
+    static constexpr bool wrap = false;
+};
+
+struct QuirksSuperChip {
+    static constexpr bool shift = true;
+    static constexpr bool jump = true;
+    static constexpr MemoryQuirk memory = MEMORY_UNCHANGED;
+    static constexpr bool vfReset = false;
+    static constexpr bool wrap = false;
+};
+
+struct QuirksXoChip {
+    static constexpr bool shift = false;
+    static constexpr bool jump = false;
+    static constexpr MemoryQuirk memory = MEMORY_INCREMENT;
+    static constexpr bool vfReset = false;
+    static constexpr bool wrap = true; //sprites wrap around to the opposite edge
+};
+
+//edit the constants above to change it
+struct QuirksCustom {
+    static constexpr bool shift = newShift;
+    static constexpr bool jump = newJump;
+    static constexpr MemoryQuirk memory = newMemory ? MEMORY_UNCHANGED : MEMORY_INCREMENT;
+    static constexpr bool vfReset = false;
+    static constexpr bool wrap = false;
+};
+
+//quirk profile picked at startup
+enum Profile {
+    PROFILE_CUSTOM,
+    PROFILE_VIP,
+    PROFILE_CHIP48,
+    PROFILE_SUPERCHIP,
+    PROFILE_XOCHIP
+};
+
+//command line name of each profile, indexed by Profile
+const char* const PROFILENAMES[] = {"custom", "vip", "chip48", "schip", "xochip"};
+
+//profile by command line name, returns false if unknown
+inline bool parseProfile(const std::string& name, Profile& profile){
+    for(int p = PROFILE_CUSTOM; p <= PROFILE_XOCHIP; p++){
+        if(name == PROFILENAMES[p]){
+            profile = (Profile)p;
+            return true;
+        }
+    }
+    std::cerr << "Unknown quirk profile " << name << " (custom, vip, chip48, schip, xochip)" << std::endl;
+    return false;
+}
+
+//unsigned number making up all of text, in base, that fits in value; returns false and says
+//so if it isn't one, rather than throwing like stoul
+template<class T>
+inline bool parseNumber(const std::string& text, T& value, int base = 10){
+    const char* start = text.c_str();
+    char* end;
+    errno = 0;
+    unsigned long long n = strtoull(start, &end, base);
+    if(end == start || *end || text.find('-') != std::string::npos || errno == ERANGE || n > std::numeric_limits<T>::max()){
+        std::cerr << "Not a number: " << text << std::endl;
+        return false;
+    }
+    value = n;
+    return true;
+}
+
+//runtime copy of a profile, only read by the reference switch
+struct QuirkFlags {
+    bool shift;
+    bool jump;
+    MemoryQuirk memory;
+    bool vfReset;
+    bool wrap;
+
+    template<class Q>
+    static QuirkFlags of(){
+        return {Q::shift, Q::jump, Q::memory, Q::vfReset, Q::wrap};
+    }
+};
+
+//packed framebuffer, stored as columns of words: planes[p][w][y] holds pixels 64w to 64w+63
+//of row y with the leftmost in the top bit. Hi-res uses all 128x64 pixels, lo-res only the
+//first 32 words of column 0, so lo-res draws and clears touch one small contiguous array
+struct FrameBuffer {
+    uint64_t planes[PLANES][ROWWORDS][HIRESHEIGHT];
+    bool hires; //128x64 mode (00FF), cleared by 00FE
+};
+
+//architectural state of the machine, plain data so saving and restoring is one memcpy;
+//the fields touched by every instruction share the first cache line
+struct alignas(64) MachineState {
+    uint8_t registers[16]; //general purpose variable registers
+    uint16_t PC; //program counter
+    uint16_t I; //index register
+    uint8_t SP; //stack pointer
+    uint8_t delay; //delay timer
+    uint8_t sound; //sound timer
+    uint8_t keyWait; //FX0A progress: 0, KEYWAITPRESS, or KEYWAITRELEASE | key
+    uint64_t rng; //xorshift64* random generator state
+    uint16_t stack[16]; //address stack
+    uint8_t planes; //bitplanes selected by FN01, bit 0 is plane 1
+    uint8_t pitch; //XO-CHIP audio playback rate (FX3A)
+    uint8_t audio[16]; //XO-CHIP audio pattern buffer (F002)
+    uint8_t patternLoaded; //F002 has run, so audio is the program's even if it is all zero
+    uint8_t flags[16]; //SUPER-CHIP persistent flag registers (FX75/FX85)
+    FrameBuffer screen; //current state of display
+    uint8_t memory [MEMORYSIZE]; //64KB of RAM memory
+};
+static_assert(std::is_trivially_copyable<MachineState>::value, "MachineState must stay plain data");
+
+//FX0A progress in MachineState::keyWait
+const uint8_t KEYWAITPRESS = 0x80; //waiting for any key to go down
+const uint8_t KEYWAITRELEASE = 0x40; //low nibble went down, waiting for it to come up
+
+//snapshot file: header followed by the raw MachineState (host byte order)
+const uint32_t SNAPSHOTVERSION = 4;
+struct SnapshotHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t size; //sizeof(MachineState) when written
+};
+
+//class to handle main emulation
+class Emulator {
+    private:
+        MachineState state; //everything a snapshot needs
+        uint16_t keys = 0; //keys held down, bit n for key n
+        uint16_t keyPresses = 0; //keys pressed since FX0A started waiting
+        bool dirty; //framebuffer changed since it was last published
+
+    public:
+        Emulator(Profile profile = PROFILE_CUSTOM): Emulator(std::random_device{}(), profile){}
+
+        //seeded constructor so headless runs are reproducible
+        Emulator(uint32_t seed, Profile profile = PROFILE_CUSTOM){
+            selectProfile(profile);
+
+            //start from the shared power-on state so runs are reproducible
+            memcpy(&state, &blankState(), sizeof(state));
+            state.rng = seedRandom(seed);
+            dirty = true;
+        }
+
+        //credit what the profiler hasn't been given yet
+        ~Emulator(){
+            if(profile)
+                flushProfile();
+        }
+
+        //power-on state shared by every instance: zeroed memory with the fonts loaded, built once
+        static const MachineState& blankState(){
+            static const MachineState state = [](){
+                MachineState blank;
+                memset(&blank, 0, sizeof(blank));
+
+                //store font data in memory from 050-09F
+                uint8_t font[80] = {
+                    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+                    0x20, 0x60, 0x20, 0x20, 0x70, // 1
+                    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+                    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+                    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+                    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+                    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+                    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+                    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+                    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+                    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+                    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+                    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+                    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+                    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+                    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+                };
+                for(int i = 0; i < 80; i++){
+                    blank.memory[0x50+i] = font[i];
+                }
+
+                //store SUPER-CHIP/XO-CHIP 8x10 font data in memory from 0A0-13F
+                uint8_t bigFont[160] = {
+                    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+                    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+                    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+                    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+                    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+                    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+                    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+                    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+                    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+                    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+                    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+                    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+                    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+                    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+                    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+                    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+                };
+                for(int i = 0; i < 160; i++){
+                    blank.memory[0xA0+i] = bigFont[i];
+                }
+
+                //load timers at max
+                blank.delay = 255;
+                blank.sound = 255;
+
+                //screen, registers and stack start empty, drawing to plane 1 in lo-res
+                blank.planes = 1;
+                blank.pitch = 64;
+
+                //initialize pointers
+                blank.PC = 0x200;
+                return blank;
+            }();
+            return state;
+        }
+
+        //spread a 32 bit seed over the generator state (splitmix64), never zero
+        static uint64_t seedRandom(uint32_t seed){
+            uint64_t z = seed + 0x9E3779B97F4A7C15ull;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            z ^= z >> 31;
+            return z ? z : 1;
+        }
+
+        //start over from a pristine machine state (e.g. a RomImage), a single memcpy;
+        //cached blocks whose bytes are the same in the new image are kept
+        void reset(const MachineState& pristine, uint32_t seed){
+            revalidateBlocks(pristine.memory);
+            memcpy(&state, &pristine, sizeof(MachineState));
+            state.rng = seedRandom(seed);
+            codeWritten = false;
+            dirty = true;
+            keys = keyPresses = 0;
+            leaveCalls();
+        }
+
+        //load ROM from file into memory
+        bool load(const char* filename){
+            //create file object
+            std::ifstream file(filename, std::ios::binary | std::ios::ate);
+            if(!file.is_open()){
+                std::cerr << "Failed to open File" << std::endl;
+                return false;
+            }
+            
+            // get file size and navigate to beginning
+            std::streamsize size = file.tellg();
+            file.seekg(0, std::ios::beg);
+
+            //check if size fits in memory
+            if (size > (MEMORYSIZE - 0x200)){
+                std::cerr << "File too big for memory" << std::endl;
+                return false;
+            }
+
+            //read into memory
+            file.read(reinterpret_cast<char*>(&state.memory[0x200]), size);
+            codeWrite(0x200, size);
+
+            return true;
+        }
+
+        //load ROM already in memory, e.g. a generated program
+        bool load(const uint8_t* rom, size_t size){
+            if (size > (MEMORYSIZE - 0x200)){
+                std::cerr << "ROM too big for memory" << std::endl;
+                return false;
+            }
+            memcpy(&state.memory[0x200], rom, size);
+            codeWrite(0x200, size);
+            return true;
+        }
+
+        //copy out the architectural state
+        void save(MachineState& out) const {
+            memcpy(&out, &state, sizeof(MachineState));
+        }
+
+        //replace the architectural state, dropping only the cached blocks whose code differs
+        void restore(const MachineState& in){
+            revalidateBlocks(in.memory);
+            memcpy(&state, &in, sizeof(MachineState));
+            dirty = true;
+            leaveCalls();
+        }
+
+        //write a versioned snapshot file
+        bool saveSnapshot(const char* filename) const {
+            std::ofstream file(filename, std::ios::binary);
+            if(!file.is_open()){
+                std::cerr << "Failed to open snapshot " << filename << std::endl;
+                return false;
+            }
+            SnapshotHeader header = {{'C', '8', 'S', 'S'}, SNAPSHOTVERSION, (uint32_t)sizeof(MachineState)};
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(reinterpret_cast<const char*>(&state), sizeof(MachineState));
+            return file.good();
+        }
+
+        //read a snapshot file written by saveSnapshot
+        bool loadSnapshot(const char* filename){
+            std::ifstream file(filename, std::ios::binary);
+            if(!file.is_open()){
+                std::cerr << "Failed to open snapshot " << filename << std::endl;
+                return false;
+            }
+            SnapshotHeader header;
+            if(!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || memcmp(header.magic, "C8SS", 4) != 0){
+                std::cerr << "Not a snapshot file" << std::endl;
+                return false;
+            }
+            if(header.version != SNAPSHOTVERSION || header.size != sizeof(MachineState)){
+                std::cerr << "Unsupported snapshot version " << header.version << std::endl;
+                return false;
+            }
+            MachineState loaded;
+            if(!file.read(reinterpret_cast<char*>(&loaded), sizeof(MachineState))){
+                std::cerr << "Truncated snapshot" << std::endl;
+                return false;
+            }
+            restore(loaded);
+            return true;
+        }
+
+        //true if the framebuffer changed since the last call
+        bool takeDirty(){
+            bool changed = dirty;
+            dirty = false;
+            return changed;
+        }
+
+        //packed framebuffer and resolution
+        const FrameBuffer& getDisplay() const {
+            return state.screen;
+        }
+
+        //sound timer, and the XO-CHIP pitch and pattern the beeper plays while it runs
+        uint8_t soundTimer() const {
+            return state.sound;
+        }
+
+        uint8_t audioPitch() const {
+            return state.pitch;
+        }
+
+        const uint8_t* audioPattern() const {
+            return state.audio;
+        }
+
+        //false until the program's first F002, while the beeper plays its default square wave
+        bool audioPatternLoaded() const {
+            return state.patternLoaded;
+        }
+
+        //byte of memory, e.g. a score the program keeps there
+        uint8_t peek(uint16_t addr) const {
+            return state.memory[addr];
+        }
+
+        void decrementTimers(){
+            if (state.delay > 0) state.delay--;
+            if (state.sound > 0) state.sound--;
+        }
+
+        //read instruction that PC is currently pointing at
+        uint16_t fetch(){
+            uint16_t instruct;
+            instruct = mem(state.PC)*0x100 + mem(state.PC+1);
+            state.PC += 2;
+            return instruct;
+        }
+
+        //decode instruction (without executing)
+        void debugDecode(uint16_t instruct){
+            //extract bytes and nibbles
+            uint8_t first   = (instruct & 0xF000) >> 12;
+            uint8_t X       = (instruct & 0x0F00) >> 8;
+            uint8_t Y       = (instruct & 0x00F0) >> 4;
+            uint8_t N       = (instruct & 0x000F);
+            uint8_t NNN     = (instruct & 0x0FFF);
+
+            /*
+            std::cout << std::hex << "Instruction: " << instruct << std::dec << std::endl;
+            std::cout << std::hex << "Masked: " << (instruct & 0xF000) << std::dec << std::endl;
+            std::cout << std::hex << "Shifted: " << ((instruct & 0xF000) >> 12) << std::dec << std::endl;
+            std::cout << std::hex << "Broken down: " << (int)first << " " << (int)X << " " << (int)Y << " " << (int)N << std::dec << std::endl;
+            */
+        
+            //decode based on nibbles/bytes
+            switch(first){
+                case 0x0:
+                    switch(NNN){
+                        //clear screen
+                        case 0x0E0:
+                            std::cout << "clear screen" << std::endl;
+                            break;
+
+                        //return from subroutine
+                        case 0x0EE:
+                            std::cout << "return from subroutine" << std::endl;
+                            break;
+
+                        //otherwise print error message
+                        default:
+                            std::cerr << std::hex << "Unrecongized instruction " << (int)first << " " << (int)X << " " << (int)Y << " " << (int)N << std::dec << std::endl;
+                    }
+                    break;
+                
+                //jump PC to NNN
+                case 0x1:
+                    std::cout << "jump to " << NNN << std::endl;
+                    break;
+                
+                //jump PC to NNN and push old PC to stack
+                case 0x2:
+                    std::cout << "execute subroutine at " << NNN << std::endl;
+                    break;
+
+                //set register VX to value NN
+                case 0x6:
+                    std::cout << "set register" << std::endl;
+                    break;
+                
+                //add value NN to register VX
+                case 0x7:
+                    std::cout << "add to register" << std::endl;
+                    break;
+                
+                //set index register to value NNN
+                case 0xA:
+                    std::cout << "set index register" << std::endl;
+                    break;
+                
+                //draw sprite
+                case 0xD:
+                    std::cout << "draw sprite" << std::endl;
+                    break;
+
+                default:
+                    std::cerr << std::hex << "Unrecongized instruction " << (int)first << " " << (int)X << " " << (int)Y << " " << (int)N << std::dec << std::endl;
+            }
+        }
+
+        //decode instruction (reference switch, kept to check the dispatch table against)
+        void decode(uint16_t instruct){
+            //extract bytes and nibbles
+            uint8_t first   = (instruct & 0xF000) >> 12;
+            uint8_t X       = (instruct & 0x0F00) >> 8;
+            uint8_t Y       = (instruct & 0x00F0) >> 4;
+            uint8_t N       = (instruct & 0x000F);
+            uint8_t NN      = (instruct & 0x00FF);
+            uint16_t NNN    = (instruct & 0x0FFF);
+            
+            //decode based on nibbles/bytes
+            switch(first){
+                case 0x0:
+                    switch(NNN){
+                        //clear selected planes
+                        case 0x0E0:
+                            clearPlanes();
+                            break;
+
+                        //return from subroutine
+                        case 0x0EE:
+                            state.PC = pop();
+                            break;
+
+                        //scroll right 4 pixels
+                        case 0x0FB:
+                            scrollPixels(4, 0);
+                            break;
+
+                        //scroll left 4 pixels
+                        case 0x0FC:
+                            scrollPixels(-4, 0);
+                            break;
+
+                        //exit interpreter, stays on this instruction
+                        case 0x0FD:
+                            state.PC -= 2;
+                            break;
+
+                        //lo-res and hi-res, both clear the screen
+                        case 0x0FE:
+                        case 0x0FF:
+                            memset(state.screen.planes, 0, sizeof(state.screen.planes));
+                            state.screen.hires = NNN == 0x0FF;
+                            dirty = true;
+                            break;
+
+                        //scroll down or up N pixels, otherwise print error message
+                        default:
+                            if((NNN & 0xFF0) == 0x0C0)
+                                scrollPixels(0, N);
+                            else if((NNN & 0xFF0) == 0x0D0)
+                                scrollPixels(0, -N);
+                            else
+                                std::cerr << std::hex << "Unrecongized instruction " << (int)first << " " << (int)X << " " << (int)Y << " " << (int)N << std::dec << std::endl;
+                    }
+                    break;
+                
+                //jump PC to NNN
+                case 0x1:
+                    state.PC = NNN;
+                    break;
+                
+                //jump PC to NNN and push old PC to stack
+                case 0x2:
+                    push(state.PC);
+                    state.PC = NNN;
+                    break;
+                
+                //skip next instruction if VX is equal to NN
+                case 0x3:
+                    if(state.registers[X] == NN){
+                        skip();
+                    }
+                    break;
+
+                //skip next instruction if VX isn't equal to NN
+                case 0x4:
+                    if(state.registers[X] != NN){
+                        skip();
+                    }
+                    break;
+                
+                case 0x5:
+                    //save VX to VY into memory at I, in either order
+                    if(N == 0x2){
+                        int count = abs(X - Y) + 1;
+                        for(int i = 0; i < count; i++)
+                            mem(state.I+i) = state.registers[X <= Y ? X+i : X-i];
+                        codeWrite(state.I, count);
+                        if(debugger)
+                            watch(state.I, count, WATCH_WRITE, instruct);
+                    }
+                    //load VX to VY from memory at I
+                    else if(N == 0x3){
+                        int count = abs(X - Y) + 1;
+                        for(int i = 0; i < count; i++)
+                            state.registers[X <= Y ? X+i : X-i] = mem(state.I+i);
+                        if(debugger)
+                            watch(state.I, count, WATCH_READ, instruct);
+                    }
+                    //skip next instruction if VX equals VY
+                    else if(state.registers[X] == state.registers[Y]){
+                        skip();
+                    }
+                    break;
+
+                //set register VX to value NN
+                case 0x6:
+                    state.registers[X] = NN;
+                    break;
+                
+                //add value NN to register VX
+                case 0x7:
+                    state.registers[X] += NN;
+                    break;
+                
+                //logic and arithmetic
+                case 0x8:
+                    switch(N){
+                        //set VX to VY
+                        case 0x0:
+                            state.registers[X] = state.registers[Y];
+                            break;
+                        
+                        //binary OR
+                        case 0x1:
+                            state.registers[X] = state.registers[X] | state.registers[Y];
+                            if(quirks.vfReset){
+                                state.registers[0xF] = 0;
+                            }
+                            break;
+
+                        //binary AND
+                        case 0x2:
+                            state.registers[X] = state.registers[X] & state.registers[Y];
+                            if(quirks.vfReset){
+                                state.registers[0xF] = 0;
+                            }
+                            break;
+
+                        //binary XOR
+                        case 0x3:
+                            state.registers[X] = state.registers[X] ^ state.registers[Y];
+                            if(quirks.vfReset){
+                                state.registers[0xF] = 0;
+                            }
+                            break;
+
+                        //Add
+                        case 0x4: {
+                            uint8_t vx = state.registers[X];
+                            uint8_t vy = state.registers[Y];
+
+                            state.registers[X] = vx + vy;
+
+                            if ((int)vx + (int)vy > 255){state.registers[0xF] = 1;} 
+                            else {state.registers[0xF] = 0;}
+                            
+                            break;
+                        }
+
+                        //Subtract VX-VY
+                        case 0x5: {
+
+                            uint8_t vx = state.registers[X];
+                            uint8_t vy = state.registers[Y];
+
+                            state.registers[X] = vx - vy;
+
+                            if ((int)vx >= (int)vy){state.registers[0xF] = 1;} 
+                            else {state.registers[0xF] = 0;}
+                            
+                            break;
+                        }
+                        
+                        //Shift right
+                        case 0x6: {
+                            if(!quirks.shift){
+                                state.registers[X] = state.registers[Y];
+                            }
+                            uint8_t vx = state.registers[X];
+                            state.registers[X] = vx >> 1;
+                            state.registers[0xF] = vx & 0x01;
+                            break;
+                        }
+
+                        //Subtract VY-VX
+                        case 0x7: {
+
+                            uint8_t vx = state.registers[X];
+                            uint8_t vy = state.registers[Y];
+
+                            state.registers[X] = vy - vx;
+
+                            if ((int)vy >= (int)vx){state.registers[0xF] = 1;} 
+                            else {state.registers[0xF] = 0;}
+
+                            break;
+                        }
+
+                        //Shift left
+                        case 0xE: {
+                            if(!quirks.shift){
+                                state.registers[X] = state.registers[Y];
+                            }
+                            uint8_t vx = state.registers[X];
+                            state.registers[X] = vx << 1;
+                            state.registers[0xF] = (vx & 0x80) >> 7;
+                            break;
+                        }
+                    }
+                    break;
+
+                //skip next instruction if VX doesn't equal VY
+                case 0x9:
+                    if(state.registers[X] != state.registers[Y]){
+                        skip();
+                    }
+                    break;
+
+                //set index register to value NNN
+                case 0xA:
+                    state.I = NNN;
+                    break;
+                
+                //jump with offset
+                case 0xB:
+                    state.PC = NNN;
+                    if (quirks.jump){
+                        state.PC += state.registers[X];
+                    }
+                    else {
+                        state.PC += state.registers[0];
+                    }
+                    break;
+
+                //random
+                case 0xC:
+                    state.registers[X] = random() & NN;
+                    break;
+
+                //draw sprite, N=0 draws 16x16, one copy of the sprite data per selected plane
+                case 0xD: {
+                    int width = screenWidth(), height = screenHeight();
+                    int rows = N ? N : 16;
+                    int columns = N ? 8 : 16;
+                    uint16_t addr = state.I;
+                    //the coordinates are read before VF is cleared, it may be one of them
+                    int xStart = state.registers[X]%width, yStart = state.registers[Y]%height;
+                    state.registers[0xF] = 0;
+                    dirty = true;
+                    if(debugger)
+                        watch(addr, spriteBytes(N), WATCH_READ, instruct);
+
+                    for(int p = 0; p < PLANES; p++){
+                        if(!(state.planes & (1 << p)))
+                            continue;
+                        for(int i = 0; i<rows; i++){
+                            int yCor = yStart + i;
+                            if(yCor >= height){
+                                if(!quirks.wrap)
+                                    break;
+                                yCor -= height;
+                            }
+                            for(int j = 0; j<columns; j++){
+                                int xCor = xStart + j;
+                                if(xCor >= width){
+                                    if(!quirks.wrap)
+                                        break;
+                                    xCor -= width;
+                                }
+                                uint8_t rowData = mem(addr + i*columns/8 + j/8);
+                                if(rowData & (0x80 >> (j & 7))){
+                                    if(getPixel(p, xCor, yCor)){
+                                        state.registers[0xF] = 1;
+                                    }
+                                    flipPixel(p, xCor, yCor);
+                                }
+                            }
+                        }
+                        addr += rows*columns/8;
+                    }
+                    break;
+                }
+
+                //skip if key
+                case 0xE:
+                    switch(NN){
+                        //skip if key is pressed
+                        case 0x9E:
+                            if(isKeyDown(state.registers[X]))
+                                skip();
+                            break;
+                        
+                        //skip if key isn't pressed
+                        case 0xA1:
+                            if(!isKeyDown(state.registers[X]))
+                                skip();
+                            break;
+                    }
+                    break;
+                
+                //timers
+                case 0xF:
+                    //set I to the 16 bit address in the next word
+                    if(instruct == 0xF000){
+                        state.I = fetch();
+                        break;
+                    }
+                    //load audio pattern from memory at I
+                    if(instruct == 0xF002){
+                        for(int i = 0; i < 16; i++)
+                            state.audio[i] = mem(state.I+i);
+                        state.patternLoaded = 1;
+                        if(debugger)
+                            watch(state.I, 16, WATCH_READ, instruct);
+                        break;
+                    }
+                    switch(NN){
+                        //select drawing planes
+                        case 0x01:
+                            state.planes = X & 3;
+                            break;
+
+                        //set VX to delay timer value
+                        case 0x07:
+                            state.registers[X] = state.delay;
+                            break;
+
+                        //set delay timer to VX
+                        case 0x15:
+                            state.delay = state.registers[X];
+                            break;
+
+                        //set sound timer to VX
+                        case 0x18:
+                            state.sound = state.registers[X];
+                            break;
+                        
+                        //add to index
+                        case 0x1E: {
+                            uint8_t vx = state.registers[X];
+                            if((int)state.I+vx > 255)
+                                state.registers[0xF] = 1;
+                            state.I = state.I + vx;
+                            break;
+                        }
+
+                        //get key
+                        case 0x0A:
+                            waitKey(X);
+                            break;
+
+                        //font char
+                        case 0x29:
+                            state.I = 0x50 + (state.registers[X])*5;
+                            break;
+
+                        //big font char
+                        case 0x30:
+                            state.I = 0xA0 + (state.registers[X] & 0xF)*10;
+                            break;
+
+                        //set audio pitch
+                        case 0x3A:
+                            state.pitch = state.registers[X];
+                            break;
+                        
+                        //decimal conversion
+                        case 0x33: {
+                            uint8_t vx = state.registers[X];
+                            mem(state.I) = vx/100;
+                            mem(state.I+1) = (vx/10)%10;
+                            mem(state.I+2) = vx%10;
+                            codeWrite(state.I, 3);
+                            if(debugger)
+                                watch(state.I, 3, WATCH_WRITE, instruct);
+                            break;
+                        }
+                        
+                        //store memory
+                        case 0x55:
+                            for(int i = 0; i <= X; i++){
+                                mem(state.I+i) = state.registers[i];
+                            }
+                            codeWrite(state.I, X+1);
+                            if(debugger)
+                                watch(state.I, X+1, WATCH_WRITE, instruct);
+                            if(quirks.memory == MEMORY_INCREMENT){
+                                state.I = state.I+X+1;
+                            }
+                            else if(quirks.memory == MEMORY_INCREMENT_X){
+                                state.I = state.I+X;
+                            }
+                            break;
+
+                        //load memory
+                        case 0x65:
+                            for(int i = 0; i <= X; i++){
+                                state.registers[i] = mem(state.I+i);
+                            }
+                            if(debugger)
+                                watch(state.I, X+1, WATCH_READ, instruct);
+                            if(quirks.memory == MEMORY_INCREMENT){
+                                state.I = state.I+X+1;
+                            }
+                            else if(quirks.memory == MEMORY_INCREMENT_X){
+                                state.I = state.I+X;
+                            }
+                            break;
+
+                        //save registers to flags
+                        case 0x75:
+                            for(int i = 0; i <= X; i++){
+                                state.flags[i] = state.registers[i];
+                            }
+                            break;
+
+                        //load registers from flags
+                        case 0x85:
+                            for(int i = 0; i <= X; i++){
+                                state.registers[i] = state.flags[i];
+                            }
+                            break;
+
+                        default:
+                            std::cerr << std::hex << "Unrecongized instruction " << (int)first << " " << (int)X << " " << (int)Y << " " << (int)N << std::dec << std::endl;
+
+                    }
+                    break;
+
+                default:
+                    std::cerr << std::hex << "Unrecongized instruction " << (int)first << " " << (int)X << " " << (int)Y << " " << (int)N << std::dec << std::endl;
+            }
+        }
+
+        //key 0-F goes down or up, called on the thread running the emulator between instructions;
+        //pressing a key already held changes nothing, so the held keys alone say what happened
+        void pressKey(uint8_t key){
+            keyPresses |= (1 << (key & 0x0F)) & ~keys;
+            keys |= 1 << (key & 0x0F);
+        }
+
+        void releaseKey(uint8_t key){
+            keys &= ~(1 << (key & 0x0F));
+        }
+
+        //keys held down, bit n for key n
+        uint16_t keyState() const {
+            return keys;
+        }
+
+        //hold exactly the keys in mask, pressing and releasing the ones that differ (replays)
+        void setKeys(uint16_t mask){
+            keyPresses |= mask & ~keys;
+            keys = mask;
+        }
+
+        //apply every queued key event, calling changed(keyState()) after each one that changed
+        //the held keys; returns the time of the oldest event, 0 if there were none
+        template<class Changed>
+        uint64_t applyInput(InputQueue& queue, Changed changed){
+            uint64_t oldest = 0;
+            KeyEvent event;
+            while(queue.pop(event)){
+                uint16_t before = keys;
+                if(event.down)
+                    pressKey(event.key);
+                else
+                    releaseKey(event.key);
+                if(keys != before)
+                    changed(keys);
+                if(!oldest)
+                    oldest = event.time;
+            }
+            return oldest;
+        }
+
+        uint64_t applyInput(InputQueue& queue){
+            return applyInput(queue, [](uint16_t){});
+        }
+
+        //run one instruction through the configured dispatch engine
+        void execute(uint16_t instruct){
+#ifdef CHIP8_SWITCH_DISPATCH
+            call(opDecode, instruct);
+#else
+            call(handlers[instruct], instruct);
+#endif
+        }
+
+        //run one instruction through the pre-decoded handler table
+        void dispatch(uint16_t instruct){
+            call(handlers[instruct], instruct);
+        }
+
+        //run one instruction through the reference switch, still profiled and traced
+        void reference(uint16_t instruct){
+            call(opDecode, instruct);
+        }
+
+        //architectural state, for code compiled ahead of time by chip8aot (aot.h) which runs
+        //simple instructions on it directly and the rest through execute()
+        MachineState& machine(){
+            return state;
+        }
+
+        //bytes covered by compiled code; a write to one of them is remembered until taken
+        void setCompiledCode(const std::bitset<MEMORYSIZE>* code){
+            compiledCode = code;
+            compiledWritten = false;
+        }
+
+        bool takeCompiledWrite(){
+            bool written = compiledWritten;
+            compiledWritten = false;
+            return written;
+        }
+
+#ifdef CHIP8_TRACE
+        //record every executed instruction into tracer (nullptr turns tracing off)
+        void setTracer(Tracer* t){
+            tracer = t;
+        }
+#endif
+
+        //count executed instructions into profiler (nullptr turns profiling off); the counters
+        //belong to the calling thread, so the emulator must only run on one thread at a time.
+        //The block engine credits whole blocks up to PROFILEFLUSH instructions late, detaching
+        //the profiler or destroying the emulator credits the rest
+        void setProfiler(Profiler* p){
+            if(profile)
+                flushProfile();
+            profile = p ? p->counters() : nullptr;
+            leaveCalls();
+            //blocks get their profile counts when translated
+            flushBlocks();
+        }
+
+        //report breakpoint and watchpoint hits to debugger (nullptr detaches it); while it is
+        //paused run() and step() do nothing
+        void setDebugger(Debugger* d){
+            debugger = d;
+        }
+
+        //the last run() ended spinning in a loop that only a timer tick or key event can end
+        bool idle() const {
+            return idling != IDLENONE;
+        }
+
+        //how many more frames of run() then decrementTimers() that loop keeps spinning through,
+        //counting from the current timer values; UINT64_MAX if only a key event can end it
+        uint64_t idleTicks() const {
+            if(idling != IDLETIMER)
+                return idling == IDLENONE ? 0 : UINT64_MAX;
+            uint16_t test = state.memory[idleStart + 2]*0x100 + state.memory[idleStart + 3];
+            uint64_t ticks = 0;
+            for(int delay = state.delay; timerSpins(test, delay); delay--){
+                ticks++;
+                if(delay == 0)
+                    return UINT64_MAX;
+            }
+            return ticks;
+        }
+
+        //do frames frames of run(perFrame) then decrementTimers() at once, for up to idleTicks()
+        //frames with no key events in between; perFrame must be at least 3
+        void skipIdleFrames(uint64_t frames, uint64_t perFrame){
+            if(!frames)
+                return;
+            if(profile)
+                profileIdle(idling == IDLETIMER ? (state.PC - idleStart)/2 : 0, frames*perFrame);
+            if(idling == IDLETIMER){
+                //the last frame's pass read the delay timer before its final tick
+                uint8_t last = state.delay > frames - 1 ? state.delay - (frames - 1) : 0;
+                state.registers[state.memory[idleStart] & 0x0F] = last;
+                uint64_t phase = (state.PC - idleStart)/2;
+                state.PC = idleStart + 2*((phase + frames % 3 * (perFrame % 3)) % 3);
+            }
+            state.delay = state.delay > frames ? state.delay - frames : 0;
+            state.sound = state.sound > frames ? state.sound - frames : 0;
+        }
+
+        //fetch and execute next instruction; with a debugger attached the fetch reads both bytes
+        void step(){
+            step(&Emulator::execute);
+        }
+
+        //step() through one decoder, e.g. reference or dispatch to check the engines against each other
+        void step(void (Emulator::*decoder)(uint16_t)){
+            if(debugger && stopsBefore())
+                return;
+            uint16_t instruct = fetch();
+            if(debugger)
+                watch(state.PC - 2, 2, WATCH_READ, instruct);
+            (this->*decoder)(instruct);
+        }
+
+        //execute count instructions, using the block cache unless the reference switch is selected
+        void run(uint64_t count){
+            //breakpoints need PC checked before every instruction, so they run one at a time
+            if(debugger && (debugger->breaking() || debugger->paused())){
+                for(uint64_t i = 0; i < count && !debugger->paused(); i++)
+                    step();
+                return;
+            }
+#ifdef CHIP8_SWITCH_DISPATCH
+            for(uint64_t i = 0; i < count; i++)
+                step();
+#else
+            if(blocks.empty())
+                blocks.assign(MEMORYSIZE, Block{0, 0, 0, 0, IDLENONE, EXITHANDLER});
+
+            //blocks were marked against the watches armed when they were translated
+            if(debugger != watchedBy || (debugger && debugger->version() != watchedVersion)){
+                flushBlocks();
+                watchedBy = debugger;
+                watchedVersion = debugger ? debugger->version() : 0;
+            }
+
+            idling = IDLENONE;
+            if(!debugger && !traced()){
+                if(!profile){
+                    runBlocks<false>(count);
+                    return;
+                }
+                runBlocks<true>(count);
+                if(unflushed >= PROFILEFLUSH)
+                    flushProfile();
+                return;
+            }
+            uint64_t executed = 0;
+            while(executed < count){
+                //the last word is stepped on its own so block ends fit in 16 bits
+                if(state.PC >= MEMORYSIZE - 2){
+                    step();
+                    executed++;
+                    continue;
+                }
+
+                const Block& block = blocks[state.PC].length ? blocks[state.PC] : translate(state.PC);
+                if(block.idle == IDLESTEPPED){
+                    step();
+                    executed++;
+                    if(debugger->paused())
+                        break;
+                    continue;
+                }
+
+                //a spin-wait takes the rest of the budget in one step, unless every instruction is traced
+                if(block.idle && !traced()){
+                    uint64_t skipped = skipIdle(block, count - executed);
+                    if(skipped){
+                        executed += skipped;
+                        continue;
+                    }
+                }
+
+                //ops stay valid even if a write below invalidates the block, so just stop early
+                const MicroOp* ops = &blockOps[block.first];
+                uint64_t length = std::min<uint64_t>(block.length, count - executed);
+                if(profile)
+                    length = runProfiled(block, ops, length);
+                else {
+                    for(uint64_t i = 0; i < length; i++){
+                        state.PC += 2;
+                        call(ops[i].handler, ops[i].instruct);
+                        if(codeWritten){
+                            codeWritten = false;
+                            length = i+1;
+                            break;
+                        }
+                    }
+                }
+                executed += length;
+                if(debugger && debugger->paused())
+                    break;
+            }
+            if(profile && unflushed >= PROFILEFLUSH)
+                flushProfile();
+#endif
+        }
+
+    private:
+        //memory access wraps at the end of RAM so stray PC or I values stay in bounds
+        uint8_t& mem(uint32_t addr){
+            return state.memory[addr & (sizeof(state.memory) - 1)];
+        }
+
+        //call stack, wraps around instead of overflowing
+        void push(uint16_t addr){
+            state.stack[state.SP] = addr;
+            state.SP = (state.SP + 1) & 15;
+        }
+
+        uint16_t pop(){
+            state.SP = (state.SP - 1) & 15;
+            return state.stack[state.SP];
+        }
+
+        //skip the next instruction, which is two words long if it is F000 NNNN
+        void skip(){
+            state.PC = skipped(state.PC);
+        }
+
+        //address past the instruction at pc, the way a skip goes
+        uint16_t skipped(uint16_t pc){
+            return pc + ((mem(pc) == 0xF0 && mem(pc+1) == 0x00) ? 4 : 2);
+        }
+
+        //key value in a register is held down, values above F never are
+        bool isKeyDown(uint8_t key) const {
+            return key < 16 && (keys >> key & 1);
+        }
+
+        //FX0A: repeat until a key is pressed and released again, then store it in VX
+        void waitKey(uint8_t X){
+            if(!(state.keyWait & (KEYWAITPRESS | KEYWAITRELEASE))){
+                state.keyWait = KEYWAITPRESS;
+                keyPresses = 0;
+            }
+            if(state.keyWait == KEYWAITPRESS && keyPresses){
+                uint8_t key = 0;
+                while(!(keyPresses >> key & 1))
+                    key++;
+                state.keyWait = KEYWAITRELEASE | key;
+            }
+            if((state.keyWait & KEYWAITRELEASE) && !isKeyDown(state.keyWait & 0x0F)){
+                state.registers[X] = state.keyWait & 0x0F;
+                state.keyWait = 0;
+                return;
+            }
+            state.PC -= 2;
+        }
+
+        int screenWidth() const {
+            return state.screen.hires ? HIRESWIDTH : WIDTH;
+        }
+
+        int screenHeight() const {
+            return state.screen.hires ? HIRESHEIGHT : HEIGHT;
+        }
+
+        //clear the selected planes, in lo-res only the words it can reach
+        void clearPlanes(){
+            size_t bytes = state.screen.hires ? sizeof(state.screen.planes[0]) : HEIGHT*sizeof(uint64_t);
+            for(int p = 0; p < PLANES; p++){
+                if(state.planes & (1 << p))
+                    memset(state.screen.planes[p], 0, bytes);
+            }
+            dirty = true;
+        }
+
+        //single pixel access for the reference switch
+        bool getPixel(int plane, int x, int y) const {
+            return (state.screen.planes[plane][x >> 6][y] >> (63 - (x & 63))) & 1;
+        }
+
+        void flipPixel(int plane, int x, int y){
+            state.screen.planes[plane][x >> 6][y] ^= 1ull << (63 - (x & 63));
+        }
+
+        //move the selected planes by dx, dy pixels one pixel at a time (reference switch only)
+        void scrollPixels(int dx, int dy){
+            int width = screenWidth(), height = screenHeight();
+            for(int p = 0; p < PLANES; p++){
+                if(!(state.planes & (1 << p)))
+                    continue;
+                FrameBuffer old = state.screen;
+                memset(state.screen.planes[p], 0, sizeof(state.screen.planes[p]));
+                for(int y = 0; y < height; y++){
+                    for(int x = 0; x < width; x++){
+                        int fromX = x - dx, fromY = y - dy;
+                        if(fromX >= 0 && fromX < width && fromY >= 0 && fromY < height
+                            && (old.planes[p][fromX >> 6][fromY] >> (63 - (fromX & 63))) & 1)
+                            flipPixel(p, x, y);
+                    }
+                }
+            }
+            dirty = true;
+        }
+
+        //move the selected planes whole rows at a time, down for positive n; every column of
+        //words moves with one memmove
+        void scrollRows(int n){
+            int height = screenHeight();
+            size_t moved = (height - abs(n))*sizeof(uint64_t);
+            size_t cleared = abs(n)*sizeof(uint64_t);
+            for(int p = 0; p < PLANES; p++){
+                if(!(state.planes & (1 << p)))
+                    continue;
+                for(int w = 0; w < ROWWORDS; w++){
+                    uint64_t* column = state.screen.planes[p][w];
+                    if(n > 0){
+                        memmove(column + n, column, moved);
+                        memset(column, 0, cleared);
+                    }
+                    else {
+                        memmove(column, column - n, moved);
+                        memset(column + height + n, 0, cleared);
+                    }
+                }
+            }
+            dirty = true;
+        }
+
+        //shift every row of the selected planes 4 pixels, right for positive direction; bits
+        //carry between the two word columns, lo-res only keeps the first. Branch-free over
+        //contiguous columns so the compiler vectorizes it
+        void scrollColumns(int direction){
+            uint64_t keep = state.screen.hires ? ~0ull : 0;
+            for(int p = 0; p < PLANES; p++){
+                if(!(state.planes & (1 << p)))
+                    continue;
+                uint64_t* left = state.screen.planes[p][0];
+                uint64_t* right = state.screen.planes[p][1];
+                if(direction > 0){
+                    for(int y = 0; y < HIRESHEIGHT; y++){
+                        right[y] = ((right[y] >> 4) | (left[y] << 60)) & keep;
+                        left[y] >>= 4;
+                    }
+                }
+                else {
+                    for(int y = 0; y < HIRESHEIGHT; y++){
+                        left[y] = (left[y] << 4) | (right[y] >> 60);
+                        right[y] <<= 4;
+                    }
+                }
+            }
+            dirty = true;
+        }
+
+        //XOR a sprite row, left-aligned in the top bits of sprite, into row y of a plane at x;
+        //returns the pixels it turned off. Whatever passes the end of the first word spills into
+        //the second in hi-res, and wraps to the start of the row only under the wrap quirk
+        template<class Q>
+        static uint64_t xorRow(uint64_t (*plane)[HIRESHEIGHT], int y, uint64_t sprite, int x, bool hires){
+            uint64_t head = sprite >> (x & 63);
+            uint64_t spill = (x & 63) ? sprite << (64 - (x & 63)) : 0;
+            if(!hires){
+                uint64_t bits = head | (Q::wrap ? spill : 0);
+                uint64_t hit = plane[0][y] & bits;
+                plane[0][y] ^= bits;
+                return hit;
+            }
+            int word = x >> 6;
+            uint64_t hit = plane[word][y] & head;
+            plane[word][y] ^= head;
+            if(word == 0 || Q::wrap){
+                hit |= plane[word ^ 1][y] & spill;
+                plane[word ^ 1][y] ^= spill;
+            }
+            return hit;
+        }
+
+        //xorshift64* step, returns the top byte
+        uint8_t random(){
+            uint64_t x = state.rng;
+            x ^= x >> 12;
+            x ^= x << 25;
+            x ^= x >> 27;
+            state.rng = x;
+            return (x * 0x2545F4914F6CDD1Dull) >> 56;
+        }
+
+        //one handler per instruction form, indexed by the full 16 bit opcode
+        typedef void (*Handler)(Emulator&, uint16_t);
+        const Handler* handlers;
+        QuirkFlags quirks; //profile the handlers were instantiated for
+
+        //pre-decoded instruction inside a cached block
+        struct MicroOp {
+            Handler handler;
+            uint16_t instruct;
+        };
+
+        //polling loops whose outcome can't change before the next timer tick or key event
+        enum IdleKind : uint8_t {
+            IDLENONE,
+            IDLEHALT, //1NNN jumping to itself
+            IDLEKEY, //FX0A waiting
+            IDLETIMER, //FX07, 3XNN or 4XNN on the same VX, 1NNN back to the FX07
+            IDLESTEPPED, //not a loop: a read watch covers the block, so it is stepped to report each fetch
+        };
+
+        //how runBlocks leaves a block: jumps, calls, returns and skips it does itself, without
+        //going through the last op's handler
+        enum BlockExit : uint8_t {
+            EXITHANDLER, //any other last instruction, or the block is cut short
+            EXIT1NNN,
+            EXIT2NNN,
+            EXIT00EE,
+            EXIT3XNN,
+            EXIT4XNN,
+            EXIT5XY0,
+            EXIT9XY0,
+            EXITEX9E,
+            EXITEXA1,
+        };
+
+        //straight-line run of instructions starting at an address, length 0 if not translated
+        struct Block {
+            uint32_t first; //index of first op in blockOps
+            uint16_t end; //address after the last instruction, or after the jump closing an idle loop
+            uint16_t target; //NNN of a closing jump or call, the whole instruction of a closing skip
+            uint8_t length; //number of ops
+            uint8_t idle; //IdleKind of the loop starting here
+            uint8_t exit; //BlockExit
+        };
+
+        static const int MAXBLOCK = 32; //longest block in instructions
+        std::vector<Block> blocks; //block starting at each address, allocated on first run
+        std::vector<MicroOp> blockOps; //storage for every translated block
+        std::bitset<MEMORYSIZE> codeMap; //bytes covered by a cached block
+        bool codeWritten = false; //set when a write hits a cached block, or a watchpoint pauses
+        const std::bitset<MEMORYSIZE>* compiledCode = nullptr; //see setCompiledCode
+        bool compiledWritten = false;
+        std::vector<uint16_t> translated; //start of every block translated since the last flush
+        uint8_t idling = IDLENONE; //IdleKind the last run() ended spinning in
+        uint16_t idleStart = 0; //address of that loop
+        const Debugger* watchedBy = nullptr; //debugger whose watches the cached blocks were marked against
+        uint64_t watchedVersion = 0; //and its version() then
+
+        //instructions that can change PC other than by stepping past them end a block
+        static bool endsBlock(uint16_t instruct){
+            switch(instruct >> 12){
+                case 0x1: case 0x2: case 0x3: case 0x4:
+                case 0x5: case 0x9: case 0xB: case 0xE:
+                    return true;
+                case 0x0:
+                    //screen ops run on inside a block, only returns and the 00FD halt move PC
+                    return instruct == 0x00EE || instruct == 0x00FD;
+                case 0xF:
+                    //F000 reads the next word, which mustn't be decoded as an instruction
+                    return (instruct & 0x00FF) == 0x0A || instruct == 0xF000;
+            }
+            return false;
+        }
+
+        //translate the straight-line run at start into micro-ops
+        const Block& translate(uint16_t start){
+            //invalidated blocks leave garbage behind, start over once it piles up
+            if(blockOps.size() > 64*1024)
+                flushBlocks();
+
+            Block block = {(uint32_t)blockOps.size(), start, 0, 0, IDLENONE, EXITHANDLER};
+            uint32_t addr = start;
+            while(block.length < MAXBLOCK && addr < MEMORYSIZE - 2){
+                uint16_t instruct = state.memory[addr]*0x100 + state.memory[addr+1];
+                blockOps.push_back({handlers[instruct], instruct});
+                codeMap[addr] = codeMap[addr+1] = true;
+                block.length++;
+                addr += 2;
+                if(endsBlock(instruct))
+                    break;
+            }
+            block.end = addr;
+            markExit(block);
+            markIdle(block, start);
+            //cached blocks aren't fetched again
+            if(debugger && debugger->watching(start, block.end - start, WATCH_READ))
+                block.idle = IDLESTEPPED;
+            if(profile)
+                profileBlock(block, start);
+            blocks[start] = block;
+            translated.push_back(start);
+            return blocks[start];
+        }
+
+        //pick how runBlocks leaves a block from its last instruction
+        void markExit(Block& block){
+            uint16_t instruct = blockOps[block.first + block.length - 1].instruct;
+            switch(profileClasses[instruct]){
+                case OP_1NNN: block.exit = EXIT1NNN; break;
+                case OP_2NNN: block.exit = EXIT2NNN; break;
+                case OP_00EE: block.exit = EXIT00EE; break;
+                case OP_3XNN: block.exit = EXIT3XNN; break;
+                case OP_4XNN: block.exit = EXIT4XNN; break;
+                case OP_5XY0: block.exit = EXIT5XY0; break;
+                case OP_9XY0: block.exit = EXIT9XY0; break;
+                case OP_EX9E: block.exit = EXITEX9E; break;
+                case OP_EXA1: block.exit = EXITEXA1; break;
+                default: block.exit = EXITHANDLER; break;
+            }
+            block.target = block.exit == EXIT1NNN || block.exit == EXIT2NNN ? opNNN(instruct) : instruct;
+        }
+
+        //run() with no tracer or debugger attached: PC and SP kept in registers and written back
+        //only for the handlers that use them, and the next block found from the exit and target
+        //resolved at translation, not the last op. PROFILED counts whole blocks and call edges
+        //for the profiler, which is attached
+        template<bool PROFILED>
+        void runBlocks(uint64_t count){
+            uint16_t pc = state.PC;
+            uint8_t sp = state.SP;
+            const uint8_t* V = state.registers;
+            uint64_t unflushedFrom = count; //count when unflushed was last brought up to date
+            while(count){
+                const Block* block = &blocks[pc];
+                //one test for the rare cases: a block not translated yet (the last word never is)
+                //or longer than what is left of the budget, idle loops, and draws the profiler times
+                if((uint64_t)block->length - 1 >= count || block->idle || (PROFILED && profiledBlocks[block->first].draws)){
+                    state.PC = pc;
+                    state.SP = sp;
+                    if(PROFILED)
+                        unflushed += unflushedFrom - count;
+                    count -= runSlowBlock(count);
+                    unflushedFrom = count;
+                    pc = state.PC;
+                    sp = state.SP;
+                    continue;
+                }
+
+                //every op but the last, which the exit below runs; ops stay valid even if a write
+                //invalidates the block, so just stop after the op that made it
+                const MicroOp* op = &blockOps[block->first];
+                const MicroOp* last = op + block->length - 1;
+                pc += 2*block->length;
+                count -= block->length;
+                for(; op != last; op++){
+                    op->handler(*this, op->instruct);
+                    if(codeWritten)
+                        break;
+                }
+                if(op != last){
+                    codeWritten = false;
+                    pc -= 2*(last - op);
+                    count += last - op;
+                    if(PROFILED)
+                        countRun(block->first, op - &blockOps[block->first] + 1);
+                    continue;
+                }
+                if(PROFILED){
+                    ProfiledBlock& counted = profiledBlocks[block->first];
+                    if(counted.runs && counted.subroutine == subroutine)
+                        counted.runs++;
+                    else
+                        countRun(block->first, block->length);
+                }
+
+                //each skip tests on its own line so they are predicted apart, as their handlers are
+                uint16_t target = block->target;
+                switch(block->exit){
+                    case EXIT1NNN: pc = target; break;
+                    case EXIT2NNN:
+                        if(PROFILED)
+                            enterCall(target);
+                        state.stack[sp] = pc;
+                        sp = (sp + 1) & 15;
+                        pc = target;
+                        break;
+                    case EXIT00EE:
+                        if(PROFILED)
+                            leaveCall();
+                        sp = (sp - 1) & 15;
+                        pc = state.stack[sp];
+                        break;
+                    case EXIT3XNN: if(V[opX(target)] == opNN(target)) pc = skipped(pc); break;
+                    case EXIT4XNN: if(V[opX(target)] != opNN(target)) pc = skipped(pc); break;
+                    case EXIT5XY0: if(V[opX(target)] == V[opY(target)]) pc = skipped(pc); break;
+                    case EXIT9XY0: if(V[opX(target)] != V[opY(target)]) pc = skipped(pc); break;
+                    case EXITEX9E: if(isKeyDown(V[opX(target)])) pc = skipped(pc); break;
+                    case EXITEXA1: if(!isKeyDown(V[opX(target)])) pc = skipped(pc); break;
+                    default:
+                        state.PC = pc;
+                        state.SP = sp;
+                        last->handler(*this, last->instruct);
+                        codeWritten = false;
+                        pc = state.PC;
+                        sp = state.SP;
+                        break;
+                }
+            }
+            state.PC = pc;
+            state.SP = sp;
+            if(PROFILED)
+                unflushed += unflushedFrom;
+        }
+
+        //the blocks runBlocks leaves to this: the last word, one not translated yet, an idle loop,
+        //or one the budget of count instructions ends inside; they run op by op with PC kept up to
+        //date. Returns how many instructions ran
+        uint64_t runSlowBlock(uint64_t count){
+            if(state.PC >= MEMORYSIZE - 2){
+                step();
+                return 1;
+            }
+            const Block& block = blocks[state.PC].length ? blocks[state.PC] : translate(state.PC);
+            if(block.idle){
+                uint64_t skipped = skipIdle(block, count);
+                if(skipped)
+                    return skipped;
+            }
+            const MicroOp* ops = &blockOps[block.first];
+            uint64_t length = std::min<uint64_t>(block.length, count);
+            if(profile)
+                return runProfiled(block, ops, length);
+            for(uint64_t i = 0; i < length; i++){
+                state.PC += 2;
+                call(ops[i].handler, ops[i].instruct);
+                if(codeWritten){
+                    codeWritten = false;
+                    return i + 1;
+                }
+            }
+            return length;
+        }
+
+        //recognize the idle loops a block can start; a timer loop's closing jump is outside the
+        //block, so it is added to the bytes whose writes invalidate it
+        void markIdle(Block& block, uint16_t start){
+            const MicroOp* ops = &blockOps[block.first];
+            if(block.length == 1 && ops[0].instruct == (0x1000 | start))
+                block.idle = IDLEHALT;
+            else if(block.length == 1 && (ops[0].instruct & 0xF0FF) == 0xF00A)
+                block.idle = IDLEKEY;
+            else if(block.length == 2 && (ops[0].instruct & 0xF0FF) == 0xF007
+                && ((ops[1].instruct >> 12) == 0x3 || (ops[1].instruct >> 12) == 0x4)
+                && opX(ops[1].instruct) == opX(ops[0].instruct)
+                && block.end == start + 4 && mem(start + 4)*0x100 + mem(start + 5) == (0x1000 | start)){
+                block.idle = IDLETIMER;
+                block.end = start + 6;
+                codeMap[start + 4] = codeMap[start + 5] = true;
+            }
+        }
+
+        //the loop FX07, test (3XNN or 4XNN), jump keeps going when VX holds value
+        static bool timerSpins(uint16_t test, uint8_t value){
+            bool equal = opNN(test) == value;
+            return (test >> 12) == 0x3 ? !equal : equal;
+        }
+
+        //instructions are being traced one by one, so none can be skipped; the profiler is
+        //credited with skipped ones by profileIdle instead
+        bool traced() const {
+#ifdef CHIP8_TRACE
+            return tracer != nullptr;
+#else
+            return false;
+#endif
+        }
+
+        //run budget instructions of the idle loop at PC at once, ending in exactly the state
+        //stepping them would; returns how many were done, 0 (or 1 for FX0A) if it isn't idle
+        uint64_t skipIdle(const Block& block, uint64_t budget){
+            const MicroOp* ops = &blockOps[block.first];
+            uint16_t start = state.PC;
+            switch(block.idle){
+                case IDLEKEY:
+                    //after one try, FX0A's wait state can't change until the next key event
+                    state.PC += 2;
+                    call(ops[0].handler, ops[0].instruct);
+                    if(state.PC != start)
+                        return 1;
+                    break;
+                case IDLETIMER:
+                    //the delay timer only moves between runs, so every pass sees the same value
+                    if(!timerSpins(ops[1].instruct, state.delay))
+                        return 0;
+                    state.registers[opX(ops[0].instruct)] = state.delay;
+                    state.PC = start + 2*(budget % 3);
+                    break;
+            }
+            idling = block.idle;
+            idleStart = start;
+            if(profile)
+                profileIdle(0, block.idle == IDLEKEY ? budget - 1 : budget); //FX0A's try was counted by call
+            return budget;
+        }
+
+        //drop every cached block
+        void flushBlocks(){
+            if(profile)
+                flushProfile();
+            profiledBlocks.clear();
+            profiledEnds.clear();
+            for(uint16_t start : translated)
+                blocks[start].length = 0;
+            translated.clear();
+            blockOps.clear();
+            codeMap.reset();
+        }
+
+        //before memory is replaced wholesale, keep the blocks whose bytes are the same in the
+        //incoming image and drop the rest; codeMap may keep stale bits, which only costs a rescan
+        void revalidateBlocks(const uint8_t* memory){
+            size_t kept = 0;
+            for(uint16_t start : translated){
+                Block& block = blocks[start];
+                if(block.length && memcmp(&state.memory[start], &memory[start], block.end - start) == 0)
+                    translated[kept++] = start;
+                else
+                    block.length = 0;
+            }
+            translated.resize(kept);
+        }
+
+        //invalidate cached blocks overlapping a write to [addr, addr+len)
+        void codeWrite(uint32_t addr, uint32_t len){
+            for(uint32_t i = 0; i < len; i++){
+                uint32_t a = (addr + i) & (sizeof(state.memory) - 1);
+                if(compiledCode && (*compiledCode)[a])
+                    compiledWritten = true;
+                if(!codeMap[a])
+                    continue;
+                uint32_t from = a >= 2*MAXBLOCK ? a - 2*MAXBLOCK + 1 : 0;
+                for(uint32_t start = from; start <= a; start++){
+                    if(blocks[start].length && a < blocks[start].end){
+                        blocks[start].length = 0;
+                        codeWritten = true;
+                    }
+                }
+            }
+        }
+
+#ifdef CHIP8_TRACE
+        Tracer* tracer = nullptr;
+
+        //execute and log PC, opcode, I and the first register that changed
+        void traceCall(Handler handler, uint16_t instruct){
+            uint8_t before[16];
+            memcpy(before, state.registers, 16);
+            uint16_t pc = state.PC - 2;
+            handler(*this, instruct);
+
+            TraceRecord record = {pc, instruct, state.I, TRACENOREG, 0};
+            for(int i = 0; i < 16; i++){
+                if(state.registers[i] != before[i]){
+                    record.reg = i;
+                    record.value = state.registers[i];
+                    break;
+                }
+            }
+            tracer->record(record);
+        }
+#endif
+
+        Debugger* debugger = nullptr;
+
+        //a breakpoint on either byte at PC paused the debugger, leave the instruction for later
+        bool stopsBefore(){
+            if(debugger->paused())
+                return true;
+            if(!debugger->breaking())
+                return false;
+            return debugger->check(state.PC, 2, WATCH_EXEC, state.PC, mem(state.PC)*0x100 + mem(state.PC+1));
+        }
+
+        //sprite bytes DXYN reads from I: N rows (16 double-byte rows for N=0) for each selected plane
+        uint32_t spriteBytes(int n) const {
+            return (n ? n : 32)*((state.planes & 1) + (state.planes >> 1 & 1));
+        }
+
+        //memory an instruction reads or writes, only called with a debugger attached; a pause
+        //ends the running block so run() returns after this instruction
+        void watch(uint32_t addr, uint32_t length, uint8_t kind, uint16_t instruct){
+            if(debugger->check(addr, length, kind, state.PC - 2, instruct))
+                codeWritten = true;
+        }
+
+        ProfileCounters* profile = nullptr;
+        const uint8_t* profileClasses = opClassTable();
+        uint16_t callers[PROFILEDEPTH]; //subroutine to return to at each depth
+        uint32_t callDepth = 0; //keeps counting past PROFILEDEPTH, deeper calls stay in the same subroutine
+        uint16_t subroutine = PROFILEMAIN; //entry of the subroutine instructions are credited to
+
+        //start counting from outside any subroutine
+        void leaveCalls(){
+            creditSubroutine();
+            callDepth = 0;
+            subroutine = PROFILEMAIN;
+        }
+
+        //a block run while profiling, counted once per run; flushBlock credits the runs to each of
+        //its instructions, the subroutine they ran in and the call closing the block, if any
+        struct ProfiledBlock {
+            uint64_t runs; //including those that stopped early, see profiledEnds
+            uint16_t start;
+            uint16_t subroutine; //that the runs were in
+            uint8_t length;
+            bool draws; //has a DXYN to time, so it never runs in runBlocks
+            uint8_t last; //form of the last instruction, for followCalls
+        };
+        std::vector<ProfiledBlock> profiledBlocks; //indexed like blockOps by the block's first op
+        std::vector<uint64_t> profiledEnds; //indexed like blockOps, runs that stopped after that op short of the block's end
+        std::vector<uint32_t> profiledPending; //blocks with runs not yet flushed
+        uint64_t unflushed = 0; //instructions in those runs
+        uint64_t selfInstructions = 0; //run in the current subroutine since it was last credited
+        uint64_t draws = 0; //DXYNs run while profiling, picks the ones that are timed
+        uint16_t idleOps[3]; //idle loop whose instructions idleCounts are for, idleLength long
+        uint16_t idleAt = 0;
+        uint8_t idleLength = 0; //0 if nothing is counted
+        uint64_t idleCounts[3] = {};
+
+        //count instruct at pc times times
+        void countOp(uint16_t pc, uint16_t instruct, uint64_t times){
+            ProfileCounters::bump(profile->classes[profileClasses[instruct]], times);
+            ProfileCounters::bump(profile->pcs[pc], times);
+        }
+
+        //credit the instructions run in the current subroutine to it
+        void creditSubroutine(){
+            if(selfInstructions){
+                ProfileCounters::bump(profile->self[subroutine], selfInstructions);
+                selfInstructions = 0;
+            }
+        }
+
+        //credit the block runs counted since the last flush to their instructions
+        void flushProfile(){
+            creditSubroutine();
+            for(uint32_t first : profiledPending)
+                flushBlock(first);
+            profiledPending.clear();
+            flushIdle();
+            unflushed = 0;
+        }
+
+        //credit the runs of the block at first counted so far
+        void flushBlock(uint32_t first){
+            ProfiledBlock& counted = profiledBlocks[first];
+            uint64_t runs = counted.runs;
+            uint64_t instructions = 0;
+            for(uint8_t i = 0; i < counted.length && runs; i++){
+                uint16_t instruct = blockOps[first + i].instruct;
+                countOp(counted.start + 2*i, instruct, runs);
+                instructions += runs;
+                //a call is always last, so every run that got there made it
+                if(profileClasses[instruct] == OP_2NNN)
+                    ProfileCounters::bump(profile->edge(counted.subroutine, counted.start + 2*i, opNNN(instruct)).calls, runs);
+                runs -= profiledEnds[first + i];
+                profiledEnds[first + i] = 0;
+            }
+            if(instructions)
+                ProfileCounters::bump(profile->self[counted.subroutine], instructions);
+            counted.runs = 0;
+        }
+
+        //count a run of the first length ops of the block at first, credited to them at the next
+        //flush; the block may have been invalidated by then, its ops stay. The caller adds the
+        //instructions to unflushed
+        void countRun(uint32_t first, uint64_t length){
+            ProfiledBlock& counted = profiledBlocks[first];
+            //runs are credited to one subroutine, a run in another first credits those before it
+            if(counted.subroutine != subroutine){
+                flushBlock(first);
+                counted.subroutine = subroutine;
+            }
+            if(!counted.runs++)
+                profiledPending.push_back(first);
+            if(length < counted.length)
+                profiledEnds[first + length - 1]++;
+        }
+
+        //credit the idle loop counts held back by profileIdle
+        void flushIdle(){
+            for(uint8_t i = 0; i < idleLength; i++){
+                countOp(idleAt + 2*i, idleOps[i], idleCounts[i]);
+                idleCounts[i] = 0;
+            }
+            idleLength = 0;
+        }
+
+        //credit count instructions of the idle loop at idleStart, starting phase instructions into
+        //the loop, as if they had been stepped
+        void profileIdle(uint64_t phase, uint64_t count){
+            uint8_t length = idling == IDLETIMER ? 3 : 1;
+            //counted up across runs while the same loop spins, a frame's skip is only a few instructions
+            bool same = idleAt == idleStart && idleLength == length;
+            for(uint8_t i = 0; i < length; i++){
+                uint16_t pc = idleStart + 2*i;
+                same &= idleOps[i] == mem(pc)*0x100 + mem(pc+1);
+            }
+            if(!same){
+                flushIdle();
+                idleAt = idleStart;
+                idleLength = length;
+                for(uint8_t i = 0; i < length; i++)
+                    idleOps[i] = mem(idleAt + 2*i)*0x100 + mem(idleAt + 2*i + 1);
+            }
+            if(length == 1)
+                idleCounts[0] += count;
+            else {
+                for(uint8_t i = 0; i < 3; i++){
+                    //the i-th instruction runs first after offset others, then every third
+                    uint64_t offset = (i + 3 - phase % 3) % 3;
+                    if(count > offset)
+                        idleCounts[i] += (count - offset + 2)/3;
+                }
+            }
+            selfInstructions += count;
+            unflushed += count;
+        }
+
+        //set up the profiler's counts for a block translated at start
+        void profileBlock(const Block& block, uint16_t start){
+            profiledBlocks.resize(blockOps.size());
+            profiledEnds.resize(blockOps.size());
+            ProfiledBlock& counted = profiledBlocks[block.first];
+            const MicroOp* ops = &blockOps[block.first];
+            counted = {0, start, subroutine, block.length, false, profileClasses[ops[block.length-1].instruct]};
+            for(uint8_t i = 0; i < block.length; i++)
+                counted.draws |= profileClasses[ops[i].instruct] == OP_DXYN;
+        }
+
+        //run the first length ops of a block while profiling, stopping early after a write into it.
+        //Returns the instructions run
+        uint64_t runProfiled(const Block& block, const MicroOp* ops, uint64_t length){
+            ProfiledBlock& counted = profiledBlocks[block.first];
+            for(uint64_t i = 0; i < length; i++){
+                state.PC += 2;
+                if(counted.draws && profileClasses[ops[i].instruct] == OP_DXYN)
+                    profiledDraw(ops[i].handler, ops[i].instruct);
+                else
+                    invoke(ops[i].handler, ops[i].instruct);
+                if(codeWritten){
+                    codeWritten = false;
+                    length = i+1;
+                    break;
+                }
+            }
+
+            countRun(block.first, length);
+            unflushed += length;
+            //calls and returns are last in a block
+            if(length == counted.length)
+                followCalls(counted.last);
+            return length;
+        }
+
+        //run a DXYN, timing every DRAWSAMPLE'th one
+        void profiledDraw(Handler handler, uint16_t instruct){
+            if(draws++ % DRAWSAMPLE){
+                invoke(handler, instruct);
+                return;
+            }
+            auto start = std::chrono::steady_clock::now();
+            invoke(handler, instruct);
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+            ProfileCounters::bump(profile->drawNanos, elapsed.count()*DRAWSAMPLE);
+        }
+
+        //enter or leave a subroutine after a 2NNN or 00EE of form op has run; calls and returns end
+        //blocks, so a block's last instruction is the only one that can
+        void followCalls(uint8_t op){
+            if(op == OP_2NNN)
+                enterCall(state.PC);
+            else if(op == OP_00EE)
+                leaveCall();
+        }
+
+        //credit what follows a call to the subroutine at entry; the call edge itself is counted
+        //with the instruction, or with the runs of the block it closes
+        void enterCall(uint16_t entry){
+            creditSubroutine();
+            if(callDepth < PROFILEDEPTH){
+                callers[callDepth] = subroutine;
+                subroutine = entry;
+            }
+            callDepth++;
+        }
+
+        //go back to crediting the caller, if there is one
+        void leaveCall(){
+            if(!callDepth)
+                return;
+            creditSubroutine();
+            callDepth--;
+            if(callDepth < PROFILEDEPTH)
+                subroutine = callers[callDepth];
+        }
+
+        //execute and count opcode form, address, call graph position and draw time
+        void profiledCall(Handler handler, uint16_t instruct){
+            uint8_t op = profileClasses[instruct];
+            uint16_t site = state.PC - 2;
+            countOp(site, instruct, 1);
+            selfInstructions++;
+            if(op == OP_DXYN)
+                profiledDraw(handler, instruct);
+            else
+                invoke(handler, instruct);
+            if(op == OP_2NNN)
+                ProfileCounters::bump(profile->edge(subroutine, site, state.PC).calls);
+            followCalls(op);
+        }
+
+        //run a handler, going through the tracer when it is compiled in and enabled
+        void invoke(Handler handler, uint16_t instruct){
+#ifdef CHIP8_TRACE
+            if(tracer){
+                traceCall(handler, instruct);
+                return;
+            }
+#endif
+            handler(*this, instruct);
+        }
+
+        //invoke a handler, counting it first when profiling
+        void call(Handler handler, uint16_t instruct){
+            if(profile){
+                profiledCall(handler, instruct);
+                return;
+            }
+            invoke(handler, instruct);
+        }
+
+        //reference switch wrapped as a handler
+        static void opDecode(Emulator& e, uint16_t instruct){
+            e.decode(instruct);
+        }
+
+        static uint8_t opX(uint16_t instruct){ return (instruct & 0x0F00) >> 8; }
+        static uint8_t opY(uint16_t instruct){ return (instruct & 0x00F0) >> 4; }
+        static uint8_t opNN(uint16_t instruct){ return instruct & 0x00FF; }
+        static uint16_t opNNN(uint16_t instruct){ return instruct & 0x0FFF; }
+
+        //clear selected planes
+        static void op00E0(Emulator& e, uint16_t instruct){
+            e.clearPlanes();
+        }
+
+        //return from subroutine
+        static void op00EE(Emulator& e, uint16_t instruct){
+            e.state.PC = e.pop();
+        }
+
+        //scroll down N pixels
+        static void op00CN(Emulator& e, uint16_t instruct){
+            e.scrollRows(instruct & 0x000F);
+        }
+
+        //scroll up N pixels
+        static void op00DN(Emulator& e, uint16_t instruct){
+            e.scrollRows(-(instruct & 0x000F));
+        }
+
+        //scroll right 4 pixels
+        static void op00FB(Emulator& e, uint16_t instruct){
+            e.scrollColumns(1);
+        }
+
+        //scroll left 4 pixels
+        static void op00FC(Emulator& e, uint16_t instruct){
+            e.scrollColumns(-1);
+        }
+
+        //exit interpreter, stays on this instruction
+        static void op00FD(Emulator& e, uint16_t instruct){
+            e.state.PC -= 2;
+        }
+
+        //lo-res (00FE) and hi-res (00FF), both clear the screen
+        static void op00FE(Emulator& e, uint16_t instruct){
+            memset(e.state.screen.planes, 0, sizeof(e.state.screen.planes));
+            e.state.screen.hires = instruct == 0x00FF;
+            e.dirty = true;
+        }
+
+        //jump PC to NNN
+        static void op1NNN(Emulator& e, uint16_t instruct){
+            e.state.PC = opNNN(instruct);
+        }
+
+        //jump PC to NNN and push old PC to stack
+        static void op2NNN(Emulator& e, uint16_t instruct){
+            e.push(e.state.PC);
+            e.state.PC = opNNN(instruct);
+        }
+
+        //skip next instruction if VX is equal to NN
+        static void op3XNN(Emulator& e, uint16_t instruct){
+            if(e.state.registers[opX(instruct)] == opNN(instruct))
+                e.skip();
+        }
+
+        //skip next instruction if VX isn't equal to NN
+        static void op4XNN(Emulator& e, uint16_t instruct){
+            if(e.state.registers[opX(instruct)] != opNN(instruct))
+                e.skip();
+        }
+
+        //skip next instruction if VX equals VY
+        static void op5XY0(Emulator& e, uint16_t instruct){
+            if(e.state.registers[opX(instruct)] == e.state.registers[opY(instruct)])
+                e.skip();
+        }
+
+        //save VX to VY into memory at I, in either order
+        static void op5XY2(Emulator& e, uint16_t instruct){
+            int X = opX(instruct), Y = opY(instruct);
+            int count = abs(X - Y) + 1;
+            for(int i = 0; i < count; i++)
+                e.mem(e.state.I+i) = e.state.registers[X <= Y ? X+i : X-i];
+            e.codeWrite(e.state.I, count);
+            if(e.debugger)
+                e.watch(e.state.I, count, WATCH_WRITE, instruct);
+        }
+
+        //load VX to VY from memory at I
+        static void op5XY3(Emulator& e, uint16_t instruct){
+            int X = opX(instruct), Y = opY(instruct);
+            int count = abs(X - Y) + 1;
+            for(int i = 0; i < count; i++)
+                e.state.registers[X <= Y ? X+i : X-i] = e.mem(e.state.I+i);
+            if(e.debugger)
+                e.watch(e.state.I, count, WATCH_READ, instruct);
+        }
+
+        //set register VX to value NN
+        static void op6XNN(Emulator& e, uint16_t instruct){
+            e.state.registers[opX(instruct)] = opNN(instruct);
+        }
+
+        //add value NN to register VX
+        static void op7XNN(Emulator& e, uint16_t instruct){
+            e.state.registers[opX(instruct)] += opNN(instruct);
+        }
+
+        //set VX to VY
+        static void op8XY0(Emulator& e, uint16_t instruct){
+            e.state.registers[opX(instruct)] = e.state.registers[opY(instruct)];
+        }
+
+        //binary OR
+        template<class Q>
+        static void op8XY1(Emulator& e, uint16_t instruct){
+            e.state.registers[opX(instruct)] |= e.state.registers[opY(instruct)];
+            if(Q::vfReset)
+                e.state.registers[0xF] = 0;
+        }
+
+        //binary AND
+        template<class Q>
+        static void op8XY2(Emulator& e, uint16_t instruct){
+            e.state.registers[opX(instruct)] &= e.state.registers[opY(instruct)];
+            if(Q::vfReset)
+                e.state.registers[0xF] = 0;
+        }
+
+        //binary XOR
+        template<class Q>
+        static void op8XY3(Emulator& e, uint16_t instruct){
+            e.state.registers[opX(instruct)] ^= e.state.registers[opY(instruct)];
+            if(Q::vfReset)
+                e.state.registers[0xF] = 0;
+        }
+
+        //add
+        static void op8XY4(Emulator& e, uint16_t instruct){
+            uint8_t vx = e.state.registers[opX(instruct)];
+            uint8_t vy = e.state.registers[opY(instruct)];
+            e.state.registers[opX(instruct)] = vx + vy;
+            e.state.registers[0xF] = ((int)vx + (int)vy > 255);
+        }
+
+        //subtract VX-VY
+        static void op8XY5(Emulator& e, uint16_t instruct){
+            uint8_t vx = e.state.registers[opX(instruct)];
+            uint8_t vy = e.state.registers[opY(instruct)];
+            e.state.registers[opX(instruct)] = vx - vy;
+            e.state.registers[0xF] = (vx >= vy);
+        }
+
+        //shift right
+        template<class Q>
+        static void op8XY6(Emulator& e, uint16_t instruct){
+            if(!Q::shift)
+                e.state.registers[opX(instruct)] = e.state.registers[opY(instruct)];
+            uint8_t vx = e.state.registers[opX(instruct)];
+            e.state.registers[opX(instruct)] = vx >> 1;
+            e.state.registers[0xF] = vx & 0x01;
+        }
+
+        //subtract VY-VX
+        static void op8XY7(Emulator& e, uint16_t instruct){
+            uint8_t vx = e.state.registers[opX(instruct)];
+            uint8_t vy = e.state.registers[opY(instruct)];
+            e.state.registers[opX(instruct)] = vy - vx;
+            e.state.registers[0xF] = (vy >= vx);
+        }
+
+        //shift left
+        template<class Q>
+        static void op8XYE(Emulator& e, uint16_t instruct){
+            if(!Q::shift)
+                e.state.registers[opX(instruct)] = e.state.registers[opY(instruct)];
+            uint8_t vx = e.state.registers[opX(instruct)];
+            e.state.registers[opX(instruct)] = vx << 1;
+            e.state.registers[0xF] = (vx & 0x80) >> 7;
+        }
+
+        //skip next instruction if VX doesn't equal VY
+        static void op9XY0(Emulator& e, uint16_t instruct){
+            if(e.state.registers[opX(instruct)] != e.state.registers[opY(instruct)])
+                e.skip();
+        }
+
+        //set index register to value NNN
+        static void opANNN(Emulator& e, uint16_t instruct){
+            e.state.I = opNNN(instruct);
+        }
+
+        //jump with offset
+        template<class Q>
+        static void opBNNN(Emulator& e, uint16_t instruct){
+            e.state.PC = opNNN(instruct) + e.state.registers[Q::jump ? opX(instruct) : 0];
+        }
+
+        //random
+        static void opCXNN(Emulator& e, uint16_t instruct){
+            e.state.registers[opX(instruct)] = e.random() & opNN(instruct);
+        }
+
+        //draw sprite: each sprite row is shifted into place and XORed into the row words of
+        //every selected plane, N=0 draws 16x16; rows past the bottom are clipped unless Q wraps
+        template<class Q>
+        static void opDXYN(Emulator& e, uint16_t instruct){
+            FrameBuffer& screen = e.state.screen;
+            int width = e.screenWidth(), height = e.screenHeight();
+            int xCor = e.state.registers[opX(instruct)] & (width - 1);
+            int yCor = e.state.registers[opY(instruct)] & (height - 1);
+            int n = instruct & 0x000F;
+            int rows = n ? n : 16;
+            int visible = Q::wrap ? rows : std::min(rows, height - yCor);
+
+            uint16_t addr = e.state.I;
+            uint64_t collision = 0;
+            if(e.debugger)
+                e.watch(addr, e.spriteBytes(n), WATCH_READ, instruct);
+            for(int p = 0; p < PLANES; p++){
+                if(!(e.state.planes & (1 << p)))
+                    continue;
+                uint64_t (*plane)[HIRESHEIGHT] = screen.planes[p];
+                //plain CHIP-8 sprites get their own loop: one byte into one word per row
+                if(n && !screen.hires){
+                    for(int i = 0; i<visible; i++){
+                        uint64_t sprite = (uint64_t)e.mem(addr+i) << 56;
+                        uint64_t bits = sprite >> xCor;
+                        if(Q::wrap && xCor)
+                            bits |= sprite << (64 - xCor);
+                        uint64_t& row = plane[0][(yCor + i) & (HEIGHT - 1)];
+                        collision |= row & bits;
+                        row ^= bits;
+                    }
+                }
+                else {
+                    for(int i = 0; i<visible; i++){
+                        uint64_t bits = n ? e.mem(addr+i) << 8 : e.mem(addr+2*i) << 8 | e.mem(addr+2*i+1);
+                        collision |= xorRow<Q>(plane, (yCor + i) & (height - 1), bits << 48, xCor, screen.hires);
+                    }
+                }
+                addr += n ? rows : 32;
+            }
+            e.state.registers[0xF] = collision != 0;
+            e.dirty = true;
+        }
+
+        //skip if key is pressed
+        static void opEX9E(Emulator& e, uint16_t instruct){
+            if(e.isKeyDown(e.state.registers[opX(instruct)]))
+                e.skip();
+        }
+
+        //skip if key isn't pressed
+        static void opEXA1(Emulator& e, uint16_t instruct){
+            if(!e.isKeyDown(e.state.registers[opX(instruct)]))
+                e.skip();
+        }
+
+        //set I to the 16 bit address in the next word
+        static void opF000(Emulator& e, uint16_t instruct){
+            e.state.I = e.fetch();
+        }
+
+        //select drawing planes
+        static void opFN01(Emulator& e, uint16_t instruct){
+            e.state.planes = opX(instruct) & 3;
+        }
+
+        //load audio pattern from memory at I
+        static void opF002(Emulator& e, uint16_t instruct){
+            for(int i = 0; i < 16; i++)
+                e.state.audio[i] = e.mem(e.state.I+i);
+            e.state.patternLoaded = 1;
+            if(e.debugger)
+                e.watch(e.state.I, 16, WATCH_READ, instruct);
+        }
+
+        //set VX to delay timer value
+        static void opFX07(Emulator& e, uint16_t instruct){
+            e.state.registers[opX(instruct)] = e.state.delay;
+        }
+
+        //get key
+        static void opFX0A(Emulator& e, uint16_t instruct){
+            e.waitKey(opX(instruct));
+        }
+
+        //set delay timer to VX
+        static void opFX15(Emulator& e, uint16_t instruct){
+            e.state.delay = e.state.registers[opX(instruct)];
+        }
+
+        //set sound timer to VX
+        static void opFX18(Emulator& e, uint16_t instruct){
+            e.state.sound = e.state.registers[opX(instruct)];
+        }
+
+        //add to index
+        static void opFX1E(Emulator& e, uint16_t instruct){
+            uint8_t vx = e.state.registers[opX(instruct)];
+            if((int)e.state.I+vx > 255)
+                e.state.registers[0xF] = 1;
+            e.state.I = e.state.I + vx;
+        }
+
+        //font char
+        static void opFX29(Emulator& e, uint16_t instruct){
+            e.state.I = 0x50 + (e.state.registers[opX(instruct)])*5;
+        }
+
+        //big font char
+        static void opFX30(Emulator& e, uint16_t instruct){
+            e.state.I = 0xA0 + (e.state.registers[opX(instruct)] & 0xF)*10;
+        }
+
+        //set audio pitch
+        static void opFX3A(Emulator& e, uint16_t instruct){
+            e.state.pitch = e.state.registers[opX(instruct)];
+        }
+
+        //decimal conversion
+        static void opFX33(Emulator& e, uint16_t instruct){
+            uint8_t vx = e.state.registers[opX(instruct)];
+            e.mem(e.state.I) = vx/100;
+            e.mem(e.state.I+1) = (vx/10)%10;
+            e.mem(e.state.I+2) = vx%10;
+            e.codeWrite(e.state.I, 3);
+            if(e.debugger)
+                e.watch(e.state.I, 3, WATCH_WRITE, instruct);
+        }
+
+        //store memory
+        template<class Q>
+        static void opFX55(Emulator& e, uint16_t instruct){
+            uint8_t X = opX(instruct);
+            for(int i = 0; i <= X; i++)
+                e.mem(e.state.I+i) = e.state.registers[i];
+            e.codeWrite(e.state.I, X+1);
+            if(e.debugger)
+                e.watch(e.state.I, X+1, WATCH_WRITE, instruct);
+            if(Q::memory == MEMORY_INCREMENT)
+                e.state.I = e.state.I+X+1;
+            else if(Q::memory == MEMORY_INCREMENT_X)
+                e.state.I = e.state.I+X;
+        }
+
+        //load memory
+        template<class Q>
+        static void opFX65(Emulator& e, uint16_t instruct){
+            uint8_t X = opX(instruct);
+            for(int i = 0; i <= X; i++)
+                e.state.registers[i] = e.mem(e.state.I+i);
+            if(e.debugger)
+                e.watch(e.state.I, X+1, WATCH_READ, instruct);
+            if(Q::memory == MEMORY_INCREMENT)
+                e.state.I = e.state.I+X+1;
+            else if(Q::memory == MEMORY_INCREMENT_X)
+                e.state.I = e.state.I+X;
+        }
+
+        //save registers to flags
+        static void opFX75(Emulator& e, uint16_t instruct){
+            for(int i = 0; i <= opX(instruct); i++)
+                e.state.flags[i] = e.state.registers[i];
+        }
+
+        //load registers from flags
+        static void opFX85(Emulator& e, uint16_t instruct){
+            for(int i = 0; i <= opX(instruct); i++)
+                e.state.registers[i] = e.state.flags[i];
+        }
+
+        //opcodes the switch silently ignores
+        static void opIgnored(Emulator& e, uint16_t instruct){}
+
+        //otherwise print error message
+        static void opUnknown(Emulator& e, uint16_t instruct){
+            std::cerr << std::hex << "Unrecongized instruction " << (instruct >> 12) << " " << (int)opX(instruct) << " " << (int)opY(instruct) << " " << (instruct & 0x000F) << std::dec << std::endl;
+        }
+
+        //handler for an opcode and the form the profiler counts it as
+        struct Resolved {
+            Handler handler;
+            OpClass op;
+        };
+
+        //pick the handler for an opcode under quirk profile Q, mirroring the nested switch in decode
+        template<class Q>
+        static Resolved resolve(uint16_t instruct){
+            switch(instruct >> 12){
+                case 0x0:
+                    switch(instruct){
+                        case 0x00E0: return {op00E0, OP_00E0};
+                        case 0x00EE: return {op00EE, OP_00EE};
+                        case 0x00FB: return {op00FB, OP_00FB};
+                        case 0x00FC: return {op00FC, OP_00FC};
+                        case 0x00FD: return {op00FD, OP_00FD};
+                        case 0x00FE: return {op00FE, OP_00FE};
+                        case 0x00FF: return {op00FE, OP_00FE};
+                    }
+                    if((instruct & 0xFFF0) == 0x00C0) return {op00CN, OP_00CN};
+                    if((instruct & 0xFFF0) == 0x00D0) return {op00DN, OP_00DN};
+                    return {opUnknown, OP_OTHER};
+                case 0x1: return {op1NNN, OP_1NNN};
+                case 0x2: return {op2NNN, OP_2NNN};
+                case 0x3: return {op3XNN, OP_3XNN};
+                case 0x4: return {op4XNN, OP_4XNN};
+                case 0x5:
+                    switch(instruct & 0x000F){
+                        case 0x2: return {op5XY2, OP_5XY2};
+                        case 0x3: return {op5XY3, OP_5XY3};
+                    }
+                    return {op5XY0, OP_5XY0};
+                case 0x6: return {op6XNN, OP_6XNN};
+                case 0x7: return {op7XNN, OP_7XNN};
+                case 0x8:
+                    switch(instruct & 0x000F){
+                        case 0x0: return {op8XY0, OP_8XY0};
+                        case 0x1: return {op8XY1<Q>, OP_8XY1};
+                        case 0x2: return {op8XY2<Q>, OP_8XY2};
+                        case 0x3: return {op8XY3<Q>, OP_8XY3};
+                        case 0x4: return {op8XY4, OP_8XY4};
+                        case 0x5: return {op8XY5, OP_8XY5};
+                        case 0x6: return {op8XY6<Q>, OP_8XY6};
+                        case 0x7: return {op8XY7, OP_8XY7};
+                        case 0xE: return {op8XYE<Q>, OP_8XYE};
+                    }
+                    return {opIgnored, OP_OTHER};
+                case 0x9: return {op9XY0, OP_9XY0};
+                case 0xA: return {opANNN, OP_ANNN};
+                case 0xB: return {opBNNN<Q>, OP_BNNN};
+                case 0xC: return {opCXNN, OP_CXNN};
+                case 0xD: return {opDXYN<Q>, OP_DXYN};
+                case 0xE:
+                    switch(instruct & 0x00FF){
+                        case 0x9E: return {opEX9E, OP_EX9E};
+                        case 0xA1: return {opEXA1, OP_EXA1};
+                    }
+                    return {opIgnored, OP_OTHER};
+                default:
+                    if(instruct == 0xF000) return {opF000, OP_F000};
+                    if(instruct == 0xF002) return {opF002, OP_F002};
+                    switch(instruct & 0x00FF){
+                        case 0x01: return {opFN01, OP_FN01};
+                        case 0x07: return {opFX07, OP_FX07};
+                        case 0x0A: return {opFX0A, OP_FX0A};
+                        case 0x15: return {opFX15, OP_FX15};
+                        case 0x18: return {opFX18, OP_FX18};
+                        case 0x1E: return {opFX1E, OP_FX1E};
+                        case 0x29: return {opFX29, OP_FX29};
+                        case 0x30: return {opFX30, OP_FX30};
+                        case 0x33: return {opFX33, OP_FX33};
+                        case 0x3A: return {opFX3A, OP_FX3A};
+                        case 0x55: return {opFX55<Q>, OP_FX55};
+                        case 0x65: return {opFX65<Q>, OP_FX65};
+                        case 0x75: return {opFX75, OP_FX75};
+                        case 0x85: return {opFX85, OP_FX85};
+                    }
+                    return {opUnknown, OP_OTHER};
+            }
+        }
+
+        //64K entry table for profile Q, shared by all instances using it
+        template<class Q>
+        static const Handler* dispatchTable(){
+            static Handler* table = [](){
+                static Handler entries[0x10000];
+                for(uint32_t i = 0; i < 0x10000; i++)
+                    entries[i] = resolve<Q>(i).handler;
+                return entries;
+            }();
+            return table;
+        }
+
+        //form of every opcode, from the same decode as the handlers; it doesn't depend on the profile
+        static const uint8_t* opClassTable(){
+            static uint8_t* table = [](){
+                static uint8_t classes[0x10000];
+                for(uint32_t i = 0; i < 0x10000; i++)
+                    classes[i] = resolve<QuirksCustom>(i).op;
+                return classes;
+            }();
+            return table;
+        }
+
+        //every profile's table is instantiated here, the choice is made once per instance
+        void selectProfile(Profile profile){
+            switch(profile){
+                case PROFILE_VIP:
+                    handlers = dispatchTable<QuirksVip>();
+                    quirks = QuirkFlags::of<QuirksVip>();
+                    break;
+                case PROFILE_CHIP48:
+                    handlers = dispatchTable<QuirksChip48>();
+                    quirks = QuirkFlags::of<QuirksChip48>();
+                    break;
+                case PROFILE_SUPERCHIP:
+                    handlers = dispatchTable<QuirksSuperChip>();
+                    quirks = QuirkFlags::of<QuirksSuperChip>();
+                    break;
+                case PROFILE_XOCHIP:
+                    handlers = dispatchTable<QuirksXoChip>();
+                    quirks = QuirkFlags::of<QuirksXoChip>();
+                    break;
+                default:
+                    handlers = dispatchTable<QuirksCustom>();
+                    quirks = QuirkFlags::of<QuirksCustom>();
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,252 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <random>
+#include <cstring>
+#include "checkmain.h"
+using namespace std;
+
+
+//random program of count instructions loaded at 0x200, drawn from opcodes every engine
+//implements, and draws often take VF as a coordinate since VF changes under them mid-instruction.
+//Jumps, calls and BNNN targets stay inside it, ahead of the call chain and landing pad. I starts
+//past them, but FX1E, FX29 and FX30 can move it back so the program stores over its own code
+vector<uint8_t> randomRom(mt19937& rng, int count){
+    auto nibble = [&](){ return (uint16_t)(rng() & 0xF); };
+    auto byte = [&](){ return (uint16_t)(rng() & 0xFF); };
+    auto target = [&](){ return (uint16_t)(0x200 + 2*(rng() % count)); };
+    uint16_t data = 0x200 + 2*count + 0x100;
+    uint16_t start = 0xA000 | data;
+    vector<uint16_t> ops = {start};
+    appendCallChain(ops);
+    for(int i = 17; i < count - 2; i++){
+        uint16_t X = nibble(), Y = nibble(), N = nibble(), NN = byte();
+        uint16_t op;
+        switch(rng() % 28){
+            case 0: op = rng() & 1 ? 0x00E0 : 0x00EE; break;
+            case 1: op = rng() & 1 ? 0x00FF : 0x00FE; break;
+            case 2: {
+                //00CN, 00DN, 00FB, 00FC
+                int k = rng() % 4;
+                op = k == 0 ? 0x00C0 | N : k == 1 ? 0x00D0 | N : k == 2 ? 0x00FB : 0x00FC;
+                break;
+            }
+            case 3: op = 0x1000 | target(); break;
+            case 24: op = 0x2000 | target(); break;
+            case 25: op = 0xB000 | target(); break;
+            case 4: op = 0x3000 | X << 8 | NN; break;
+            case 5: op = 0x4000 | X << 8 | NN; break;
+            case 6: op = 0x5000 | X << 8 | Y << 4 | (rng() % 3 == 0 ? 0 : 2 + (rng() & 1)); break;
+            case 7: case 8: op = 0x6000 | X << 8 | NN; break;
+            case 9: op = 0x7000 | X << 8 | NN; break;
+            case 10: case 11: {
+                static const uint16_t alu[] = {0, 1, 2, 3, 4, 5, 6, 7, 0xE};
+                op = 0x8000 | X << 8 | Y << 4 | alu[rng() % 9];
+                break;
+            }
+            case 12: op = 0x9000 | X << 8 | Y << 4; break;
+            case 13: op = 0xA000 | (data + rng() % 0x800); break;
+            case 14: op = 0xC000 | X << 8 | NN; break;
+            case 15: case 16: case 17:
+                //a third of the draws put VF in X or Y
+                if(rng() % 3 == 0){
+                    if(rng() & 1) X = 0xF;
+                    else Y = 0xF;
+                }
+                op = 0xD000 | X << 8 | Y << 4 | N;
+                break;
+            case 18: op = (rng() & 1 ? 0xE09E : 0xE0A1) | X << 8; break;
+            case 19: {
+                static const uint16_t timers[] = {0x07, 0x0A, 0x15, 0x18, 0x3A};
+                op = 0xF000 | X << 8 | timers[rng() % 5];
+                break;
+            }
+            case 26: {
+                static const uint16_t index[] = {0x1E, 0x29, 0x30};
+                op = 0xF000 | X << 8 | index[rng() % 3];
+                break;
+            }
+            case 27: op = (rng() & 1 ? 0xF075 : 0xF085) | X << 8; break;
+            case 20: op = 0xF033 | X << 8; break;
+            case 21: op = 0xF055 | X << 8; break;
+            case 22: op = 0xF065 | X << 8; break;
+            default: op = rng() % 4 == 0 ? 0xF002 : 0xF001 | (rng() % 4) << 8; break;
+        }
+        ops.push_back(op);
+    }
+    //a skip at the end lands on the second jump
+    ops.push_back(0x1200);
+    ops.push_back(0x1200);
+    vector<uint8_t> bytes = romBytes(ops);
+    appendLandingPad(bytes);
+    return bytes;
+}
+
+const char* ENGINES[] = {"switch", "table", "block"};
+
+//run count instructions on an engine: the reference switch or the handler table a step at a
+//time, or the block cache in one run
+void runEngine(Emulator& emu, int engine, uint64_t count){
+    if(engine == 2){
+        emu.run(count);
+        return;
+    }
+    for(uint64_t i = 0; i < count; i++)
+        emu.step(engine == 0 ? &Emulator::reference : &Emulator::dispatch);
+}
+
+//BNNN in every engine: V0=5, V3=7, B320 lands on 0x325 (NNN+V0), or on 0x327 (XNN+VX)
+//under the profiles with the jump quirk; returns how many engines jumped elsewhere
+uint32_t checkJump(Profile profile){
+    const uint8_t rom[] = {0x60, 0x05, 0x63, 0x07, 0xB3, 0x20};
+    uint16_t expected = profile == PROFILE_CHIP48 || profile == PROFILE_SUPERCHIP ? 0x327 : 0x325;
+    uint32_t wrong = 0;
+    for(int engine = 0; engine < 3; engine++){
+        Emulator emu(0, profile);
+        emu.load(rom, sizeof(rom));
+        runEngine(emu, engine, 3);
+        uint16_t pc = emu.machine().PC;
+        if(pc != expected){
+            cout << PROFILENAMES[profile] << ": BNNN in the " << ENGINES[engine] << " jumped to " << hex << pc
+                 << ", expected " << expected << dec << endl;
+            wrong++;
+        }
+    }
+    return wrong;
+}
+
+//loop for checkDebugger: VE counts passes, and FX33, FX55, FX65 and DXYN each touch their own bytes
+const uint8_t WATCHROM[] = {
+    0x7E, 0x01, //200: VE += 1
+    0x6A, 0x7B, //202: VA = 123
+    0xA3, 0x00, //204: I = 0x300
+    0xFA, 0x33, //206: BCD of VA to 300-302
+    0xA3, 0x10, //208: I = 0x310
+    0xF2, 0x55, //20A: V0-V2 to 310-312
+    0xA3, 0x20, //20C: I = 0x320
+    0xF1, 0x65, //20E: V0-V1 from 320-321
+    0xA3, 0x30, //210: I = 0x330
+    0xD0, 0x15, //212: sprite from 330-334
+    0x12, 0x00  //214: back to 200
+};
+
+//a breakpoint or a watch on one byte of WATCHROM, and the hit it must give
+struct WatchCase {
+    uint16_t addr;
+    uint8_t kind;
+    uint16_t pc;
+    uint16_t instruct;
+};
+
+//each watch in every engine: the first pass pauses with the expected hit, before the instruction
+//for a breakpoint and after it for a read or write, and nothing runs while paused; after
+//resume() the next pause is the same hit one pass later, so a breakpoint's instruction ran once.
+//Returns how many engine and watch pairs got something else
+uint32_t checkDebugger(Profile profile){
+    static const WatchCase CASES[] = {
+        {0x301, WATCH_WRITE, 0x206, 0xFA33},
+        {0x312, WATCH_WRITE, 0x20A, 0xF255},
+        {0x321, WATCH_READ, 0x20E, 0xF165},
+        {0x334, WATCH_READ, 0x212, 0xD015},
+        {0x20D, WATCH_READ, 0x20C, 0xA320}, //second byte of an instruction fetch
+        {0x201, WATCH_EXEC, 0x200, 0x7E01}
+    };
+    uint32_t wrong = 0;
+    for(const WatchCase& c : CASES){
+        for(int engine = 0; engine < 3; engine++){
+            Emulator emu(0, profile);
+            emu.load(WATCHROM, sizeof(WATCHROM));
+            Debugger debugger;
+            debugger.arm(c.addr, 1, c.kind);
+            emu.setDebugger(&debugger);
+            uint16_t pc = c.kind == WATCH_EXEC ? c.pc : c.pc + 2;
+            bool ok = true;
+            for(uint8_t pass = 0; pass < 2 && ok; pass++){
+                runEngine(emu, engine, 100);
+                runEngine(emu, engine, 100); //paused, so this runs nothing
+                const WatchHit& hit = debugger.lastHit();
+                uint8_t passes = emu.machine().registers[0xE] - (c.kind == WATCH_EXEC ? 0 : 1);
+                ok = debugger.paused() && debugger.hits() == pass + 1u && hit.kind == c.kind
+                     && hit.addr == c.addr && hit.pc == c.pc && hit.instruct == c.instruct
+                     && emu.machine().PC == pc && passes == pass;
+                debugger.resume();
+            }
+            if(!ok){
+                cout << PROFILENAMES[profile] << ": " << watchKindName(c.kind) << " at " << hex << c.addr << " in the "
+                     << ENGINES[engine] << " stopped at " << emu.machine().PC << " after " << dec
+                     << (int)emu.machine().registers[0xE] << " passes and " << debugger.hits() << " hits" << endl;
+                wrong++;
+            }
+        }
+    }
+    return wrong;
+}
+
+//usage: chip8_enginecheck [--roms N] [--frames N] [--seed N]
+//runs random programs with random key presses through the reference switch, the handler table
+//and the block cache under every quirk profile and compares the whole machine state after each frame; also
+//checks BNNN and breakpoints and watchpoints in each engine
+int main(int argc, char* argv[]){
+    CheckOptions options{200, 200};
+    if(!parseCheckOptions(argc, argv, options))
+        return 1;
+    uint32_t roms = options.roms, frames = options.frames, seed = options.seed;
+
+    silenceEngineErrors();
+
+    const uint64_t perFrame = INSTFREQ/TIMERFREQ;
+    unique_ptr<MachineState> a(new MachineState), b(new MachineState), c(new MachineState);
+    uint32_t failed = 0;
+    for(int p = PROFILE_CUSTOM; p <= PROFILE_XOCHIP; p++){
+        Profile profile = (Profile)p;
+        failed += checkJump(profile);
+        failed += checkDebugger(profile);
+        mt19937 rng(seed);
+        uint32_t diverged = 0;
+        for(uint32_t r = 0; r < roms; r++){
+            vector<uint8_t> rom = randomRom(rng, 128);
+            uint32_t machineSeed = rng();
+            unique_ptr<Emulator> reference(new Emulator(machineSeed, profile));
+            unique_ptr<Emulator> table(new Emulator(machineSeed, profile));
+            unique_ptr<Emulator> block(new Emulator(machineSeed, profile));
+            reference->load(rom.data(), rom.size());
+            table->load(rom.data(), rom.size());
+            block->load(rom.data(), rom.size());
+            for(uint32_t f = 0; f < frames; f++){
+                //a random key goes down or up every frame, so FX0A and EX9E/EXA1 see input
+                uint8_t key = rng() & 0xF;
+                bool down = rng() & 1;
+                for(Emulator* e : {reference.get(), table.get(), block.get()}){
+                    if(down)
+                        e->pressKey(key);
+                    else
+                        e->releaseKey(key);
+                }
+                uint16_t pc = reference->machine().PC;
+                for(uint64_t i = 0; i < perFrame; i++){
+                    reference->decode(reference->fetch());
+                    table->dispatch(table->fetch());
+                }
+                block->run(perFrame);
+                reference->decrementTimers();
+                table->decrementTimers();
+                block->decrementTimers();
+                reference->save(*a);
+                table->save(*b);
+                block->save(*c);
+                bool tableDiffers = memcmp(a.get(), b.get(), sizeof(MachineState)) != 0;
+                bool blockDiffers = memcmp(a.get(), c.get(), sizeof(MachineState)) != 0;
+                if(tableDiffers || blockDiffers){
+                    cout << PROFILENAMES[p] << " rom " << r << ": " << (tableDiffers ? "table " : "") << (blockDiffers ? "block " : "")
+                         << "differ from the switch after frame " << f << " (started at " << hex << pc << dec << ")" << endl;
+                    diverged++;
+                    break;
+                }
+            }
+        }
+        cout << PROFILENAMES[p] << ": " << roms << " programs, " << diverged << " diverged" << endl;
+        failed += diverged;
+    }
+    return failed ? 1 : 0;
+}
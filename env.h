@@ -0,0 +1,192 @@
+#ifndef ENV_H
+#define ENV_H
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "emulator.h"
+#include "romcache.h"
+#include "chip8env.h"
+
+//what one step of an environment returns; screen is a view of the emulator's own framebuffer
+struct EnvStep {
+    const FrameBuffer* screen;
+    int32_t reward;
+    uint8_t done; //CHIP8_RUNNING, CHIP8_TERMINATED or CHIP8_TRUNCATED
+};
+
+//one emulator driven as a training environment: reset to a seed, step a number of frames
+//with a set of keys held, reading reward and game over from the program's memory
+class Env {
+    private:
+        std::shared_ptr<const RomImage> rom;
+        Chip8EnvConfig config;
+        Emulator emu;
+        int32_t score = 0;
+        uint32_t frames = 0;
+
+        int32_t readScore() const {
+            if(config.reward_address < 0)
+                return 0;
+            uint16_t addr = config.reward_address;
+            return config.reward_bytes == 2 ? emu.peek(addr) << 8 | emu.peek(addr + 1) : emu.peek(addr);
+        }
+
+    public:
+        Env(std::shared_ptr<const RomImage> image, const Chip8EnvConfig& settings):
+            rom(image), config(settings), emu(0u, (Profile)settings.profile){
+            reset(0);
+        }
+
+        const FrameBuffer& reset(uint32_t seed){
+            emu.reset(rom->pristine(), seed);
+            score = readScore();
+            frames = 0;
+            return emu.getDisplay();
+        }
+
+        //hold exactly the keys in keymask for count frames, stopping early if the episode ends;
+        //spin-waits are skipped the way headless jobs skip them
+        EnvStep step(uint16_t keymask, uint32_t count){
+            emu.setKeys(keymask);
+
+            const uint64_t perFrame = INSTFREQ/TIMERFREQ;
+            uint8_t done = CHIP8_RUNNING;
+            for(uint32_t f = 0; f < count && !done; ){
+                emu.run(perFrame);
+                emu.decrementTimers();
+                f++;
+                frames++;
+                if(emu.idle()){
+                    uint64_t skip = std::min<uint64_t>(emu.idleTicks(), count - f);
+                    if(config.max_frames)
+                        skip = std::min<uint64_t>(skip, config.max_frames - std::min(frames, config.max_frames));
+                    emu.skipIdleFrames(skip, perFrame);
+                    f += skip;
+                    frames += skip;
+                }
+                if(config.done_address >= 0 && emu.peek(config.done_address) == config.done_value)
+                    done = CHIP8_TERMINATED;
+                else if(config.max_frames && frames >= config.max_frames)
+                    done = CHIP8_TRUNCATED;
+            }
+
+            int32_t now = readScore();
+            EnvStep result = {&emu.getDisplay(), now - score, done};
+            score = now;
+            return result;
+        }
+
+        const FrameBuffer& screen() const {
+            return emu.getDisplay();
+        }
+
+        uint8_t peek(uint16_t addr) const {
+            return emu.peek(addr);
+        }
+};
+
+//environments on one ROM stepped together by persistent worker threads; step() hands out
+//environments one at a time, so episodes of different lengths balance across workers
+class EnvPool {
+    private:
+        std::vector<std::unique_ptr<Env>> envs;
+        std::vector<std::thread> workers;
+        std::mutex lock;
+        std::condition_variable wake, finished;
+        uint64_t generation = 0;
+        size_t busy = 0; //workers inside work()
+        bool quitting = false;
+        std::atomic<size_t> next{0}; //next environment to claim
+        std::atomic<size_t> completed{0};
+
+        //arguments of the batch in progress
+        const uint16_t* keymasks = nullptr;
+        uint32_t frames = 0;
+        EnvStep* results = nullptr;
+
+        void work(){
+            size_t i;
+            while((i = next.fetch_add(1)) < envs.size()){
+                results[i] = envs[i]->step(keymasks[i], frames);
+                completed.fetch_add(1);
+            }
+        }
+
+        void workerLoop(){
+            uint64_t seen = 0;
+            std::unique_lock<std::mutex> guard(lock);
+            while(true){
+                wake.wait(guard, [&](){ return quitting || generation != seen; });
+                if(quitting)
+                    return;
+                seen = generation;
+                busy++;
+                guard.unlock();
+                work();
+                guard.lock();
+                if(--busy == 0)
+                    finished.notify_all();
+            }
+        }
+
+    public:
+        //threads counts the caller, which steps environments too; 0 for one per core
+        EnvPool(std::shared_ptr<const RomImage> rom, const Chip8EnvConfig& config, size_t count, size_t threads){
+            for(size_t i = 0; i < count; i++)
+                envs.emplace_back(new Env(rom, config));
+            if(!threads)
+                threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+            for(size_t t = 1; t < std::min(threads, count); t++)
+                workers.emplace_back(&EnvPool::workerLoop, this);
+        }
+
+        EnvPool(const EnvPool&) = delete;
+        EnvPool& operator=(const EnvPool&) = delete;
+
+        ~EnvPool(){
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                quitting = true;
+            }
+            wake.notify_all();
+            for(std::thread& t : workers)
+                t.join();
+        }
+
+        size_t size() const {
+            return envs.size();
+        }
+
+        Env& operator[](size_t i){
+            return *envs[i];
+        }
+
+        const Env& operator[](size_t i) const {
+            return *envs[i];
+        }
+
+        //step environment i with keymasks[i] for count frames, into out[i]
+        void step(const uint16_t* masks, uint32_t count, EnvStep* out){
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                keymasks = masks;
+                frames = count;
+                results = out;
+                completed = 0;
+                next = 0;
+                generation++;
+            }
+            wake.notify_all();
+            work();
+            //every environment done and no worker still looking for more
+            std::unique_lock<std::mutex> guard(lock);
+            finished.wait(guard, [&](){ return completed == envs.size() && busy == 0; });
+        }
+};
+
+#endif
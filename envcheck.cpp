@@ -0,0 +1,174 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include "chip8env.h"
+#include "romcache.h"
+#include "checkmain.h"
+using namespace std;
+
+const char* ROMFILE = "envcheck.ch8";
+const uint16_t SCOREADDR = 0x400; //V0, the score
+const uint16_t ROUNDADDR = 0x405; //V5, rounds played; the episode ends at ROUNDS
+const uint8_t ROUNDS = 10;
+
+//each round adds 1 to the score, or 2 while key 1 is held, stores V0-V5 at 0x400 and waits
+//1-8 frames (CXNN, so it depends on the seed) on the delay timer, which the environments skip
+const vector<uint16_t> PROGRAM = {
+    0x6401, //200: V4 = 1, the key
+    0x7501, //202: V5 += 1
+    0x7001, //204: V0 += 1
+    0xE4A1, //206: skip unless key V4 is down
+    0x7001, //208: V0 += 1
+    0xC107, //20A: V1 = rand & 7
+    0x7101, //20C: V1 += 1
+    0xA400, //20E: I = 0x400
+    0xF555, //210: store V0-V5
+    0xF115, //212: delay = V1
+    0xF207, //214: V2 = delay
+    0x3200, //216: skip if V2 == 0
+    0x1214, //218: back to 214
+    0x3500 | ROUNDS, //21A: skip if V5 == ROUNDS
+    0x1202, //21C: next round
+    0x121E  //21E: halt
+};
+
+//the reference: score after each frame stepped without skipping, until the episode ends
+vector<uint8_t> scores(const RomImage& rom, uint32_t seed, uint16_t keymask){
+    Emulator emu(seed, PROFILE_CUSTOM);
+    emu.reset(rom.pristine(), seed);
+    emu.setKeys(keymask);
+    vector<uint8_t> out;
+    while(emu.peek(ROUNDADDR) != ROUNDS){
+        emu.run(INSTFREQ/TIMERFREQ);
+        emu.decrementTimers();
+        out.push_back(emu.peek(SCOREADDR));
+    }
+    return out;
+}
+
+//prints what failed, returns 1 if it did
+uint32_t expect(bool ok, const string& what){
+    if(!ok)
+        cout << what << endl;
+    return ok ? 0 : 1;
+}
+
+//usage: chip8_envcheck
+//drives the C interface on a generated ROM that keeps its score and round count in memory:
+//rewards, termination and truncation of single environments stepped a few frames at a time
+//against the same program stepped frame by frame without idle skipping, a pool against single
+//environments, and configs with addresses past the 64KB of memory
+int main(){
+    vector<uint8_t> bytes = romBytes(PROGRAM);
+    ofstream(ROMFILE, ios::binary).write((const char*)bytes.data(), bytes.size());
+    shared_ptr<RomImage> image = RomImage::fromBytes(bytes.data(), bytes.size());
+
+    Chip8EnvConfig config;
+    chip8_env_default_config(&config);
+    config.reward_address = SCOREADDR;
+    config.done_address = ROUNDADDR;
+    config.done_value = ROUNDS;
+    uint32_t failed = 0;
+
+    //episodes stepped 1, 2, 3 and 7 frames at a time end on the frame the reference does, with
+    //the score the reference has at each step, and rewards that add up to it
+    for(uint32_t seed = 1; seed <= 20; seed++){
+        uint16_t keymask = seed & 1 ? 0x0002 : 0;
+        vector<uint8_t> expected = scores(*image, seed, keymask);
+        for(uint32_t frames : {1, 2, 3, 7}){
+            Chip8Env* env = chip8_env_create(ROMFILE, &config);
+            chip8_env_reset(env, seed);
+            uint8_t done = CHIP8_RUNNING;
+            int32_t total = 0;
+            size_t played = 0; //frames stepped, or the last frame of the episode if it ended in this step
+            bool same = true;
+            while(!done && played < expected.size()){
+                total += chip8_env_step(env, keymask, frames, &done);
+                played = min(played + frames, expected.size());
+                same &= chip8_env_peek(env, SCOREADDR) == expected[played - 1];
+            }
+            failed += expect(same && done == CHIP8_TERMINATED && total == expected.back(),
+                             "seed " + to_string(seed) + " stepped " + to_string(frames) + " frames at a time: score or end differs");
+            chip8_env_destroy(env);
+        }
+    }
+
+    //max_frames cuts the episode short on exactly that frame, however far one step would skip;
+    //on the frame the episode also ends it terminates instead. Frames stepped past the limit
+    //follow on from it, so an idle skip that overshot shows up as a score that changes early
+    for(uint32_t seed = 1; seed <= 20; seed++){
+        vector<uint8_t> expected = scores(*image, seed, 0);
+        for(uint32_t limit : {(uint32_t)expected.size()/2, (uint32_t)expected.size() - 1, (uint32_t)expected.size()}){
+            Chip8EnvConfig truncated = config;
+            truncated.max_frames = limit;
+            Chip8Env* env = chip8_env_create(ROMFILE, &truncated);
+            chip8_env_reset(env, seed);
+            uint8_t done;
+            int32_t reward = chip8_env_step(env, 0, 1000, &done);
+            uint8_t end = limit == expected.size() ? CHIP8_TERMINATED : CHIP8_TRUNCATED;
+            bool same = done == end && reward == expected[limit - 1] && chip8_env_peek(env, SCOREADDR) == expected[limit - 1];
+            for(size_t f = limit; f < expected.size(); f++){
+                chip8_env_step(env, 0, 1, &done);
+                same &= chip8_env_peek(env, SCOREADDR) == expected[f];
+            }
+            failed += expect(same, "seed " + to_string(seed) + " with max_frames " + to_string(limit) + " didn't stop there");
+            chip8_env_destroy(env);
+        }
+    }
+
+    //a pool on several threads matches single environments seeded seed + index, with and without keys
+    {
+        const uint32_t COUNT = 64;
+        Chip8EnvPool* pool = chip8_pool_create(ROMFILE, &config, COUNT, 4);
+        vector<Chip8Env*> singles;
+        for(uint32_t i = 0; i < COUNT; i++){
+            singles.push_back(chip8_env_create(ROMFILE, &config));
+            chip8_env_reset(singles[i], 100 + i);
+        }
+        chip8_pool_reset(pool, -1, 100);
+        vector<uint16_t> keymasks(COUNT);
+        vector<int32_t> rewards(COUNT);
+        vector<uint8_t> dones(COUNT);
+        bool same = true;
+        for(uint32_t step = 0; step < 30; step++){
+            for(uint32_t i = 0; i < COUNT; i++)
+                keymasks[i] = (i + step) % 3 ? 0x0002 : 0;
+            bool keys = step % 4 != 0;
+            chip8_pool_step(pool, keys ? keymasks.data() : nullptr, 2, rewards.data(), dones.data());
+            for(uint32_t i = 0; i < COUNT; i++){
+                uint8_t done;
+                int32_t reward = chip8_env_step(singles[i], keys ? keymasks[i] : 0, 2, &done);
+                same &= reward == rewards[i] && done == dones[i];
+                same &= equal(chip8_pool_screen(pool, i), chip8_pool_screen(pool, i) + 2*2*64, chip8_env_screen(singles[i]));
+            }
+        }
+        failed += expect(same, "pool environments differ from single ones");
+        for(Chip8Env* env : singles)
+            chip8_env_destroy(env);
+        chip8_pool_destroy(pool);
+    }
+
+    //addresses the environment can't read
+    {
+        Chip8EnvConfig bad = config;
+        bad.reward_address = 0x10000;
+        failed += expect(!chip8_env_create(ROMFILE, &bad), "reward_address 0x10000 accepted");
+        bad.reward_address = 0xFFFF;
+        bad.reward_bytes = 2;
+        failed += expect(!chip8_env_create(ROMFILE, &bad), "2-byte reward_address 0xFFFF accepted");
+        bad = config;
+        bad.done_address = 0x10000;
+        failed += expect(!chip8_env_create(ROMFILE, &bad), "done_address 0x10000 accepted");
+        bad = config;
+        bad.reward_address = 0xFFFE;
+        bad.reward_bytes = 2;
+        Chip8Env* env = chip8_env_create(ROMFILE, &bad);
+        failed += expect(env != nullptr, "2-byte reward_address 0xFFFE rejected");
+        chip8_env_destroy(env);
+    }
+
+    cout << (failed ? "environments: failed" : "environments: ok") << endl;
+    return failed ? 1 : 0;
+}
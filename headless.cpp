@@ -0,0 +1,453 @@
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <memory>
+#include "headless.h"
+#include "romcache.h"
+#include "capture.h"
+#include "replay.h"
+using namespace std;
+
+bool traceSupported(){
+#ifdef CHIP8_TRACE
+    return true;
+#else
+    cerr << "Tracing is compiled out, rebuild with -DCHIP8_TRACE" << endl;
+    return false;
+#endif
+}
+
+bool writeProfile(Profiler& profiler, const string& prefix){
+    if(!profiler.writeJson(prefix + ".json") || !profiler.writeFolded(prefix + ".folded")){
+        cerr << "Failed to write profile " << prefix << endl;
+        return false;
+    }
+    return true;
+}
+
+bool loadInputScript(const string& filename, vector<InputEvent>& events){
+    ifstream file(filename);
+    if(!file.is_open()){
+        cerr << "Failed to open input script " << filename << endl;
+        return false;
+    }
+
+    string line;
+    while(getline(file, line)){
+        if(line.empty() || line[0] == '#')
+            continue;
+        istringstream in(line);
+        string frameText, key, extra;
+        uint32_t frame;
+        if(!(in >> frameText >> key) || in >> extra || !parseNumber(frameText, frame)){
+            cerr << "Bad line in input script " << filename << ": " << line << endl;
+            return false;
+        }
+        InputEvent event = {frame, 0xFF, key[0] != '-'};
+        if(key != "-" && !parseNumber(key.substr(event.down ? 0 : 1), event.key, 16)){
+            cerr << "Bad key in input script " << filename << ": " << line << endl;
+            return false;
+        }
+        event.key &= 0x0F;
+        events.push_back(event);
+    }
+    stable_sort(events.begin(), events.end(), [](const InputEvent& a, const InputEvent& b){
+        return a.frame < b.frame;
+    });
+    return true;
+}
+
+uint64_t hashDisplay(const FrameBuffer& display){
+    uint64_t hash = 14695981039346656037ull;
+    int rows = display.hires ? HIRESHEIGHT : HEIGHT;
+    int words = display.hires ? ROWWORDS : 1;
+    for(int p = 0; p < PLANES; p++){
+        for(int w = 0; w < words; w++){
+            for(int y = 0; y < rows; y++){
+                for(int b = 0; b < 64; b += 8){
+                    hash ^= (display.planes[p][w][y] >> b) & 0xFF;
+                    hash *= 1099511628211ull;
+                }
+            }
+        }
+    }
+    return hash;
+}
+
+JobResult runJob(const Job& job, uint64_t budget, Decoder decoder, const string& traceFile, const string& captureFile, Profiler* profiler){
+    JobResult result;
+    //every job on the same ROM shares one mapped image, starting the run is a memcpy
+    shared_ptr<const RomImage> rom = RomCache::global().get(job.rom);
+    if(!rom)
+        return result;
+    Emulator emu(job.seed, job.profile);
+    emu.reset(rom->pristine(), job.seed);
+
+#ifdef CHIP8_TRACE
+    unique_ptr<Tracer> tracer;
+    if(!traceFile.empty()){
+        tracer.reset(Tracer::open(traceFile.c_str(), true));
+        if(!tracer){
+            cerr << "Failed to open trace file " << traceFile << endl;
+            return result;
+        }
+        emu.setTracer(tracer.get());
+    }
+#endif
+    if(profiler)
+        emu.setProfiler(profiler);
+
+    unique_ptr<CaptureWriter> capture;
+    if(!captureFile.empty()){
+        capture.reset(CaptureWriter::open(captureFile));
+        if(!capture)
+            return result;
+    }
+
+    vector<InputEvent> events;
+    if(!job.inputScript.empty() && !loadInputScript(job.inputScript, events))
+        return result;
+
+    //timers tick once per frame, so a frame is INSTFREQ/TIMERFREQ instructions
+    const uint64_t perFrame = INSTFREQ/TIMERFREQ;
+    size_t nextEvent = 0;
+    uint32_t frame = 0;
+    while(result.instructions < budget){
+        while(nextEvent < events.size() && events[nextEvent].frame <= frame){
+            const InputEvent& event = events[nextEvent];
+            if(event.down)
+                emu.pressKey(event.key);
+            else if(event.key == 0xFF){
+                for(uint8_t key = 0; key < 16; key++)
+                    emu.releaseKey(key);
+            }
+            else
+                emu.releaseKey(event.key);
+            nextEvent++;
+        }
+
+        uint64_t count = min(perFrame, budget - result.instructions);
+        if(decoder){
+            for(uint64_t i = 0; i < count; i++)
+                (emu.*decoder)(emu.fetch());
+        }
+        else
+            emu.run(count);
+        result.instructions += count;
+
+        emu.decrementTimers();
+        if(capture && !capture->write(frame, emu.getDisplay())){
+            cerr << "Failed to grow capture " << captureFile << endl;
+            return result;
+        }
+        frame++;
+
+        //a spin-wait that only a timer tick or key can end is jumped over, frames at a time,
+        //up to the tick or scripted key that ends it
+        if(!decoder && emu.idle()){
+            uint64_t frames = min(emu.idleTicks(), (budget - result.instructions)/perFrame);
+            if(nextEvent < events.size())
+                frames = min<uint64_t>(frames, events[nextEvent].frame - frame);
+            for(uint64_t i = 0; capture && i < frames; i++){
+                if(!capture->write(frame + i, emu.getDisplay())){
+                    cerr << "Failed to grow capture " << captureFile << endl;
+                    return result;
+                }
+            }
+            emu.skipIdleFrames(frames, perFrame);
+            result.instructions += frames*perFrame;
+            frame += frames;
+        }
+    }
+
+    result.displayHash = hashDisplay(emu.getDisplay());
+    result.ok = true;
+    return result;
+}
+
+ReplayResult runReplay(const string& filename){
+    ReplayResult result;
+    Recording recording;
+    if(!loadRecording(filename, recording))
+        return result;
+    shared_ptr<const RomImage> rom = RomCache::global().get(recording.rom);
+    if(!rom)
+        return result;
+    if(rom->hash() != recording.romHash){
+        cerr << recording.rom << " isn't the ROM " << filename << " was recorded with" << endl;
+        return result;
+    }
+    Emulator emu(recording.seed, recording.profile);
+    emu.reset(rom->pristine(), recording.seed);
+    result.instructions = replayRecording(emu, recording);
+    result.frames = recording.frames;
+    result.stateHash = hashMachine(emu);
+    result.matched = result.instructions == recording.instructions && result.stateHash == recording.stateHash;
+    result.ok = true;
+    return result;
+}
+
+//thread pool where each worker owns a deque of job indices and steals from others when empty
+class WorkStealingPool {
+    private:
+        struct Queue {
+            mutex lock;
+            deque<size_t> jobs;
+        };
+        vector<Queue> queues;
+
+        //take from the back of our own queue
+        bool popLocal(size_t worker, size_t& job){
+            Queue& q = queues[worker];
+            lock_guard<mutex> guard(q.lock);
+            if(q.jobs.empty())
+                return false;
+            job = q.jobs.back();
+            q.jobs.pop_back();
+            return true;
+        }
+
+        //take from the front of another worker's queue
+        bool steal(size_t worker, size_t& job){
+            for(size_t i = 1; i < queues.size(); i++){
+                Queue& q = queues[(worker + i) % queues.size()];
+                lock_guard<mutex> guard(q.lock);
+                if(!q.jobs.empty()){
+                    job = q.jobs.front();
+                    q.jobs.pop_front();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    public:
+        WorkStealingPool(size_t workers): queues(max<size_t>(workers, 1)){}
+
+        //run task(i) for every i in [0, count) across all workers
+        template<class Task>
+        void run(size_t count, Task task){
+            for(size_t i = 0; i < count; i++)
+                queues[i % queues.size()].jobs.push_back(i);
+
+            vector<thread> threads;
+            for(size_t w = 0; w < queues.size(); w++){
+                threads.emplace_back([this, w, &task](){
+                    size_t job;
+                    while(popLocal(w, job) || steal(w, job))
+                        task(job);
+                });
+            }
+            for(thread& t : threads)
+                t.join();
+        }
+};
+
+bool loadJobs(const string& filename, Profile profile, vector<Job>& jobs){
+    ifstream file(filename);
+    if(!file.is_open()){
+        cerr << "Failed to open jobs file " << filename << endl;
+        return false;
+    }
+
+    string line;
+    while(getline(file, line)){
+        if(line.empty() || line[0] == '#')
+            continue;
+        istringstream in(line);
+        Job job = {"", 0, "", profile};
+        if(!(in >> job.rom))
+            continue;
+        string seedText, profileName, extra;
+        in >> seedText >> job.inputScript >> profileName;
+        if(in >> extra || (!seedText.empty() && !parseNumber(seedText, job.seed))){
+            cerr << "Bad line in jobs file " << filename << ": " << line << endl;
+            return false;
+        }
+        if(job.inputScript == "-")
+            job.inputScript.clear();
+        if(!profileName.empty() && !parseProfile(profileName, job.profile))
+            return false;
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+//replay every recording across the pool, printing each final state hash; fails if any
+//recording can't run or doesn't end where it was recorded to
+static int runReplays(const vector<string>& files, size_t threads){
+    vector<ReplayResult> results(files.size());
+    auto start = chrono::steady_clock::now();
+    WorkStealingPool pool(threads);
+    pool.run(files.size(), [&](size_t i){
+        results[i] = runReplay(files[i]);
+    });
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    uint64_t total = 0, frames = 0;
+    size_t failed = 0;
+    for(size_t i = 0; i < files.size(); i++){
+        const ReplayResult& r = results[i];
+        if(!r.ok || !r.matched)
+            failed++;
+        if(!r.ok){
+            cout << files[i] << " FAILED" << endl;
+            continue;
+        }
+        total += r.instructions;
+        frames += r.frames;
+        cout << files[i] << " " << r.frames << " " << r.instructions << " " << std::hex << r.stateHash << std::dec
+             << (r.matched ? " OK" : " MISMATCH") << endl;
+    }
+
+    double played = (double)frames/TIMERFREQ;
+    cout << files.size() << " recordings (" << failed << " failed) on " << max<size_t>(threads, 1) << " threads: "
+         << played << "s of play, " << total << " instructions in " << seconds << "s, "
+         << (seconds > 0 ? played/seconds : 0) << "x real time" << endl;
+    return failed ? 1 : 0;
+}
+
+int runHeadless(int argc, char* argv[]){
+    uint64_t budget = 600*(INSTFREQ/TIMERFREQ);
+    Decoder decoder = nullptr;
+    string tracePrefix, capturePrefix, profilePrefix;
+    size_t threads = thread::hardware_concurrency();
+    size_t repeat = 1;
+    Profile profile = PROFILE_CUSTOM;
+    vector<string> jobFiles, roms, replays;
+
+    for(int i = 1; i < argc; i++){
+        string arg = argv[i];
+        bool hasValue = i+1 < argc;
+        if(arg == "--frames" && hasValue){
+            if(!parseNumber(argv[++i], budget))
+                return 1;
+            if(budget > UINT64_MAX/(INSTFREQ/TIMERFREQ)){
+                cerr << "Too many frames: " << argv[i] << endl;
+                return 1;
+            }
+            budget *= INSTFREQ/TIMERFREQ;
+        }
+        else if(arg == "--instructions" && hasValue){
+            if(!parseNumber(argv[++i], budget))
+                return 1;
+        }
+        else if(arg == "--threads" && hasValue){
+            if(!parseNumber(argv[++i], threads))
+                return 1;
+        }
+        else if(arg == "--repeat" && hasValue){
+            if(!parseNumber(argv[++i], repeat))
+                return 1;
+        }
+        else if(arg == "--dispatch" && hasValue){
+            string name = argv[++i];
+            if(name == "switch")
+                decoder = &Emulator::reference;
+            else if(name == "table")
+                decoder = &Emulator::dispatch;
+            else if(name == "block")
+                decoder = nullptr;
+            else {
+                cerr << "Unknown dispatch " << name << endl;
+                return 1;
+            }
+        }
+        else if(arg == "--trace" && hasValue){
+            if(!traceSupported())
+                return 1;
+            tracePrefix = argv[++i];
+        }
+        else if(arg == "--capture" && hasValue)
+            capturePrefix = argv[++i];
+        else if(arg == "--profile" && hasValue)
+            profilePrefix = argv[++i];
+        else if(arg == "--quirks" && hasValue){
+            if(!parseProfile(argv[++i], profile))
+                return 1;
+        }
+        else if(arg == "--jobs" && hasValue)
+            jobFiles.push_back(argv[++i]);
+        else if(arg == "--replay" && hasValue)
+            replays.push_back(argv[++i]);
+        else if(arg.compare(0, 2, "--") == 0){
+            cerr << "usage: chip8_headless (or emulator --headless) [--frames N | --instructions N] [--threads N] [--repeat N] [--dispatch switch|table|block] [--quirks PROFILE] [--trace PREFIX] [--capture PREFIX] [--profile PREFIX] (--jobs FILE | ROM... | --replay FILE...)" << endl;
+            return 1;
+        }
+        else
+            roms.push_back(arg);
+    }
+
+    if(!replays.empty()){
+        if(!jobFiles.empty() || !roms.empty()){
+            cerr << "Recordings can't be replayed in the same run as ROMs or jobs" << endl;
+            return 1;
+        }
+        return runReplays(replays, threads);
+    }
+
+    //--quirks is the default for ROMs on the command line and jobs that don't name a profile
+    vector<Job> jobs;
+    for(const string& file : jobFiles){
+        if(!loadJobs(file, profile, jobs))
+            return 1;
+    }
+    for(const string& rom : roms)
+        jobs.push_back({rom, 0, "", profile});
+
+    //--repeat runs every job again with consecutive seeds
+    size_t base = jobs.size();
+    for(size_t r = 1; r < repeat; r++){
+        for(size_t i = 0; i < base; i++){
+            Job job = jobs[i];
+            job.seed += r;
+            jobs.push_back(job);
+        }
+    }
+
+    if(jobs.empty()){
+        cerr << "No jobs to run" << endl;
+        return 1;
+    }
+
+    //one profile over every job, each worker thread counts into its own block
+    unique_ptr<Profiler> profiler;
+    if(!profilePrefix.empty())
+        profiler.reset(new Profiler());
+
+    vector<JobResult> results(jobs.size());
+    auto start = chrono::steady_clock::now();
+    WorkStealingPool pool(threads);
+    pool.run(jobs.size(), [&](size_t i){
+        string traceFile = tracePrefix.empty() ? "" : tracePrefix + "." + to_string(i) + ".trace";
+        string captureFile = capturePrefix.empty() ? "" : capturePrefix + "." + to_string(i) + ".c8v";
+        results[i] = runJob(jobs[i], budget, decoder, traceFile, captureFile, profiler.get());
+    });
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    uint64_t total = 0;
+    size_t failed = 0;
+    for(size_t i = 0; i < jobs.size(); i++){
+        if(!results[i].ok){
+            failed++;
+            cout << jobs[i].rom << " " << jobs[i].seed << " FAILED" << endl;
+            continue;
+        }
+        total += results[i].instructions;
+        cout << jobs[i].rom << " " << jobs[i].seed << " " << results[i].instructions << " " << std::hex << results[i].displayHash << std::dec << endl;
+    }
+
+    cout << jobs.size() << " jobs (" << failed << " failed) on " << max<size_t>(threads, 1) << " threads: "
+         << total << " instructions in " << seconds << "s, " << (seconds > 0 ? total/seconds : 0) << " instructions/s, "
+         << (total ? seconds*1e9*max<size_t>(threads, 1)/total : 0) << " ns/instruction per thread" << endl;
+    if(profiler && !writeProfile(*profiler, profilePrefix))
+        return 1;
+    return failed ? 1 : 0;
+}
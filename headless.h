@@ -0,0 +1,71 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "emulator.h"
+
+//one headless run: ROM file, RNG seed and optional input script
+struct Job {
+    std::string rom;
+    uint32_t seed;
+    std::string inputScript;
+    Profile profile;
+};
+
+//key change applied at the start of a frame (a release of key 0xFF releases every key)
+struct InputEvent {
+    uint32_t frame;
+    uint8_t key;
+    bool down;
+};
+
+//outcome of a headless run
+struct JobResult {
+    bool ok = false;
+    uint64_t instructions = 0;
+    uint64_t displayHash = 0;
+};
+
+//outcome of replaying a recording (replay.h)
+struct ReplayResult {
+    bool ok = false; //the recording and its ROM loaded and ran
+    bool matched = false; //ended in the recorded state after the recorded instructions
+    uint64_t frames = 0;
+    uint64_t instructions = 0;
+    uint64_t stateHash = 0;
+};
+
+//which decoder a headless run uses: reference switch or handler table, null for the block cache
+typedef void (Emulator::*Decoder)(uint16_t);
+
+//tracing needs the CHIP8_TRACE build flag
+bool traceSupported();
+
+//write PREFIX.json and PREFIX.folded from a profiler, false if either can't be written
+bool writeProfile(Profiler& profiler, const std::string& prefix);
+
+//read input script: one "<frame> <key>" per line, key is a hex digit to press it, '-' and a hex digit
+//to release it, or '-' alone to release every key
+bool loadInputScript(const std::string& filename, std::vector<InputEvent>& events);
+
+//FNV-1a over the visible part of each plane of a framebuffer, used to compare sweeps
+uint64_t hashDisplay(const FrameBuffer& display);
+
+//run one job without SDL for a fixed instruction budget, counting into profiler unless it is null
+//and writing every frame to captureFile unless it is empty
+JobResult runJob(const Job& job, uint64_t budget, Decoder decoder, const std::string& traceFile, const std::string& captureFile, Profiler* profiler);
+
+//run a recording made with the frontend's --record back to back, checking the ROM against the
+//recorded hash and the final state against the recorded one
+ReplayResult runReplay(const std::string& filename);
+
+//read jobs file: one "<rom> [seed] [input script|-] [quirk profile]" per line
+bool loadJobs(const std::string& filename, Profile profile, std::vector<Job>& jobs);
+
+//headless batch mode, never initializes SDL; argv[0] is the program or "--headless" and is skipped
+//usage: [--frames N | --instructions N] [--threads N] [--repeat N] [--dispatch switch|table|block] [--trace PREFIX] [--capture PREFIX] [--profile PREFIX] [--quirks PROFILE] (--jobs FILE | ROM... | --replay FILE...)
+int runHeadless(int argc, char* argv[]);
+
+#endif
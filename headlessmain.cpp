@@ -0,0 +1,6 @@
+#include "headless.h"
+
+//headless batch mode and replays without the SDL frontend, same options as emulator --headless
+int main(int argc, char* argv[]){
+    return runHeadless(argc, argv);
+}
@@ -0,0 +1,123 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <random>
+#include <cstring>
+#include "headless.h"
+#include "checkmain.h"
+using namespace std;
+
+
+//random program made of the spin-waits the block cache skips: a delay timer wait (FX07, 3XNN or
+//4XNN on the same register, 1NNN back) entered at a random phase, an FX0A key wait, and after
+//five rounds of both a 1NNN jumping to itself
+vector<uint8_t> randomRom(mt19937& rng){
+    vector<uint16_t> ops;
+    uint16_t delay = 1 + rng() % 120;
+    uint16_t Y = 2 + rng() % 12;
+    ops.push_back(0x6000 | Y << 8 | delay); //VY = delay
+    ops.push_back(0xF015 | Y << 8); //delay timer = VY
+    ops.push_back(0xF018 | Y << 8); //sound timer = VY
+    for(uint32_t i = rng() % 6; i > 0; i--)
+        ops.push_back(0x7E01); //filler, so the wait starts at any phase of a frame
+    uint16_t loop = 0x200 + 2*ops.size();
+    ops.push_back(0xF007 | Y << 8);
+    if(rng() & 1)
+        ops.push_back(0x3000 | Y << 8 | rng() % (delay + 1)); //spins until the timer reaches NN
+    else
+        ops.push_back(0x4000 | Y << 8 | delay); //spins while the timer is still at its start
+    ops.push_back(0x1000 | loop);
+    ops.push_back(0xA000 | 5*(rng() % 16)); //I = a font digit
+    ops.push_back(0xD005 | (rng() & 0xF) << 8 | (rng() & 0xF) << 4);
+    ops.push_back(0xF00A); //V0 = key
+    ops.push_back(0x7101); //V1 counts rounds
+    ops.push_back(0x3105);
+    ops.push_back(0x1200);
+    uint16_t halt = 0x200 + 2*ops.size();
+    ops.push_back(0x1000 | halt);
+
+    return romBytes(ops);
+}
+
+void applyKeys(Emulator& emu, const vector<InputEvent>& events, size_t& next, uint32_t frame){
+    for(; next < events.size() && events[next].frame <= frame; next++){
+        if(events[next].down)
+            emu.pressKey(events[next].key);
+        else
+            emu.releaseKey(events[next].key);
+    }
+}
+
+//usage: chip8_idlecheck [--roms N] [--frames N] [--seed N]
+//runs programs built from spin-waits with random key events under every quirk profile and
+//several frame lengths, once stepping every instruction through the reference switch and once
+//as headless jobs run, through the block cache with whole idle frames jumped over by
+//skipIdleFrames; the whole machine state must match at every frame both stop at
+int main(int argc, char* argv[]){
+    CheckOptions options{100, 2000};
+    if(!parseCheckOptions(argc, argv, options))
+        return 1;
+    uint32_t roms = options.roms, frames = options.frames, seed = options.seed;
+
+    const uint64_t frameLengths[] = {INSTFREQ/TIMERFREQ, 3, 4, 5};
+    unique_ptr<MachineState> a(new MachineState), b(new MachineState);
+    uint32_t failed = 0;
+    for(int p = PROFILE_CUSTOM; p <= PROFILE_XOCHIP; p++){
+        Profile profile = (Profile)p;
+        mt19937 rng(seed);
+        uint32_t diverged = 0;
+        uint64_t skipped = 0;
+        for(uint32_t r = 0; r < roms; r++){
+            vector<uint8_t> rom = randomRom(rng);
+            uint64_t perFrame = frameLengths[r % 4];
+            uint32_t machineSeed = rng();
+            vector<InputEvent> events;
+            for(uint32_t f = rng() % 50; f < frames; f += 1 + rng() % 200)
+                events.push_back({f, (uint8_t)(rng() & 0xF), (rng() & 1) != 0});
+
+            unique_ptr<Emulator> stepped(new Emulator(machineSeed, profile));
+            unique_ptr<Emulator> skipping(new Emulator(machineSeed, profile));
+            stepped->load(rom.data(), rom.size());
+            skipping->load(rom.data(), rom.size());
+            size_t steppedEvent = 0, skippingEvent = 0;
+            uint32_t skippingFrame = 0; //next frame the skipping machine runs
+            for(uint32_t f = 0; f < frames; f++){
+                applyKeys(*stepped, events, steppedEvent, f);
+                for(uint64_t i = 0; i < perFrame; i++)
+                    stepped->decode(stepped->fetch());
+                stepped->decrementTimers();
+
+                //the frame loop of runJob
+                if(f == skippingFrame){
+                    applyKeys(*skipping, events, skippingEvent, f);
+                    skipping->run(perFrame);
+                    skipping->decrementTimers();
+                    skippingFrame++;
+                    if(skipping->idle()){
+                        uint64_t idleFrames = min<uint64_t>(skipping->idleTicks(), frames - skippingFrame);
+                        if(skippingEvent < events.size())
+                            idleFrames = min<uint64_t>(idleFrames, events[skippingEvent].frame - skippingFrame);
+                        skipping->skipIdleFrames(idleFrames, perFrame);
+                        skippingFrame += idleFrames;
+                        skipped += idleFrames;
+                    }
+                }
+                if(f + 1 != skippingFrame)
+                    continue;
+                stepped->save(*a);
+                skipping->save(*b);
+                if(memcmp(a.get(), b.get(), sizeof(MachineState))){
+                    cout << PROFILENAMES[p] << " rom " << r << " (" << perFrame << " per frame): skipping differs after frame "
+                         << f << hex << ", PC " << a->PC << "/" << b->PC << ", delay " << (int)a->delay << "/" << (int)b->delay
+                         << dec << endl;
+                    diverged++;
+                    break;
+                }
+            }
+        }
+        cout << PROFILENAMES[p] << ": " << roms << " programs, " << skipped << " frames skipped, " << diverged << " diverged" << endl;
+        failed += diverged;
+    }
+    return failed ? 1 : 0;
+}
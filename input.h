@@ -0,0 +1,60 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+
+//key going down or up, stamped with the steady clock when the frontend saw it
+struct KeyEvent {
+    uint64_t time; //steady_clock nanoseconds
+    uint8_t key; //0-F
+    bool down;
+};
+
+//steady clock in nanoseconds, the time base of KeyEvent
+inline uint64_t inputClock(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//lock-free single-producer single-consumer ring of key events: the display thread pushes
+//what it polls, the emu thread pops them between instructions. Neither side ever waits;
+//a full ring drops the event and counts it.
+class InputQueue {
+    private:
+        static const uint32_t CAPACITY = 256; //power of two
+        KeyEvent events[CAPACITY];
+        alignas(64) std::atomic<uint32_t> head{0}; //next slot to read, written by the consumer
+        alignas(64) std::atomic<uint32_t> tail{0}; //next slot to write, written by the producer
+        std::atomic<uint64_t> lost{0};
+
+    public:
+        //producer: false if the ring was full and the event was dropped
+        bool push(const KeyEvent& event){
+            uint32_t t = tail.load(std::memory_order_relaxed);
+            if(t - head.load(std::memory_order_acquire) == CAPACITY){
+                lost.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            events[t % CAPACITY] = event;
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        //consumer: oldest event, false if there is none
+        bool pop(KeyEvent& event){
+            uint32_t h = head.load(std::memory_order_relaxed);
+            if(h == tail.load(std::memory_order_acquire))
+                return false;
+            event = events[h % CAPACITY];
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+
+        //events dropped because the consumer fell CAPACITY behind
+        uint64_t dropped() const {
+            return lost.load(std::memory_order_relaxed);
+        }
+};
+
+#endif
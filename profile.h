@@ -0,0 +1,272 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+
+//instruction forms counted separately, in the order they are reported
+enum OpClass {
+    OP_00E0, OP_00EE, OP_00CN, OP_00DN, OP_00FB, OP_00FC, OP_00FD, OP_00FE,
+    OP_1NNN, OP_2NNN, OP_3XNN, OP_4XNN, OP_5XY0, OP_5XY2, OP_5XY3, OP_6XNN, OP_7XNN,
+    OP_8XY0, OP_8XY1, OP_8XY2, OP_8XY3, OP_8XY4, OP_8XY5, OP_8XY6, OP_8XY7, OP_8XYE,
+    OP_9XY0, OP_ANNN, OP_BNNN, OP_CXNN, OP_DXYN, OP_EX9E, OP_EXA1,
+    OP_F000, OP_FN01, OP_F002, OP_FX07, OP_FX0A, OP_FX15, OP_FX18, OP_FX1E, OP_FX29,
+    OP_FX30, OP_FX33, OP_FX3A, OP_FX55, OP_FX65, OP_FX75, OP_FX85,
+    OP_OTHER,
+    OPCLASSES
+};
+
+const char* const OPCLASSNAMES[OPCLASSES] = {
+    "00E0", "00EE", "00CN", "00DN", "00FB", "00FC", "00FD", "00FE",
+    "1NNN", "2NNN", "3XNN", "4XNN", "5XY0", "5XY2", "5XY3", "6XNN", "7XNN",
+    "8XY0", "8XY1", "8XY2", "8XY3", "8XY4", "8XY5", "8XY6", "8XY7", "8XYE",
+    "9XY0", "ANNN", "BNNN", "CXNN", "DXYN", "EX9E", "EXA1",
+    "F000", "FN01", "F002", "FX07", "FX0A", "FX15", "FX18", "FX1E", "FX29",
+    "FX30", "FX33", "FX3A", "FX55", "FX65", "FX75", "FX85",
+    "other"
+};
+
+const uint32_t PROFILEADDRESSES = 0x10000; //PC histogram covers the whole address space
+const int PROFILEDEPTH = 16; //call-graph depth followed, same as the machine stack
+const uint16_t PROFILEMAIN = 0x1000; //stands for the code outside any subroutine, past every 2NNN target
+const uint64_t DRAWSAMPLE = 64; //one draw in this many is timed, reading the clock costs more than most draws
+const uint64_t PROFILEFLUSH = 1 << 16; //block engine instructions counted per block before they are credited to each address
+
+//counters written by a single thread; increments are plain relaxed load/store pairs (no locked
+//instructions) so any thread can read them at any time without a data race
+class ProfileCounters {
+    public:
+        //calls from a call site in one subroutine to another, counted flat; the call tree is only
+        //built from these when the profile is read
+        struct CallEdge {
+            uint16_t caller; //entry of the subroutine the call site is in, PROFILEMAIN outside any
+            uint16_t site;
+            uint16_t target;
+            std::atomic<uint64_t> calls{0};
+        };
+
+        std::atomic<uint64_t> classes[OPCLASSES]{};
+        std::atomic<uint64_t> pcs[PROFILEADDRESSES]{};
+        std::atomic<uint64_t> self[PROFILEMAIN + 1]{}; //instructions run in each subroutine itself, by entry
+        std::atomic<uint64_t> drawNanos{0}; //time spent inside DXYN, estimated from every DRAWSAMPLE'th draw
+
+        static void bump(std::atomic<uint64_t>& counter, uint64_t amount = 1){
+            counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        }
+
+        //edge for a call from site in caller to target, created on first call
+        CallEdge& edge(uint16_t caller, uint16_t site, uint16_t target){
+            CallEdge*& last = recent[site % RECENT];
+            if(last && last->site == site && last->target == target && last->caller == caller)
+                return *last;
+            uint64_t key = (uint64_t)caller << 32 | (uint32_t)site << 16 | target;
+            auto found = edges.find(key);
+            if(found == edges.end())
+                found = edges.emplace(key, addEdge(caller, site, target)).first;
+            last = &at(found->second);
+            return *last;
+        }
+
+        //(caller, target) to calls, summed over call sites, for merging
+        void collectEdges(std::map<std::pair<uint16_t, uint16_t>, uint64_t>& out){
+            std::lock_guard<std::mutex> guard(edgesLock);
+            for(uint32_t id = 0; id < edgeCount; id++){
+                CallEdge& e = at(id);
+                out[{e.caller, e.target}] += e.calls.load(std::memory_order_relaxed);
+            }
+        }
+
+    private:
+        static const uint32_t CHUNK = 1024; //edges are allocated in chunks so they never move
+        static const uint32_t RECENT = 256; //last edge seen at each call site's low bits, saves the map lookup in loops
+        std::mutex edgesLock; //held while adding an edge or reading them
+        std::vector<std::unique_ptr<CallEdge[]>> chunks;
+        uint32_t edgeCount = 0;
+        std::unordered_map<uint64_t, uint32_t> edges; //(caller, site, target) to edge, writer only
+        CallEdge* recent[RECENT] = {}; //writer only
+
+        CallEdge& at(uint32_t id){
+            return chunks[id / CHUNK][id % CHUNK];
+        }
+
+        uint32_t addEdge(uint16_t caller, uint16_t site, uint16_t target){
+            std::lock_guard<std::mutex> guard(edgesLock);
+            if(edgeCount % CHUNK == 0)
+                chunks.emplace_back(new CallEdge[CHUNK]);
+            CallEdge& e = at(edgeCount);
+            e.caller = caller;
+            e.site = site;
+            e.target = target;
+            return edgeCount++;
+        }
+};
+
+//execution profile shared by any number of emulators: each thread running one gets its own
+//counters, and reads merge them all
+class Profiler {
+    private:
+        std::mutex lock;
+        std::vector<std::unique_ptr<ProfileCounters>> all;
+        uint64_t id; //tells profilers apart in the per-thread lookup below
+
+        static uint64_t nextId(){
+            static std::atomic<uint64_t> counter{0};
+            return ++counter;
+        }
+
+    public:
+        Profiler(): id(nextId()){}
+
+        //counters owned by the calling thread, created the first time it asks
+        ProfileCounters* counters(){
+            thread_local std::vector<std::pair<uint64_t, ProfileCounters*>> mine;
+            for(const std::pair<uint64_t, ProfileCounters*>& entry : mine){
+                if(entry.first == id)
+                    return entry.second;
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            all.emplace_back(new ProfileCounters());
+            mine.push_back({id, all.back().get()});
+            return all.back().get();
+        }
+
+        //totals over every thread
+        struct Summary {
+            uint64_t classes[OPCLASSES] = {};
+            std::vector<uint64_t> pcs = std::vector<uint64_t>(PROFILEADDRESSES);
+            uint64_t instructions = 0;
+            uint64_t drawNanos = 0;
+            std::map<std::string, std::pair<uint64_t, uint64_t>> calls; //path to (calls, instructions)
+        };
+
+        Summary merge(){
+            Summary sum;
+            std::vector<uint64_t> self(PROFILEMAIN + 1);
+            std::map<std::pair<uint16_t, uint16_t>, uint64_t> edges; //(caller, target) to calls
+            std::vector<uint64_t> called(PROFILEMAIN + 1); //calls into each subroutine from anywhere
+            std::lock_guard<std::mutex> guard(lock);
+            for(const std::unique_ptr<ProfileCounters>& c : all){
+                for(int i = 0; i < OPCLASSES; i++){
+                    uint64_t count = c->classes[i].load(std::memory_order_relaxed);
+                    sum.classes[i] += count;
+                    sum.instructions += count;
+                }
+                for(uint32_t pc = 0; pc < PROFILEADDRESSES; pc++)
+                    sum.pcs[pc] += c->pcs[pc].load(std::memory_order_relaxed);
+                sum.drawNanos += c->drawNanos.load(std::memory_order_relaxed);
+                for(uint32_t entry = 0; entry <= PROFILEMAIN; entry++)
+                    self[entry] += c->self[entry].load(std::memory_order_relaxed);
+                c->collectEdges(edges);
+            }
+            for(const auto& e : edges)
+                called[e.first.second] += e.second;
+            addCalls(sum.calls, edges, self, called, "main", PROFILEMAIN, 1.0, 0);
+            return sum;
+        }
+
+        //call path ending in entry, then every path below it, with share the part of entry's calls
+        //and instructions made through this path: the counters don't say which path each call came
+        //by, so a subroutine's are split between its callers in proportion to their calls
+        static void addCalls(std::map<std::string, std::pair<uint64_t, uint64_t>>& out, const std::map<std::pair<uint16_t, uint16_t>, uint64_t>& edges,
+                             const std::vector<uint64_t>& self, const std::vector<uint64_t>& called, const std::string& path, uint16_t entry, double share, int depth){
+            std::pair<uint64_t, uint64_t>& counts = out[path];
+            counts.first += std::llround(share*called[entry]);
+            counts.second += std::llround(share*self[entry]);
+            if(depth == PROFILEDEPTH)
+                return;
+            for(auto e = edges.lower_bound({entry, 0}); e != edges.end() && e->first.first == entry; ++e){
+                if(!e->second)
+                    continue;
+                double below = share*e->second/called[e->first.second];
+                //paths with less than one call's share are left out, recursion fades away through them
+                if(below*called[e->first.second] < 0.5)
+                    continue;
+                char hex[8];
+                snprintf(hex, sizeof(hex), "%04X", e->first.second);
+                addCalls(out, edges, self, called, path + ";" + hex, e->first.second, below, depth + 1);
+            }
+        }
+
+        //JSON summary: instruction counts per opcode form, hottest addresses, every executed address,
+        //call graph and draw time
+        bool writeJson(const std::string& filename, size_t hotspots = 32){
+            std::ofstream out(filename);
+            if(!out.is_open())
+                return false;
+            Summary sum = merge();
+
+            out << "{\n  \"instructions\": " << sum.instructions << ",\n  \"opcodes\": {";
+            bool first = true;
+            for(int i = 0; i < OPCLASSES; i++){
+                if(!sum.classes[i])
+                    continue;
+                out << (first ? "\n" : ",\n") << "    \"" << OPCLASSNAMES[i] << "\": " << sum.classes[i];
+                first = false;
+            }
+
+            std::vector<uint32_t> order;
+            for(uint32_t pc = 0; pc < PROFILEADDRESSES; pc++){
+                if(sum.pcs[pc])
+                    order.push_back(pc);
+            }
+            std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b){
+                return sum.pcs[a] > sum.pcs[b];
+            });
+            out << "\n  },\n  \"hotspots\": [";
+            for(size_t i = 0; i < order.size() && i < hotspots; i++){
+                char pc[8];
+                snprintf(pc, sizeof(pc), "%04X", order[i]);
+                out << (i ? ",\n" : "\n") << "    {\"pc\": \"" << pc << "\", \"count\": " << sum.pcs[order[i]] << "}";
+            }
+
+            out << "\n  ],\n  \"pcHistogram\": {";
+            first = true;
+            for(uint32_t pc = 0; pc < PROFILEADDRESSES; pc++){
+                if(!sum.pcs[pc])
+                    continue;
+                char hex[8];
+                snprintf(hex, sizeof(hex), "%04X", pc);
+                out << (first ? "\n" : ",\n") << "    \"" << hex << "\": " << sum.pcs[pc];
+                first = false;
+            }
+
+            out << "\n  },\n  \"calls\": [";
+            first = true;
+            for(const auto& entry : sum.calls){
+                out << (first ? "\n" : ",\n") << "    {\"stack\": \"" << entry.first << "\", \"calls\": " << entry.second.first
+                    << ", \"instructions\": " << entry.second.second << "}";
+                first = false;
+            }
+
+            uint64_t draws = sum.classes[OP_DXYN];
+            out << "\n  ],\n  \"draw\": {\"count\": " << draws << ", \"ns\": " << sum.drawNanos
+                << ", \"nsPerDraw\": " << (draws ? (double)sum.drawNanos/draws : 0) << "}\n}\n";
+            return out.good();
+        }
+
+        //folded stacks, one "main;0300;0350 count" line per call path, for flamegraph tools
+        bool writeFolded(const std::string& filename){
+            std::ofstream out(filename);
+            if(!out.is_open())
+                return false;
+            Summary sum = merge();
+            for(const auto& entry : sum.calls){
+                if(entry.second.second)
+                    out << entry.first << " " << entry.second.second << "\n";
+            }
+            return out.good();
+        }
+};
+
+#endif
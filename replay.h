@@ -0,0 +1,222 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include "emulator.h"
+
+//input recording: header, the ROM path, then one record per key change: instructions run since
+//the previous change as a varint and the 16 bit key mask after it (host byte order like snapshots)
+const char REPLAYMAGIC[4] = {'C', '8', 'R', 'P'};
+const uint32_t REPLAYVERSION = 2;
+
+struct ReplayHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t seed;
+    uint32_t ips; //instructions per second the frames were scheduled at
+    uint32_t profile;
+    uint32_t romLength; //bytes of ROM path after the header
+    uint64_t romHash; //RomImage::hash of the ROM
+    uint64_t frames;
+    uint64_t instructions;
+    uint64_t stateHash; //hashMachine of the state after the last frame
+    uint64_t events;
+};
+
+//keys held from an instruction on
+struct ReplayEvent {
+    uint64_t instruction; //instructions run before the change, counted from the start
+    uint16_t keys; //bit n for key n
+};
+
+//a session that runs again exactly: ROM, seed, profile, frame schedule and every key change,
+//plus what the run it was recorded from ended in
+struct Recording {
+    std::string rom;
+    uint64_t romHash = 0;
+    uint32_t seed = 0;
+    Profile profile = PROFILE_CUSTOM;
+    uint32_t ips = INSTFREQ;
+    uint64_t frames = 0;
+    uint64_t instructions = 0;
+    uint64_t stateHash = 0;
+    std::vector<ReplayEvent> events;
+
+    //the held keys became keys after instruction instructions
+    void record(uint64_t instruction, uint16_t keys){
+        events.push_back({instruction, keys});
+    }
+};
+
+//FNV-1a over every field of a machine state, skipping struct padding so equal states always match
+inline uint64_t hashMachine(const MachineState& s){
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&hash](const void* data, size_t size){
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        for(size_t i = 0; i < size; i++){
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+    };
+    add(s.registers, sizeof(s.registers));
+    add(&s.PC, sizeof(s.PC));
+    add(&s.I, sizeof(s.I));
+    add(&s.SP, sizeof(s.SP));
+    add(&s.delay, sizeof(s.delay));
+    add(&s.sound, sizeof(s.sound));
+    add(&s.keyWait, sizeof(s.keyWait));
+    add(&s.rng, sizeof(s.rng));
+    add(s.stack, sizeof(s.stack));
+    add(&s.planes, sizeof(s.planes));
+    add(&s.pitch, sizeof(s.pitch));
+    add(s.audio, sizeof(s.audio));
+    add(&s.patternLoaded, sizeof(s.patternLoaded));
+    add(s.flags, sizeof(s.flags));
+    add(s.screen.planes, sizeof(s.screen.planes));
+    add(&s.screen.hires, sizeof(s.screen.hires));
+    add(s.memory, sizeof(s.memory));
+    return hash;
+}
+
+//hash of an emulator's current state
+inline uint64_t hashMachine(const Emulator& emu){
+    std::unique_ptr<MachineState> state(new MachineState);
+    emu.save(*state);
+    return hashMachine(*state);
+}
+
+inline bool writeRecording(const std::string& filename, const Recording& recording){
+    std::ofstream file(filename, std::ios::binary);
+    if(!file.is_open()){
+        std::cerr << "Failed to open recording " << filename << std::endl;
+        return false;
+    }
+    ReplayHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, REPLAYMAGIC, 4);
+    header.version = REPLAYVERSION;
+    header.seed = recording.seed;
+    header.ips = recording.ips;
+    header.profile = recording.profile;
+    header.romLength = recording.rom.size();
+    header.romHash = recording.romHash;
+    header.frames = recording.frames;
+    header.instructions = recording.instructions;
+    header.stateHash = recording.stateHash;
+    header.events = recording.events.size();
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(recording.rom.data(), recording.rom.size());
+
+    std::vector<uint8_t> out;
+    out.reserve(recording.events.size()*4);
+    uint64_t previous = 0;
+    for(const ReplayEvent& event : recording.events){
+        uint64_t delta = event.instruction - previous;
+        while(delta >= 0x80){
+            out.push_back((uint8_t)(delta | 0x80));
+            delta >>= 7;
+        }
+        out.push_back((uint8_t)delta);
+        out.push_back(event.keys & 0xFF);
+        out.push_back(event.keys >> 8);
+        previous = event.instruction;
+    }
+    file.write(reinterpret_cast<const char*>(out.data()), out.size());
+    if(!file.good()){
+        std::cerr << "Failed to write recording " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+//false if filename isn't a recording this version can read
+inline bool loadRecording(const std::string& filename, Recording& recording){
+    std::ifstream file(filename, std::ios::binary);
+    if(!file.is_open()){
+        std::cerr << "Failed to open recording " << filename << std::endl;
+        return false;
+    }
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    ReplayHeader header;
+    if(data.size() < sizeof(header) || memcmp(data.data(), REPLAYMAGIC, 4) != 0){
+        std::cerr << "Not a recording: " << filename << std::endl;
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    if(header.version != REPLAYVERSION || header.profile > PROFILE_XOCHIP || header.ips == 0){
+        std::cerr << "Unsupported recording version " << header.version << ": " << filename << std::endl;
+        return false;
+    }
+    if(data.size() - sizeof(header) < header.romLength){
+        std::cerr << "Truncated recording " << filename << std::endl;
+        return false;
+    }
+    const uint8_t* at = data.data() + sizeof(header);
+    const uint8_t* end = data.data() + data.size();
+    recording.rom.assign(reinterpret_cast<const char*>(at), header.romLength);
+    at += header.romLength;
+    recording.romHash = header.romHash;
+    recording.seed = header.seed;
+    recording.profile = (Profile)header.profile;
+    recording.ips = header.ips;
+    recording.frames = header.frames;
+    recording.instructions = header.instructions;
+    recording.stateHash = header.stateHash;
+
+    recording.events.clear();
+    uint64_t instruction = 0;
+    for(uint64_t i = 0; i < header.events; i++){
+        uint64_t delta = 0;
+        int shift = 0;
+        while(at < end && (*at & 0x80)){
+            delta |= (uint64_t)(*at++ & 0x7F) << shift;
+            shift += 7;
+            //a 64 bit count takes at most 10 bytes, the 10th without the continuation bit
+            if(shift >= 64){
+                std::cerr << "Malformed recording " << filename << std::endl;
+                return false;
+            }
+        }
+        if(end - at < 3){
+            std::cerr << "Truncated recording " << filename << std::endl;
+            return false;
+        }
+        delta |= (uint64_t)*at++ << shift;
+        instruction += delta;
+        recording.events.push_back({instruction, (uint16_t)(at[0] | at[1] << 8)});
+        at += 2;
+    }
+    return true;
+}
+
+//run a recording on emu, which must have been reset to the recorded ROM and seed in the
+//recorded profile: the same frames back to back, with each key change applied after the same
+//instruction it was made at. Returns the instructions run
+inline uint64_t replayRecording(Emulator& emu, const Recording& recording){
+    uint64_t done = 0;
+    size_t next = 0;
+    for(uint64_t frame = 1; frame <= recording.frames; frame++){
+        //the frontend's schedule: ips spread over frames without losing the remainder
+        uint64_t target = frame*recording.ips/TIMERFREQ;
+        while(next < recording.events.size() && recording.events[next].instruction < target){
+            const ReplayEvent& event = recording.events[next++];
+            if(event.instruction > done){
+                emu.run(event.instruction - done);
+                done = event.instruction;
+            }
+            emu.setKeys(event.keys);
+        }
+        emu.run(target - done);
+        done = target;
+        emu.decrementTimers();
+    }
+    return done;
+}
+
+#endif
@@ -0,0 +1,125 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <random>
+#include "headless.h"
+#include "replay.h"
+#include "romcache.h"
+#include "checkmain.h"
+using namespace std;
+
+const char* ROMFILE = "replaycheck.ch8";
+
+//spins counting in V4 until key V5 is held, then waits on FX0A for a key, draws its digit at a
+//random place and spins on that key next, so the final state depends on the exact instruction
+//every key change lands on
+const vector<uint16_t> PROGRAM = {
+    0x7401, //200: V4 += 1
+    0xE59E, //202: skip if key V5 is down
+    0x1200, //204: back to 200
+    0xF00A, //206: V0 = key
+    0xF029, //208: I = digit V0
+    0xC13F, //20A: V1 = rand & 63
+    0xC21F, //20C: V2 = rand & 31
+    0xD125, //20E: draw it
+    0x8500, //210: V5 = V0
+    0x1200  //212: back to 200
+};
+
+//play the recording's events the way the frontend does, stepping each instruction through the
+//reference switch and decrementing timers on its frame schedule, and fill in how it ended
+void record(const RomImage& rom, Recording& recording){
+    Emulator emu(recording.seed, recording.profile);
+    emu.reset(rom.pristine(), recording.seed);
+    uint64_t done = 0;
+    size_t next = 0;
+    for(uint64_t frame = 1; frame <= recording.frames; frame++){
+        uint64_t target = frame*recording.ips/TIMERFREQ;
+        for(; done < target; done++){
+            for(; next < recording.events.size() && recording.events[next].instruction == done; next++)
+                emu.setKeys(recording.events[next].keys);
+            emu.reference(emu.fetch());
+        }
+        emu.decrementTimers();
+    }
+    recording.instructions = done;
+    recording.stateHash = hashMachine(emu);
+}
+
+//usage: chip8_replaycheck
+//records sessions of a generated ROM with random seeds, profiles and key changes in code, writes
+//them out and replays them through runReplay as chip8_headless --replay does: each must end in
+//the recorded state, and must stop matching once one byte of its key changes is flipped
+int main(){
+    vector<uint8_t> bytes = romBytes(PROGRAM);
+    ofstream(ROMFILE, ios::binary).write((const char*)bytes.data(), bytes.size());
+    shared_ptr<const RomImage> rom = RomCache::global().get(ROMFILE);
+    if(!rom)
+        return 1;
+
+    mt19937 rng(1);
+    uint32_t failed = 0;
+    for(int r = 0; r < 20; r++){
+        Recording recording;
+        recording.rom = ROMFILE;
+        recording.romHash = rom->hash();
+        recording.seed = rng();
+        recording.profile = (Profile)(r % (PROFILE_XOCHIP + 1));
+        recording.ips = r % 2 ? INSTFREQ : 1000 + rng() % 1000;
+        recording.frames = 60 + rng() % 300;
+        //key 0 goes down first and starts the program drawing; later changes are random masks,
+        //often empty so FX0A sees keys come back up
+        uint64_t total = recording.frames*recording.ips/TIMERFREQ;
+        uint64_t at = 1 + rng() % 100;
+        recording.record(at, 0x0001);
+        while((at += 1 + rng() % 300) < total)
+            recording.record(at, rng() % 3 ? 0 : 1 << (rng() % 16));
+        record(*rom, recording);
+
+        string file = "replaycheck." + to_string(r) + ".c8r";
+        if(!writeRecording(file, recording))
+            return 1;
+        ReplayResult result = runReplay(file);
+        if(!result.ok || !result.matched || result.instructions != recording.instructions || result.frames != recording.frames){
+            cout << file << ": replay doesn't match the recorded run" << endl;
+            failed++;
+            continue;
+        }
+
+        //the first event's instruction is below 0x80, one varint byte, and the low byte of its key
+        //mask follows: with it cleared key 0 never goes down there
+        fstream stream(file, ios::binary | ios::in | ios::out);
+        stream.seekp(sizeof(ReplayHeader) + recording.rom.size() + 1);
+        stream.put(0);
+        stream.close();
+        result = runReplay(file);
+        if(!result.ok || result.matched){
+            cout << file << ": replay still matches after its first key change was dropped" << endl;
+            failed++;
+        }
+    }
+    //an instruction count whose varint runs past 64 bits is malformed, not read on
+    {
+        Recording recording;
+        recording.rom = ROMFILE;
+        recording.romHash = rom->hash();
+        for(int e = 0; e < 4; e++)
+            recording.record(e, 0);
+        record(*rom, recording);
+        if(!writeRecording("replaycheck.long.c8r", recording))
+            return 1;
+        fstream stream("replaycheck.long.c8r", ios::binary | ios::in | ios::out);
+        stream.seekp(sizeof(ReplayHeader) + recording.rom.size());
+        for(int i = 0; i < 11; i++)
+            stream.put((char)0xFF);
+        stream.close();
+        if(runReplay("replaycheck.long.c8r").ok){
+            cout << "replaycheck.long.c8r: an 11 byte varint was accepted" << endl;
+            failed++;
+        }
+    }
+    cout << "replay: 20 recordings, " << failed << " failed" << endl;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,178 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include "xordelta.h"
+
+//history of fixed-size state snapshots, one per frame, newest last.
+//every keyInterval-th snapshot is a keyframe; the others are stored as the XOR
+//against their keyframe, delta encoded (xordelta.h) so unchanged bytes cost almost nothing.
+//entries live in a circular byte log capped at maxBytes and are indexed by a fixed ring of
+//maxFrames slots, the oldest keyframe group is dropped to make room, so push and pop do
+//O(state size) work and never allocate after construction.
+class RewindBuffer {
+    private:
+        struct Entry {
+            size_t offset; //position in log
+            size_t length; //encoded bytes
+            bool key; //keyframe, encoded against zero
+        };
+
+        size_t stateSize;
+        int keyInterval;
+        std::vector<uint8_t> log; //circular storage for encoded entries
+        std::vector<Entry> ring; //entry slots, sized once
+        size_t first = 0; //slot of the oldest entry
+        size_t count = 0; //live entries
+        size_t head = 0; //next write position in log
+        int sinceKey = 0; //entries pushed since the newest keyframe
+        std::vector<uint8_t> keyframe; //decoded newest keyframe
+        std::vector<uint8_t> scratch; //encoder output
+        std::vector<uint8_t> decoded; //decoder scratch
+
+        //encode state XOR base into scratch
+        size_t encode(const uint8_t* state, const uint8_t* base){
+            return encodeXorDelta(state, base, stateSize, scratch.data());
+        }
+
+        //apply an encoded entry on top of base, writing the result to out
+        void decode(const Entry& entry, const uint8_t* base, uint8_t* out) const {
+            memcpy(out, base, stateSize);
+            decodeXorDelta(&log[entry.offset], entry.length, out, stateSize);
+        }
+
+        //i-th live entry, oldest first
+        Entry& entry(size_t i){
+            return ring[(first + i) % ring.size()];
+        }
+
+        const Entry& entry(size_t i) const {
+            return ring[(first + i) % ring.size()];
+        }
+
+        void popOldest(){
+            first = (first + 1) % ring.size();
+            count--;
+        }
+
+        //entries are laid out oldest to newest from the front entry to head, so a write
+        //that clears the oldest entry clears all of them
+        bool overlapsOldest(size_t offset, size_t length) const {
+            if(!count)
+                return false;
+            size_t start = entry(0).offset;
+            return offset < start + entry(0).length && start < offset + length;
+        }
+
+        //drop the oldest keyframe and every delta that depends on it
+        void dropOldestGroup(){
+            popOldest();
+            while(count && !entry(0).key)
+                popOldest();
+        }
+
+        //index of the keyframe the entry at index depends on
+        size_t keyFor(size_t index) const {
+            while(!entry(index).key)
+                index--;
+            return index;
+        }
+
+    public:
+        RewindBuffer(size_t stateSize, size_t maxBytes, size_t maxFrames, int keyInterval = 60):
+            stateSize(stateSize), keyInterval(keyInterval), log(maxBytes),
+            ring(std::max<size_t>(1, std::min(maxFrames, maxBytes))), //an entry takes at least a byte
+            keyframe(stateSize), scratch(2*stateSize + 32), decoded(stateSize){}
+
+        //record the state at a frame boundary
+        void push(const void* state){
+            const uint8_t* bytes = static_cast<const uint8_t*>(state);
+            bool key = !count || sinceKey >= keyInterval;
+            size_t length;
+            if(key){
+                memset(decoded.data(), 0, stateSize);
+                length = encode(bytes, decoded.data());
+            }
+            else
+                length = encode(bytes, keyframe.data());
+
+            //one entry can't be bigger than the whole log
+            if(length > log.size())
+                return;
+
+            //wrap to the start when the entry doesn't fit before the end; entries past head
+            //are the oldest ones and go first so the live entries no longer wrap
+            if(head + length > log.size()){
+                while(count && entry(0).offset >= head)
+                    dropOldestGroup();
+                head = 0;
+            }
+            while(overlapsOldest(head, length) || count == ring.size())
+                dropOldestGroup();
+
+            //the newest keyframe can't have been dropped without its deltas, so this only happens when everything is gone
+            if(!key && !count){
+                sinceKey = keyInterval;
+                push(state);
+                return;
+            }
+
+            memcpy(&log[head], scratch.data(), length);
+            entry(count++) = {head, length, key};
+            head += length;
+
+            if(key){
+                memcpy(keyframe.data(), bytes, stateSize);
+                sinceKey = 1;
+            }
+            else
+                sinceKey++;
+        }
+
+        //remove the newest snapshot and write it to state, returns false when history is empty
+        bool pop(void* state){
+            if(!count)
+                return false;
+
+            //keyframe always holds the decoded keyframe of the newest entry
+            size_t newest = count - 1;
+            size_t key = keyFor(newest);
+            if(key == newest)
+                memcpy(state, keyframe.data(), stateSize);
+            else
+                decode(entry(newest), keyframe.data(), static_cast<uint8_t*>(state));
+
+            head = entry(newest).offset;
+            count--;
+
+            //continue encoding against the keyframe of whatever is now newest
+            if(!count)
+                sinceKey = 0;
+            else {
+                size_t previousKey = keyFor(count - 1);
+                if(key == newest){
+                    memset(decoded.data(), 0, stateSize);
+                    decode(entry(previousKey), decoded.data(), keyframe.data());
+                }
+                sinceKey = (int)(count - previousKey);
+            }
+            return true;
+        }
+
+        size_t frames() const {
+            return count;
+        }
+
+        //bytes of log holding live entries
+        size_t bytesUsed() const {
+            size_t total = 0;
+            for(size_t i = 0; i < count; i++)
+                total += entry(i).length;
+            return total;
+        }
+};
+
+#endif
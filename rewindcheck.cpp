@@ -0,0 +1,83 @@
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <random>
+#include "rewind.h"
+using namespace std;
+
+const size_t STATESIZE = 256;
+
+//usage: chip8_rewindcheck
+//random pushes and pops on RewindBuffers of random log sizes, frame caps and keyframe intervals,
+//against a deque of every state pushed: eviction may only take the oldest states, every pop must
+//give back the newest one exactly, and the log and frame caps must hold throughout
+int main(){
+    mt19937 rng(1);
+    uint32_t failed = 0;
+    for(int trial = 0; trial < 300; trial++){
+        //the log always fits the largest encoding of one state, so no push is refused
+        size_t maxBytes = 2*STATESIZE + 32 + rng() % 4096;
+        size_t maxFrames = 1 + rng() % 64;
+        int keyInterval = 1 + rng() % 12;
+        RewindBuffer buffer(STATESIZE, maxBytes, maxFrames, keyInterval);
+        deque<vector<uint8_t>> model;
+        vector<uint8_t> state(STATESIZE), out(STATESIZE);
+
+        bool ok = true;
+        for(int op = 0; op < 2000 && ok; op++){
+            //pushes outnumber pops, in bursts of either, so the buffer fills and wraps, and pops
+            //cross keyframes back into groups whose keyframe has to be decoded again
+            if(rng() % 3){
+                //mostly a few bytes change, as between frames, sometimes all of them
+                if(rng() % 16 == 0){
+                    for(uint8_t& b : state)
+                        b = rng();
+                }
+                else {
+                    for(uint32_t n = rng() % 8; n > 0; n--)
+                        state[rng() % STATESIZE] = rng();
+                }
+                buffer.push(state.data());
+                model.push_back(state);
+                if(buffer.frames() == 0 || buffer.frames() > model.size()){
+                    cout << "trial " << trial << " op " << op << ": push left " << buffer.frames() << " frames" << endl;
+                    ok = false;
+                }
+                while(model.size() > buffer.frames())
+                    model.pop_front();
+            }
+            else {
+                bool popped = buffer.pop(out.data());
+                if(popped != !model.empty() || (popped && out != model.back())){
+                    cout << "trial " << trial << " op " << op << ": pop didn't give back the newest state" << endl;
+                    ok = false;
+                }
+                if(popped){
+                    state = model.back();
+                    model.pop_back();
+                }
+            }
+            if(buffer.frames() != model.size() || buffer.frames() > maxFrames || buffer.bytesUsed() > maxBytes){
+                cout << "trial " << trial << " op " << op << ": " << buffer.frames() << " frames in "
+                     << buffer.bytesUsed() << " bytes, caps " << maxFrames << " and " << maxBytes << endl;
+                ok = false;
+            }
+        }
+
+        //what is left comes back newest first
+        while(ok && !model.empty()){
+            if(!buffer.pop(out.data()) || out != model.back()){
+                cout << "trial " << trial << ": draining didn't give back the states newest first" << endl;
+                ok = false;
+            }
+            model.pop_back();
+        }
+        if(ok && buffer.pop(out.data())){
+            cout << "trial " << trial << ": pop after draining returned a state" << endl;
+            ok = false;
+        }
+        failed += !ok;
+    }
+    cout << "rewind: 300 trials, " << failed << " failed" << endl;
+    return failed ? 1 : 0;
+}
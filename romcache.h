@@ -0,0 +1,164 @@
+#ifndef ROMCACHE_H
+#define ROMCACHE_H
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "emulator.h"
+
+//ROM file mapped read-only once, content-hashed, with the machine state it boots into;
+//shared between every instance running it, so starting a run is one memcpy of pristine()
+class RomImage {
+    private:
+        const uint8_t* bytes = nullptr;
+        size_t length = 0;
+        uint64_t contentHash = 0;
+        void* mapping = nullptr; //mmap'd file, null when the bytes were copied
+        std::vector<uint8_t> copy; //fallback storage when mapping isn't available
+        std::unique_ptr<MachineState> boot; //fonts and ROM loaded, PC at 0x200
+
+        RomImage(){}
+
+        //FNV-1a over the ROM bytes
+        static uint64_t hashBytes(const uint8_t* data, size_t size){
+            uint64_t hash = 14695981039346656037ull;
+            for(size_t i = 0; i < size; i++){
+                hash ^= data[i];
+                hash *= 1099511628211ull;
+            }
+            return hash;
+        }
+
+        //hash the bytes and build the pristine state, false if the ROM doesn't fit in memory
+        bool finish(const std::string& name){
+            if(length > MEMORYSIZE - 0x200){
+                std::cerr << "File too big for memory: " << name << std::endl;
+                return false;
+            }
+            contentHash = hashBytes(bytes, length);
+            boot.reset(new MachineState(Emulator::blankState()));
+            if(length)
+                memcpy(&boot->memory[0x200], bytes, length);
+            return true;
+        }
+
+    public:
+        RomImage(const RomImage&) = delete;
+        RomImage& operator=(const RomImage&) = delete;
+
+        //map a ROM file, falls back to reading it where mmap isn't available; nullptr on failure
+        static std::shared_ptr<RomImage> map(const std::string& path){
+            std::shared_ptr<RomImage> image(new RomImage());
+#ifndef _WIN32
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if(fd < 0){
+                std::cerr << "Failed to open " << path << std::endl;
+                return nullptr;
+            }
+            struct stat info;
+            if(fstat(fd, &info) == 0 && info.st_size > 0){
+                void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(data != MAP_FAILED){
+                    image->mapping = data;
+                    image->bytes = static_cast<const uint8_t*>(data);
+                    image->length = info.st_size;
+                }
+            }
+            close(fd);
+            if(image->mapping)
+                return image->finish(path) ? image : nullptr;
+#endif
+            std::ifstream file(path, std::ios::binary);
+            if(!file.is_open()){
+                std::cerr << "Failed to open " << path << std::endl;
+                return nullptr;
+            }
+            std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            return fromBytes(data.data(), data.size(), path);
+        }
+
+        //image of a ROM already in memory (generated programs), the bytes are copied
+        static std::shared_ptr<RomImage> fromBytes(const uint8_t* data, size_t size, const std::string& name = "rom"){
+            std::shared_ptr<RomImage> image(new RomImage());
+            image->copy.assign(data, data + size);
+            image->bytes = image->copy.data();
+            image->length = size;
+            return image->finish(name) ? image : nullptr;
+        }
+
+        const uint8_t* data() const {
+            return bytes;
+        }
+
+        size_t size() const {
+            return length;
+        }
+
+        uint64_t hash() const {
+            return contentHash;
+        }
+
+        //state to hand to Emulator::reset
+        const MachineState& pristine() const {
+            return *boot;
+        }
+
+        ~RomImage(){
+#ifndef _WIN32
+            if(mapping)
+                munmap(mapping, length);
+#endif
+        }
+};
+
+//process-wide cache: each path is mapped once, and files with identical contents share one image
+class RomCache {
+    private:
+        std::mutex lock;
+        std::unordered_map<std::string, std::shared_ptr<const RomImage>> byPath;
+        std::unordered_map<uint64_t, std::vector<std::shared_ptr<const RomImage>>> byHash;
+
+    public:
+        static RomCache& global(){
+            static RomCache cache;
+            return cache;
+        }
+
+        //image for path, mapping it on first use; nullptr if it can't be loaded
+        std::shared_ptr<const RomImage> get(const std::string& path){
+            std::lock_guard<std::mutex> guard(lock);
+            auto found = byPath.find(path);
+            if(found != byPath.end())
+                return found->second;
+
+            std::shared_ptr<const RomImage> image = RomImage::map(path);
+            if(!image)
+                return nullptr;
+
+            //a copy of a ROM already cached under another name reuses that image
+            std::vector<std::shared_ptr<const RomImage>>& sameHash = byHash[image->hash()];
+            for(const std::shared_ptr<const RomImage>& other : sameHash){
+                if(other->size() == image->size() && memcmp(other->data(), image->data(), image->size()) == 0){
+                    byPath[path] = other;
+                    return other;
+                }
+            }
+            sameHash.push_back(image);
+            byPath[path] = image;
+            return image;
+        }
+};
+
+#endif
@@ -0,0 +1,109 @@
+//scaler kernels written once against a vector type V (VecScalar, VecSse2 or VecAvx2 in
+//scaler.h). scaler.h includes this file once per instruction set, inside that instruction
+//set's namespace and target pragma, so no include guard. Every kernel does the same lane
+//operations whatever V::N is, which is what keeps the outputs bit-identical
+
+template<class V>
+struct ScaleKernels {
+    typedef typename V::T T;
+
+    //row y of the framebuffer (count pixels, count a multiple of 32) into palette colours
+    static void expandRow(const FrameBuffer& display, int y, const uint32_t* palette, int count, uint32_t* out){
+        //lane l of a vector at x tests bit 31 - (x & 31) - l of the 32 bit half holding x
+        alignas(32) static const uint32_t bits[32] = {
+            1u << 31, 1u << 30, 1u << 29, 1u << 28, 1u << 27, 1u << 26, 1u << 25, 1u << 24,
+            1u << 23, 1u << 22, 1u << 21, 1u << 20, 1u << 19, 1u << 18, 1u << 17, 1u << 16,
+            1u << 15, 1u << 14, 1u << 13, 1u << 12, 1u << 11, 1u << 10, 1u << 9, 1u << 8,
+            1u << 7, 1u << 6, 1u << 5, 1u << 4, 1u << 3, 1u << 2, 1u << 1, 1u << 0};
+        T zero = V::set1(0);
+        T c0 = V::set1(palette[0]), c1 = V::set1(palette[1]), c2 = V::set1(palette[2]), c3 = V::set1(palette[3]);
+        for(int x = 0; x < count; x += V::N){
+            int shift = 32 - (x & 32);
+            T mask = V::load(&bits[x & 31]);
+            T clear0 = V::eq(V::andv(V::set1((uint32_t)(display.planes[0][x >> 6][y] >> shift)), mask), zero);
+            T clear1 = V::eq(V::andv(V::set1((uint32_t)(display.planes[1][x >> 6][y] >> shift)), mask), zero);
+            V::store(out + x, V::select(clear0, V::select(clear1, c0, c2), V::select(clear1, c1, c3)));
+        }
+    }
+
+    //AdvMAME2x/Scale2x: each pixel E becomes 2x2, a corner takes the colour of the two
+    //neighbours meeting there when they match and the opposite pair doesn't; rows are
+    //count pixels with one pixel of border on every side
+    static void scale2xRow(const uint32_t* above, const uint32_t* row, const uint32_t* below, int count, uint32_t* out0, uint32_t* out1){
+        alignas(32) uint32_t e[4][V::N];
+        for(int x = 0; x < count; x += V::N){
+            T B = V::load(above + x), D = V::load(row + x - 1), E = V::load(row + x);
+            T F = V::load(row + x + 1), H = V::load(below + x);
+            T off = V::orv(V::eq(B, H), V::eq(D, F));
+            V::store(e[0], V::select(off, E, V::select(V::eq(D, B), D, E)));
+            V::store(e[1], V::select(off, E, V::select(V::eq(B, F), F, E)));
+            V::store(e[2], V::select(off, E, V::select(V::eq(D, H), D, E)));
+            V::store(e[3], V::select(off, E, V::select(V::eq(H, F), F, E)));
+            for(int l = 0; l < V::N; l++){
+                out0[2*(x + l)] = e[0][l];
+                out0[2*(x + l) + 1] = e[1][l];
+                out1[2*(x + l)] = e[2][l];
+                out1[2*(x + l) + 1] = e[3][l];
+            }
+        }
+    }
+
+    //AdvMAME3x/Scale3x, each pixel becomes 3x3 with the edge cells also checking the diagonals
+    static void scale3xRow(const uint32_t* above, const uint32_t* row, const uint32_t* below, int count, uint32_t* out0, uint32_t* out1, uint32_t* out2){
+        alignas(32) uint32_t e[9][V::N];
+        for(int x = 0; x < count; x += V::N){
+            T A = V::load(above + x - 1), B = V::load(above + x), C = V::load(above + x + 1);
+            T D = V::load(row + x - 1), E = V::load(row + x), F = V::load(row + x + 1);
+            T G = V::load(below + x - 1), H = V::load(below + x), I = V::load(below + x + 1);
+            T off = V::orv(V::eq(B, H), V::eq(D, F));
+            T DB = V::eq(D, B), BF = V::eq(B, F), DH = V::eq(D, H), HF = V::eq(H, F);
+            //x && E != y is andnot(E == y, x)
+            T top = V::orv(V::andnot(V::eq(E, C), DB), V::andnot(V::eq(E, A), BF));
+            T left = V::orv(V::andnot(V::eq(E, G), DB), V::andnot(V::eq(E, A), DH));
+            T right = V::orv(V::andnot(V::eq(E, I), BF), V::andnot(V::eq(E, C), HF));
+            T bottom = V::orv(V::andnot(V::eq(E, I), DH), V::andnot(V::eq(E, G), HF));
+            V::store(e[0], V::select(off, E, V::select(DB, D, E)));
+            V::store(e[1], V::select(off, E, V::select(top, B, E)));
+            V::store(e[2], V::select(off, E, V::select(BF, F, E)));
+            V::store(e[3], V::select(off, E, V::select(left, D, E)));
+            V::store(e[4], E);
+            V::store(e[5], V::select(off, E, V::select(right, F, E)));
+            V::store(e[6], V::select(off, E, V::select(DH, D, E)));
+            V::store(e[7], V::select(off, E, V::select(bottom, H, E)));
+            V::store(e[8], V::select(off, E, V::select(HF, F, E)));
+            for(int l = 0; l < V::N; l++){
+                for(int c = 0; c < 3; c++){
+                    out0[3*(x + l) + c] = e[c][l];
+                    out1[3*(x + l) + c] = e[3 + c][l];
+                    out2[3*(x + l) + c] = e[6 + c][l];
+                }
+            }
+        }
+    }
+
+    //repeat each of count pixels factor times; a pixel's vector stores may run past its own
+    //span into the next pixel's, which overwrites them, so only the last few go one at a time
+    static void widenRow(const uint32_t* in, int count, int factor, uint32_t* out){
+        int reach = (factor + V::N - 1)/V::N*V::N;
+        int i = 0;
+        for(; i < count && i*factor + reach <= count*factor; i++){
+            T colour = V::set1(in[i]);
+            for(int j = 0; j < factor; j += V::N)
+                V::store(out + i*factor + j, colour);
+        }
+        for(; i < count; i++){
+            for(int j = 0; j < factor; j++)
+                out[i*factor + j] = in[i];
+        }
+    }
+
+    //half brightness, keeping alpha opaque, for CRT scanlines
+    static void darkenRow(const uint32_t* in, int count, uint32_t* out){
+        T mask = V::set1(0x007F7F7F), alpha = V::set1(0xFF000000);
+        int i = 0;
+        for(; i + V::N <= count; i += V::N)
+            V::store(out + i, V::orv(V::andv(V::srl1(V::load(in + i)), mask), alpha));
+        for(; i < count; i++)
+            out[i] = ((in[i] >> 1) & 0x007F7F7F) | 0xFF000000;
+    }
+};
@@ -0,0 +1,258 @@
+#ifndef SCALER_H
+#define SCALER_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include "emulator.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define CHIP8_SCALER_X86
+#include <immintrin.h>
+#endif
+
+//how the screen is enlarged to the window
+enum ScaleFilter {
+    FILTER_NEAREST, //square blocks
+    FILTER_SCALE2X, //Scale2x (AdvMAME2x) edge smoothing, then blocks
+    FILTER_SCALE3X, //Scale3x (AdvMAME3x), then blocks
+    FILTER_CRT //blocks with darkened scanlines
+};
+
+//filter by command line name, returns false if unknown
+inline bool parseScaleFilter(const std::string& name, ScaleFilter& filter){
+    if(name == "nearest") filter = FILTER_NEAREST;
+    else if(name == "scale2x") filter = FILTER_SCALE2X;
+    else if(name == "scale3x") filter = FILTER_SCALE3X;
+    else if(name == "crt") filter = FILTER_CRT;
+    else {
+        std::cerr << "Unknown filter " << name << " (nearest, scale2x, scale3x, crt)" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+//kernels the scaler runs, each produces exactly the same pixels
+enum SimdLevel {
+    SIMD_SCALAR,
+    SIMD_SSE2,
+    SIMD_AVX2
+};
+
+inline const char* simdName(SimdLevel level){
+    static const char* names[] = {"scalar", "sse2", "avx2"};
+    return names[level];
+}
+
+//widest kernels this CPU runs
+inline SimdLevel detectSimd(){
+#ifdef CHIP8_SCALER_X86
+    return __builtin_cpu_supports("avx2") ? SIMD_AVX2 : SIMD_SSE2;
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+//one pixel at a time, comparisons give all ones or all zeros like the vector versions
+struct VecScalar {
+    typedef uint32_t T;
+    static const int N = 1;
+    static T load(const uint32_t* p){ return *p; }
+    static void store(uint32_t* p, T v){ *p = v; }
+    static T set1(uint32_t v){ return v; }
+    static T eq(T a, T b){ return a == b ? ~0u : 0u; }
+    static T andv(T a, T b){ return a & b; }
+    static T orv(T a, T b){ return a | b; }
+    static T andnot(T a, T b){ return ~a & b; }
+    static T select(T mask, T a, T b){ return (a & mask) | (b & ~mask); }
+    static T srl1(T a){ return a >> 1; }
+};
+
+#ifdef CHIP8_SCALER_X86
+//four pixels, SSE2 is part of every x86-64 CPU
+struct VecSse2 {
+    typedef __m128i T;
+    static const int N = 4;
+    static T load(const uint32_t* p){ return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+    static void store(uint32_t* p, T v){ _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+    static T set1(uint32_t v){ return _mm_set1_epi32(v); }
+    static T eq(T a, T b){ return _mm_cmpeq_epi32(a, b); }
+    static T andv(T a, T b){ return _mm_and_si128(a, b); }
+    static T orv(T a, T b){ return _mm_or_si128(a, b); }
+    static T andnot(T a, T b){ return _mm_andnot_si128(a, b); }
+    static T select(T mask, T a, T b){ return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+    static T srl1(T a){ return _mm_srli_epi32(a, 1); }
+};
+#endif
+
+namespace scalebase {
+#include "scalekernels.h"
+}
+
+#ifdef CHIP8_SCALER_X86
+//everything up to the pop is compiled for AVX2 and only called once detectSimd found it
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+//eight pixels
+struct VecAvx2 {
+    typedef __m256i T;
+    static const int N = 8;
+    static T load(const uint32_t* p){ return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    static void store(uint32_t* p, T v){ _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+    static T set1(uint32_t v){ return _mm256_set1_epi32(v); }
+    static T eq(T a, T b){ return _mm256_cmpeq_epi32(a, b); }
+    static T andv(T a, T b){ return _mm256_and_si256(a, b); }
+    static T orv(T a, T b){ return _mm256_or_si256(a, b); }
+    static T andnot(T a, T b){ return _mm256_andnot_si256(a, b); }
+    static T select(T mask, T a, T b){ return _mm256_blendv_epi8(b, a, mask); }
+    static T srl1(T a){ return _mm256_srli_epi32(a, 1); }
+};
+
+namespace scaleavx2 {
+#include "scalekernels.h"
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+#endif
+
+//black, plane 1, plane 2, both planes
+const uint32_t SCREENPALETTE[4] = {0xFF000000, 0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555};
+
+//filters a FrameBuffer into 32 bit ARGB pixels at the small multiple of the 128x64 hi-res
+//screen the filter needs (lo-res pixels are twice as big): one pixel per pixel for nearest, 2x2
+//or 3x3 for Scale2x/3x, three rows per pixel for CRT scanlines. The screen is expanded to
+//colours with a one pixel border, optionally run through Scale2x/3x, then each row is widened
+//once and copied down the rows it covers. The renderer enlarges that texture by a whole number
+//to width() x height(), the largest multiple of 128x64 that fits the target size, sampling the
+//nearest pixel, so the CPU work and the upload stay the same at any window size
+class Scaler {
+    private:
+        ScaleFilter filter;
+        SimdLevel simd;
+        int across, down; //texture pixels per hi-res pixel
+        int factor; //displayed pixels per hi-res pixel, a multiple of across and down
+        std::vector<uint32_t> source; //screen in colours, one pixel of border on every side
+        std::vector<uint32_t> filtered; //source after Scale2x/3x
+
+        template<class K>
+        void run(const FrameBuffer& display, uint32_t* out, int pitch){
+            int shift = display.hires ? 0 : 1;
+            int w = HIRESWIDTH >> shift, h = HIRESHEIGHT >> shift;
+            int stride = w + 2;
+            for(int y = 0; y < h; y++){
+                uint32_t* row = &source[(y + 1)*stride];
+                K::expandRow(display, y, SCREENPALETTE, w, row + 1);
+                row[0] = row[1];
+                row[w + 1] = row[w];
+            }
+            memcpy(&source[0], &source[stride], stride*sizeof(uint32_t));
+            memcpy(&source[(h + 1)*stride], &source[h*stride], stride*sizeof(uint32_t));
+
+            //rows the widening pass reads: the filtered image, or the source without its border
+            int smooth = filter == FILTER_SCALE2X ? 2 : filter == FILTER_SCALE3X ? 3 : 1;
+            int width = w*smooth, rows = h*smooth;
+            const uint32_t* in = &source[stride + 1];
+            int inStride = stride;
+            for(int y = 0; y < h && smooth > 1; y++){
+                const uint32_t* above = &source[y*stride + 1];
+                uint32_t* out0 = &filtered[y*smooth*width];
+                if(smooth == 2)
+                    K::scale2xRow(above, above + stride, above + 2*stride, w, out0, out0 + width);
+                else
+                    K::scale3xRow(above, above + stride, above + 2*stride, w, out0, out0 + width, out0 + 2*width);
+            }
+            if(smooth > 1){
+                in = filtered.data();
+                inStride = width;
+            }
+
+            //each row read is widened to wide pixels and covers block texture rows, of which CRT
+            //darkens the last third; only lo-res needs either above one
+            int wide = (across << shift)/smooth;
+            int block = (down << shift)/smooth;
+            int bright = filter == FILTER_CRT ? block - block/3 : block;
+            size_t bytes = width*wide*sizeof(uint32_t);
+            uint8_t* target = reinterpret_cast<uint8_t*>(out);
+            for(int r = 0; r < rows; r++){
+                uint8_t* first = target + (size_t)r*block*pitch;
+                K::widenRow(in + r*inStride, width, wide, reinterpret_cast<uint32_t*>(first));
+                for(int j = 1; j < block; j++){
+                    uint8_t* line = first + (size_t)j*pitch;
+                    if(j < bright)
+                        memcpy(line, first, bytes);
+                    else if(j == bright)
+                        K::darkenRow(reinterpret_cast<const uint32_t*>(first), width*wide, reinterpret_cast<uint32_t*>(line));
+                    else
+                        memcpy(line, first + (size_t)bright*pitch, bytes);
+                }
+            }
+        }
+
+    public:
+        //a texture for filter, shown at the largest whole multiple fitting maxWidth x maxHeight
+        //that the texture scales to evenly
+        Scaler(ScaleFilter mode, int maxWidth, int maxHeight, SimdLevel level = detectSimd()): filter(mode), simd(level){
+            across = filter == FILTER_SCALE2X ? 2 : filter == FILTER_SCALE3X ? 3 : 1;
+            down = filter == FILTER_CRT ? 3 : across;
+            int step = std::max(across, down);
+            factor = std::min(maxWidth/HIRESWIDTH, maxHeight/HIRESHEIGHT)/step*step;
+            factor = std::max(factor, step);
+            source.resize((HIRESWIDTH + 2)*(HIRESHEIGHT + 2));
+            filtered.resize(HIRESWIDTH*across*HIRESHEIGHT*across);
+#ifndef CHIP8_SCALER_X86
+            simd = SIMD_SCALAR;
+#endif
+        }
+
+        //size scale() writes
+        int textureWidth() const {
+            return HIRESWIDTH*across;
+        }
+
+        int textureHeight() const {
+            return HIRESHEIGHT*down;
+        }
+
+        //size the renderer shows the texture at
+        int width() const {
+            return HIRESWIDTH*factor;
+        }
+
+        int height() const {
+            return HIRESHEIGHT*factor;
+        }
+
+        SimdLevel level() const {
+            return simd;
+        }
+
+        //write the filtered screen to out, textureWidth() x textureHeight() pixels with rows pitch bytes apart
+        void scale(const FrameBuffer& display, uint32_t* out, int pitch){
+            switch(simd){
+#ifdef CHIP8_SCALER_X86
+                case SIMD_AVX2:
+                    run<scaleavx2::ScaleKernels<VecAvx2>>(display, out, pitch);
+                    return;
+                case SIMD_SSE2:
+                    run<scalebase::ScaleKernels<VecSse2>>(display, out, pitch);
+                    return;
+#endif
+                default:
+                    run<scalebase::ScaleKernels<VecScalar>>(display, out, pitch);
+            }
+        }
+};
+
+#endif
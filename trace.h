@@ -0,0 +1,140 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <vector>
+
+//binary trace file: 8 byte header followed by packed 8 byte records
+const char TRACEMAGIC[4] = {'C', '8', 'T', 'R'};
+const uint32_t TRACEVERSION = 1;
+const uint8_t TRACENOREG = 0xFF; //no register changed
+
+//one executed instruction
+#pragma pack(push, 1)
+struct TraceRecord {
+    uint16_t PC; //address the instruction was fetched from
+    uint16_t instruct; //opcode
+    uint16_t I; //index register after executing
+    uint8_t reg; //first register the instruction changed, TRACENOREG if none
+    uint8_t value; //new value of that register
+};
+#pragma pack(pop)
+static_assert(sizeof(TraceRecord) == 8, "trace records must stay 8 bytes");
+
+//single producer, single consumer ring of trace records, never blocks the producer
+class TraceRing {
+    private:
+        std::vector<TraceRecord> records;
+        size_t mask;
+        std::atomic<size_t> head{0}; //next slot to write, owned by producer
+        std::atomic<size_t> tail{0}; //next slot to read, owned by consumer
+
+    public:
+        //capacity is rounded up to a power of two
+        TraceRing(size_t capacity){
+            size_t size = 1;
+            while(size < capacity)
+                size <<= 1;
+            records.resize(size);
+            mask = size - 1;
+        }
+
+        //add a record, returns false if the ring is full
+        bool push(const TraceRecord& record){
+            size_t h = head.load(std::memory_order_relaxed);
+            if(h - tail.load(std::memory_order_acquire) > mask)
+                return false;
+            records[h & mask] = record;
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+
+        //copy up to max records into out, returns how many were taken
+        size_t pop(TraceRecord* out, size_t max){
+            size_t t = tail.load(std::memory_order_relaxed);
+            size_t available = head.load(std::memory_order_acquire) - t;
+            size_t count = available < max ? available : max;
+            for(size_t i = 0; i < count; i++)
+                out[i] = records[(t + i) & mask];
+            tail.store(t + count, std::memory_order_release);
+            return count;
+        }
+};
+
+//owns a ring and a background thread draining it into a trace file
+class Tracer {
+    private:
+        TraceRing ring;
+        FILE* file;
+        bool wait; //record waits for the drainer instead of dropping
+        std::atomic<bool> running{true};
+        std::atomic<uint64_t> dropped{0};
+        std::thread drainer;
+
+        //write out whatever is in the ring, returns number of records written
+        size_t drain(){
+            TraceRecord batch[4096];
+            size_t total = 0;
+            size_t count;
+            while((count = ring.pop(batch, 4096)) > 0){
+                fwrite(batch, sizeof(TraceRecord), count, file);
+                total += count;
+            }
+            return total;
+        }
+
+        void drainLoop(){
+            while(running.load(std::memory_order_acquire)){
+                if(drain() == 0)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            drain();
+        }
+
+    public:
+        Tracer(FILE* out, bool waitForSpace = false, size_t capacity = 1 << 16): ring(capacity), file(out), wait(waitForSpace){
+            fwrite(TRACEMAGIC, 1, 4, file);
+            fwrite(&TRACEVERSION, sizeof(TRACEVERSION), 1, file);
+            drainer = std::thread(&Tracer::drainLoop, this);
+        }
+
+        //open a trace file, returns nullptr on failure; runs that don't need to keep real time
+        //(headless) pass waitForSpace so no record is lost
+        static Tracer* open(const char* filename, bool waitForSpace = false){
+            FILE* out = fopen(filename, "wb");
+            if(!out)
+                return nullptr;
+            return new Tracer(out, waitForSpace);
+        }
+
+        //called from the emulation thread, if the drainer fell behind either waits for it or drops the record
+        void record(const TraceRecord& record){
+            while(!ring.push(record)){
+                if(!wait){
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                std::this_thread::yield();
+            }
+        }
+
+        uint64_t droppedRecords() const {
+            return dropped.load(std::memory_order_relaxed);
+        }
+
+        //stop the drain thread after flushing everything recorded so far, and say if anything was lost
+        ~Tracer(){
+            running.store(false, std::memory_order_release);
+            drainer.join();
+            fclose(file);
+            if(droppedRecords())
+                fprintf(stderr, "Trace dropped %llu records, the drainer fell behind\n", (unsigned long long)droppedRecords());
+        }
+};
+
+#endif
@@ -0,0 +1,50 @@
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include "trace.h"
+using namespace std;
+
+//print a binary trace written by the emulator's --trace option
+int main (int argc, char* argv[]){
+    if(argc < 2){
+        cerr << "usage: tracedump FILE" << endl;
+        return 1;
+    }
+
+    FILE* file = fopen(argv[1], "rb");
+    if(!file){
+        cerr << "Failed to open " << argv[1] << endl;
+        return 1;
+    }
+
+    //check header
+    char magic[4];
+    uint32_t version;
+    if(fread(magic, 1, 4, file) != 4 || memcmp(magic, TRACEMAGIC, 4) != 0
+        || fread(&version, sizeof(version), 1, file) != 1){
+        cerr << "Not a trace file" << endl;
+        return 1;
+    }
+    if(version != TRACEVERSION){
+        cerr << "Unsupported trace version " << version << endl;
+        return 1;
+    }
+
+    TraceRecord batch[4096];
+    size_t count;
+    uint64_t total = 0;
+    while((count = fread(batch, sizeof(TraceRecord), 4096, file)) > 0){
+        for(size_t i = 0; i < count; i++){
+            const TraceRecord& r = batch[i];
+            printf("%04X  %04X  I=%04X", r.PC, r.instruct, r.I);
+            if(r.reg != TRACENOREG)
+                printf("  V%X=%02X", r.reg, r.value);
+            printf("\n");
+        }
+        total += count;
+    }
+    fclose(file);
+
+    cerr << total << " instructions" << endl;
+    return 0;
+}
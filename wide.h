@@ -0,0 +1,959 @@
+#ifndef WIDE_H
+#define WIDE_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <bitset>
+#include "emulator.h"
+
+const int WIDEMEMORY = 0x1000; //each lane's address space, the original 4KB
+
+//the lanes an instruction runs for: all of them, or a list of lane numbers
+struct AllLanes {
+    size_t count;
+
+    size_t size() const {
+        return count;
+    }
+
+    size_t operator[](size_t k) const {
+        return k;
+    }
+};
+
+struct LaneList {
+    const uint32_t* lanes;
+    size_t count;
+
+    size_t size() const {
+        return count;
+    }
+
+    size_t operator[](size_t k) const {
+        return lanes[k];
+    }
+};
+
+//many instances ("lanes") of one ROM run in lockstep, e.g. the same game under thousands of seeds
+//and input sequences. State is kept structure-of-arrays with the lane number fastest, so an
+//instruction every lane agrees on is one loop over contiguous bytes that the compiler vectorizes.
+//While all PCs agree the PC is kept and fetched once, a test every lane agrees on keeps them
+//there, and the delay timer and FX0A spin-waits Emulator skips are skipped for all lanes at once.
+//Lanes that branch apart run a group per opcode, until the PCs meet again.
+//Only CHIP-8 runs wide (lo-res, one plane, 4KB per lane): a lane reaching a SUPER-CHIP or
+//XO-CHIP instruction, a PC past 4KB or a sprite, BCD or register store/load from I past 4KB,
+//stops there, which stopped() reports.
+class WideEmulator {
+    private:
+        size_t count;
+        std::vector<uint8_t> registers; //[16][count]
+        std::vector<uint16_t> PC; //stale while together
+        std::vector<uint16_t> I;
+        std::vector<uint8_t> SP, delay, sound, keyWait;
+        std::vector<uint16_t> stack; //[16][count]
+        std::vector<uint64_t> rng;
+        std::vector<uint16_t> keys, keyPresses;
+        std::vector<uint8_t> memory; //[WIDEMEMORY][count]
+        std::vector<uint64_t> screen; //[HEIGHT][count], lo-res rows as in FrameBuffer
+        std::vector<uint8_t> halted; //lane reached an instruction that doesn't run wide
+
+        std::vector<uint32_t> active; //lanes still running
+        bool removed = false; //a lane halted this step, active needs rebuilding
+        bool together = true; //every active lane is at sharedPC
+        uint16_t sharedPC = 0x200;
+        std::bitset<WIDEMEMORY> written; //addresses a lane has stored to, they may differ between lanes
+
+        //regrouping scratch: opcode per lane, lanes not run yet, lanes of the group being run
+        std::vector<uint16_t> opcodes;
+        std::vector<uint32_t> order;
+        std::vector<uint32_t> group;
+
+        uint64_t togetherSteps = 0, apartSteps = 0, groupsRun = 0;
+
+        typedef void (*Runner)(WideEmulator&, uint64_t);
+        Runner runner;
+
+        uint8_t* V(int r){
+            return &registers[r*count];
+        }
+
+        uint8_t& at(size_t lane, uint32_t addr){
+            return memory[(addr & (WIDEMEMORY - 1))*count + lane];
+        }
+
+        void store(size_t lane, uint32_t addr, uint8_t value){
+            at(lane, addr) = value;
+            written.set(addr & (WIDEMEMORY - 1));
+        }
+
+        //a skip that would read its next instruction from past the 4KB stops the lane on the skip
+        void skip(size_t lane){
+            if(PC[lane] >= WIDEMEMORY - 1){
+                halted[lane] = 1;
+                PC[lane] -= 2;
+                removed = true;
+                return;
+            }
+            PC[lane] += (at(lane, PC[lane]) == 0xF0 && at(lane, PC[lane]+1) == 0x00) ? 4 : 2;
+        }
+
+        bool isKeyDown(size_t lane, uint8_t key) const {
+            return key < 16 && (keys[lane] >> key & 1);
+        }
+
+        //FX0A for one lane, as Emulator::waitKey
+        void waitKey(size_t lane, uint8_t X){
+            if(!(keyWait[lane] & (KEYWAITPRESS | KEYWAITRELEASE))){
+                keyWait[lane] = KEYWAITPRESS;
+                keyPresses[lane] = 0;
+            }
+            if(keyWait[lane] == KEYWAITPRESS && keyPresses[lane]){
+                uint8_t key = 0;
+                while(!(keyPresses[lane] >> key & 1))
+                    key++;
+                keyWait[lane] = KEYWAITRELEASE | key;
+            }
+            if((keyWait[lane] & KEYWAITRELEASE) && !isKeyDown(lane, keyWait[lane] & 0x0F)){
+                V(X)[lane] = keyWait[lane] & 0x0F;
+                keyWait[lane] = 0;
+                return;
+            }
+            PC[lane] -= 2;
+        }
+
+        uint8_t random(size_t lane){
+            uint64_t x = rng[lane];
+            x ^= x >> 12;
+            x ^= x << 25;
+            x ^= x >> 27;
+            rng[lane] = x;
+            return (x * 0x2545F4914F6CDD1Dull) >> 56;
+        }
+
+        //leave the lanes on the instruction they can't run
+        template<class L>
+        void halt(const L& lanes){
+            for(size_t k = 0; k < lanes.size(); k++){
+                halted[lanes[k]] = 1;
+                PC[lanes[k]] -= 2;
+            }
+            removed = true;
+        }
+
+        //Emulator reads and writes up to 64KB from I, a lane can't: stop it if I+length passes the 4KB
+        bool beyondMemory(size_t lane, uint32_t length){
+            if(I[lane] + length <= WIDEMEMORY)
+                return false;
+            halted[lane] = 1;
+            PC[lane] -= 2;
+            removed = true;
+            return true;
+        }
+
+        //every lane's I is the same and length bytes from it are inside the 4KB, so a store or
+        //load from I is a loop over whole contiguous rows of memory
+        template<class L>
+        bool sharedI(const L& lanes, uint32_t length) const {
+            uint16_t first = I[lanes[0]];
+            bool same = first + length <= WIDEMEMORY;
+            for(size_t k = 0; k < lanes.size(); k++)
+                same &= I[lanes[k]] == first;
+            return same;
+        }
+
+        //I after FX55 or FX65 of registers 0 to X, as the memory quirk has it
+        template<class Q, class L>
+        void advanceI(const L& lanes, int X){
+            uint16_t step = Q::memory == MEMORY_INCREMENT ? X+1 : Q::memory == MEMORY_INCREMENT_X ? X : 0;
+            if(!step)
+                return;
+            for(size_t k = 0; k < lanes.size(); k++)
+                I[lanes[k]] += step;
+        }
+
+        //bytes op reads or writes from I
+        static uint32_t reach(uint16_t op){
+            if(op >> 12 == 0xD)
+                return op & 0xF;
+            if(op >> 12 != 0xF)
+                return 0;
+            switch(op & 0xFF){
+                case 0x33:
+                    return 3;
+                case 0x55: case 0x65:
+                    return (op >> 8 & 0xF) + 1;
+            }
+            return 0;
+        }
+
+        //some lane's I is too close to the end for op, so the lanes need their own PCs to stop it
+        bool nearEnd(uint16_t op) const {
+            uint32_t length = reach(op);
+            if(!length)
+                return false;
+            for(uint32_t l : active){
+                if(I[l] + length > WIDEMEMORY)
+                    return true;
+            }
+            return false;
+        }
+
+        //instructions that neither read nor write the PC, so lanes at one PC stay together;
+        //jumps and calls are handled separately, everything else runs apart
+        static bool lockstep(uint16_t op){
+            switch(op >> 12){
+                case 0x0:
+                    return op == 0x00E0;
+                case 0x6: case 0x7: case 0xA: case 0xC:
+                    return true;
+                case 0x8:
+                    return (op & 0xF) <= 0x7 || (op & 0xF) == 0xE;
+                case 0xD:
+                    return (op & 0xF) != 0;
+                case 0xF:
+                    switch(op & 0xFF){
+                        case 0x07: case 0x15: case 0x18: case 0x1E: case 0x29:
+                        case 0x30: case 0x33: case 0x55: case 0x65:
+                            return true;
+                    }
+            }
+            return false;
+        }
+
+        //run op for the given lanes, whose PCs already point past it
+        template<class Q, class L>
+        void execute(uint16_t op, const L& lanes){
+            const size_t n = lanes.size();
+            int X = op >> 8 & 0xF, Y = op >> 4 & 0xF;
+            uint8_t NN = op & 0xFF;
+            uint16_t NNN = op & 0xFFF;
+            uint8_t* vx = V(X);
+            uint8_t* vy = V(Y);
+            uint8_t* vf = V(0xF);
+
+            switch(op >> 12){
+                case 0x0:
+                    if(op == 0x00E0){
+                        for(int y = 0; y < HEIGHT; y++){
+                            uint64_t* row = &screen[y*count];
+                            for(size_t k = 0; k < n; k++)
+                                row[lanes[k]] = 0;
+                        }
+                    }
+                    else if(op == 0x00EE){
+                        for(size_t k = 0; k < n; k++){
+                            size_t l = lanes[k];
+                            SP[l] = (SP[l] - 1) & 15;
+                            PC[l] = stack[SP[l]*count + l];
+                        }
+                    }
+                    //scrolling and resolution changes; other 0NNN are passed over as Emulator does
+                    else if((op & 0xFFF0) == 0x00C0 || (op & 0xFFF0) == 0x00D0 || (op >= 0x00FB && op <= 0x00FF))
+                        halt(lanes);
+                    break;
+                case 0x1:
+                    for(size_t k = 0; k < n; k++)
+                        PC[lanes[k]] = NNN;
+                    break;
+                case 0x2:
+                    for(size_t k = 0; k < n; k++){
+                        size_t l = lanes[k];
+                        stack[SP[l]*count + l] = PC[l];
+                        SP[l] = (SP[l] + 1) & 15;
+                        PC[l] = NNN;
+                    }
+                    break;
+                case 0x3:
+                    for(size_t k = 0; k < n; k++){
+                        if(vx[lanes[k]] == NN)
+                            skip(lanes[k]);
+                    }
+                    break;
+                case 0x4:
+                    for(size_t k = 0; k < n; k++){
+                        if(vx[lanes[k]] != NN)
+                            skip(lanes[k]);
+                    }
+                    break;
+                case 0x5:
+                    if((op & 0xF) == 0x2 || (op & 0xF) == 0x3){
+                        halt(lanes);
+                        break;
+                    }
+                    for(size_t k = 0; k < n; k++){
+                        if(vx[lanes[k]] == vy[lanes[k]])
+                            skip(lanes[k]);
+                    }
+                    break;
+                case 0x6:
+                    for(size_t k = 0; k < n; k++)
+                        vx[lanes[k]] = NN;
+                    break;
+                case 0x7:
+                    for(size_t k = 0; k < n; k++)
+                        vx[lanes[k]] += NN;
+                    break;
+                case 0x8:
+                    switch(op & 0xF){
+                        case 0x0:
+                            for(size_t k = 0; k < n; k++)
+                                vx[lanes[k]] = vy[lanes[k]];
+                            break;
+                        case 0x1:
+                            for(size_t k = 0; k < n; k++){
+                                vx[lanes[k]] |= vy[lanes[k]];
+                                if(Q::vfReset)
+                                    vf[lanes[k]] = 0;
+                            }
+                            break;
+                        case 0x2:
+                            for(size_t k = 0; k < n; k++){
+                                vx[lanes[k]] &= vy[lanes[k]];
+                                if(Q::vfReset)
+                                    vf[lanes[k]] = 0;
+                            }
+                            break;
+                        case 0x3:
+                            for(size_t k = 0; k < n; k++){
+                                vx[lanes[k]] ^= vy[lanes[k]];
+                                if(Q::vfReset)
+                                    vf[lanes[k]] = 0;
+                            }
+                            break;
+                        case 0x4:
+                            for(size_t k = 0; k < n; k++){
+                                size_t l = lanes[k];
+                                unsigned sum = vx[l] + vy[l];
+                                vx[l] = sum;
+                                vf[l] = sum > 255;
+                            }
+                            break;
+                        case 0x5:
+                            for(size_t k = 0; k < n; k++){
+                                size_t l = lanes[k];
+                                uint8_t a = vx[l], b = vy[l];
+                                vx[l] = a - b;
+                                vf[l] = a >= b;
+                            }
+                            break;
+                        case 0x6:
+                            for(size_t k = 0; k < n; k++){
+                                size_t l = lanes[k];
+                                uint8_t v = Q::shift ? vx[l] : vy[l];
+                                vx[l] = v >> 1;
+                                vf[l] = v & 0x01;
+                            }
+                            break;
+                        case 0x7:
+                            for(size_t k = 0; k < n; k++){
+                                size_t l = lanes[k];
+                                uint8_t a = vx[l], b = vy[l];
+                                vx[l] = b - a;
+                                vf[l] = b >= a;
+                            }
+                            break;
+                        case 0xE:
+                            for(size_t k = 0; k < n; k++){
+                                size_t l = lanes[k];
+                                uint8_t v = Q::shift ? vx[l] : vy[l];
+                                vx[l] = v << 1;
+                                vf[l] = v >> 7;
+                            }
+                            break;
+                    }
+                    break;
+                case 0x9:
+                    for(size_t k = 0; k < n; k++){
+                        if(vx[lanes[k]] != vy[lanes[k]])
+                            skip(lanes[k]);
+                    }
+                    break;
+                case 0xA:
+                    for(size_t k = 0; k < n; k++)
+                        I[lanes[k]] = NNN;
+                    break;
+                case 0xB: {
+                    uint8_t* offset = Q::jump ? vx : V(0);
+                    for(size_t k = 0; k < n; k++)
+                        PC[lanes[k]] = NNN + offset[lanes[k]];
+                    break;
+                }
+                case 0xC:
+                    for(size_t k = 0; k < n; k++)
+                        vx[lanes[k]] = random(lanes[k]) & NN;
+                    break;
+                //the lo-res loop of Emulator::opDXYN, lane by lane
+                case 0xD: {
+                    int rows = op & 0xF;
+                    if(!rows){
+                        halt(lanes);
+                        break;
+                    }
+                    for(size_t k = 0; k < n; k++){
+                        size_t l = lanes[k];
+                        int xCor = vx[l] & (WIDTH - 1);
+                        int yCor = vy[l] & (HEIGHT - 1);
+                        int visible = Q::wrap ? rows : std::min(rows, HEIGHT - yCor);
+                        if(beyondMemory(l, visible))
+                            continue;
+                        uint16_t addr = I[l];
+                        uint64_t collision = 0;
+                        for(int i = 0; i < visible; i++){
+                            uint64_t sprite = (uint64_t)at(l, addr+i) << 56;
+                            uint64_t bits = sprite >> xCor;
+                            if(Q::wrap && xCor)
+                                bits |= sprite << (64 - xCor);
+                            uint64_t& row = screen[((yCor + i) & (HEIGHT - 1))*count + l];
+                            collision |= row & bits;
+                            row ^= bits;
+                        }
+                        vf[l] = collision != 0;
+                    }
+                    break;
+                }
+                case 0xE:
+                    if(NN == 0x9E){
+                        for(size_t k = 0; k < n; k++){
+                            if(isKeyDown(lanes[k], vx[lanes[k]]))
+                                skip(lanes[k]);
+                        }
+                    }
+                    else if(NN == 0xA1){
+                        for(size_t k = 0; k < n; k++){
+                            if(!isKeyDown(lanes[k], vx[lanes[k]]))
+                                skip(lanes[k]);
+                        }
+                    }
+                    break;
+                default:
+                    if(op == 0xF000 || op == 0xF002){
+                        halt(lanes);
+                        break;
+                    }
+                    switch(NN){
+                        case 0x07:
+                            for(size_t k = 0; k < n; k++)
+                                vx[lanes[k]] = delay[lanes[k]];
+                            break;
+                        case 0x0A:
+                            for(size_t k = 0; k < n; k++)
+                                waitKey(lanes[k], X);
+                            break;
+                        case 0x15:
+                            for(size_t k = 0; k < n; k++)
+                                delay[lanes[k]] = vx[lanes[k]];
+                            break;
+                        case 0x18:
+                            for(size_t k = 0; k < n; k++)
+                                sound[lanes[k]] = vx[lanes[k]];
+                            break;
+                        case 0x1E:
+                            for(size_t k = 0; k < n; k++){
+                                size_t l = lanes[k];
+                                uint8_t v = vx[l];
+                                if((int)I[l] + v > 255)
+                                    vf[l] = 1;
+                                I[l] += v;
+                            }
+                            break;
+                        case 0x29:
+                            for(size_t k = 0; k < n; k++)
+                                I[lanes[k]] = 0x50 + vx[lanes[k]]*5;
+                            break;
+                        case 0x30:
+                            for(size_t k = 0; k < n; k++)
+                                I[lanes[k]] = 0xA0 + (vx[lanes[k]] & 0xF)*10;
+                            break;
+                        case 0x33:
+                            if(sharedI(lanes, 3)){
+                                uint16_t addr = I[lanes[0]];
+                                uint8_t* hundreds = &memory[addr*count];
+                                uint8_t* tens = &memory[(addr+1)*count];
+                                uint8_t* ones = &memory[(addr+2)*count];
+                                for(size_t k = 0; k < n; k++){
+                                    size_t l = lanes[k];
+                                    uint8_t v = vx[l];
+                                    hundreds[l] = v/100;
+                                    tens[l] = (v/10)%10;
+                                    ones[l] = v%10;
+                                }
+                                written.set(addr);
+                                written.set(addr+1);
+                                written.set(addr+2);
+                                break;
+                            }
+                            for(size_t k = 0; k < n; k++){
+                                size_t l = lanes[k];
+                                if(beyondMemory(l, 3))
+                                    continue;
+                                uint8_t v = vx[l];
+                                store(l, I[l], v/100);
+                                store(l, I[l]+1, (v/10)%10);
+                                store(l, I[l]+2, v%10);
+                            }
+                            break;
+                        case 0x55:
+                            if(sharedI(lanes, X+1)){
+                                uint16_t addr = I[lanes[0]];
+                                for(int i = 0; i <= X; i++){
+                                    uint8_t* row = &memory[(addr+i)*count];
+                                    const uint8_t* v = V(i);
+                                    for(size_t k = 0; k < n; k++)
+                                        row[lanes[k]] = v[lanes[k]];
+                                    written.set(addr+i);
+                                }
+                                advanceI<Q>(lanes, X);
+                                break;
+                            }
+                            for(size_t k = 0; k < n; k++){
+                                size_t l = lanes[k];
+                                if(beyondMemory(l, X+1))
+                                    continue;
+                                for(int i = 0; i <= X; i++)
+                                    store(l, I[l]+i, V(i)[l]);
+                                if(Q::memory == MEMORY_INCREMENT)
+                                    I[l] += X+1;
+                                else if(Q::memory == MEMORY_INCREMENT_X)
+                                    I[l] += X;
+                            }
+                            break;
+                        case 0x65:
+                            if(sharedI(lanes, X+1)){
+                                uint16_t addr = I[lanes[0]];
+                                for(int i = 0; i <= X; i++){
+                                    const uint8_t* row = &memory[(addr+i)*count];
+                                    uint8_t* v = V(i);
+                                    for(size_t k = 0; k < n; k++)
+                                        v[lanes[k]] = row[lanes[k]];
+                                }
+                                advanceI<Q>(lanes, X);
+                                break;
+                            }
+                            for(size_t k = 0; k < n; k++){
+                                size_t l = lanes[k];
+                                if(beyondMemory(l, X+1))
+                                    continue;
+                                for(int i = 0; i <= X; i++)
+                                    V(i)[l] = at(l, I[l]+i);
+                                if(Q::memory == MEMORY_INCREMENT)
+                                    I[l] += X+1;
+                                else if(Q::memory == MEMORY_INCREMENT_X)
+                                    I[l] += X;
+                            }
+                            break;
+                        //planes, audio and flag registers
+                        case 0x01: case 0x3A: case 0x75: case 0x85:
+                            halt(lanes);
+                            break;
+                    }
+            }
+        }
+
+        //every active lane takes its own copy of the shared PC
+        void split(){
+            for(uint32_t l : active)
+                PC[l] = sharedPC;
+            together = false;
+        }
+
+        //one instruction for lanes that may be anywhere: all of them at once if they fetched the
+        //same opcode, otherwise a group per opcode
+        template<class Q>
+        void stepApart(){
+            apartSteps++;
+            //a PC that leaves the 4KB stops its lane rather than wrapping
+            for(uint32_t l : active){
+                if(PC[l] >= WIDEMEMORY - 1){
+                    halted[l] = 1;
+                    removed = true;
+                }
+            }
+            if(removed)
+                dropHalted();
+            if(active.empty())
+                return;
+            for(uint32_t l : active)
+                opcodes[l] = at(l, PC[l]) << 8 | at(l, PC[l]+1);
+
+            uint16_t first = opcodes[active[0]];
+            bool same = true;
+            for(uint32_t l : active)
+                same &= opcodes[l] == first;
+
+            if(same){
+                for(uint32_t l : active)
+                    PC[l] += 2;
+                if(active.size() == count)
+                    execute<Q>(first, AllLanes{count});
+                else
+                    execute<Q>(first, LaneList{active.data(), active.size()});
+                groupsRun++;
+            }
+            else {
+                //the lanes sharing the first waiting lane's opcode run, the rest wait; lanes
+                //usually part two or three ways, past a few groups the rest are sorted instead
+                size_t waiting = active.size();
+                std::copy(active.begin(), active.end(), order.begin());
+                for(int pass = 0; waiting && pass < 4; pass++){
+                    uint16_t op = opcodes[order[0]];
+                    size_t matched = 0, left = 0;
+                    for(size_t k = 0; k < waiting; k++){
+                        uint32_t l = order[k];
+                        if(opcodes[l] == op)
+                            group[matched++] = l;
+                        else
+                            order[left++] = l;
+                    }
+                    runGroup<Q>(op, LaneList{group.data(), matched});
+                    waiting = left;
+                }
+                std::sort(order.begin(), order.begin() + waiting, [this](uint32_t a, uint32_t b){
+                    return opcodes[a] < opcodes[b];
+                });
+                for(size_t begin = 0, end; begin < waiting; begin = end){
+                    for(end = begin + 1; end < waiting && opcodes[order[end]] == opcodes[order[begin]]; end++)
+                        ;
+                    runGroup<Q>(opcodes[order[begin]], LaneList{&order[begin], end - begin});
+                }
+            }
+
+            if(removed)
+                dropHalted();
+            if(!active.empty())
+                rejoin();
+        }
+
+        //op for lanes that all fetched it
+        template<class Q>
+        void runGroup(uint16_t op, const LaneList& lanes){
+            for(size_t k = 0; k < lanes.size(); k++)
+                PC[lanes[k]] += 2;
+            execute<Q>(op, lanes);
+            groupsRun++;
+        }
+
+        //lanes that meet again go back to sharing one PC
+        void rejoin(){
+            uint16_t pc = PC[active[0]];
+            bool met = true;
+            for(uint32_t l : active)
+                met &= PC[l] == pc;
+            if(met){
+                together = true;
+                sharedPC = pc;
+            }
+        }
+
+        //op at sharedPC for every lane, giving each its own PC; for the instructions that may
+        //send lanes different ways, which go back to sharing if they don't
+        template<class Q>
+        void stepShared(uint16_t op){
+            for(uint32_t l : active)
+                PC[l] = sharedPC + 2;
+            together = false;
+            if(active.size() == count)
+                execute<Q>(op, AllLanes{count});
+            else
+                execute<Q>(op, LaneList{active.data(), active.size()});
+            if(removed)
+                dropHalted();
+            if(!active.empty())
+                rejoin();
+        }
+
+        //skips, which send the lanes two ways
+        static bool isSkip(uint16_t op){
+            switch(op >> 12){
+                case 0x3: case 0x4: case 0x9:
+                    return true;
+                case 0x5:
+                    return (op & 0xF) != 0x2 && (op & 0xF) != 0x3;
+                case 0xE:
+                    return (op & 0xFF) == 0x9E || (op & 0xFF) == 0xA1;
+            }
+            return false;
+        }
+
+        //lanes whose skip op is taken
+        template<class L>
+        size_t skipping(uint16_t op, const L& lanes){
+            const size_t n = lanes.size();
+            uint8_t NN = op & 0xFF;
+            uint8_t* vx = V(op >> 8 & 0xF);
+            uint8_t* vy = V(op >> 4 & 0xF);
+            size_t taken = 0;
+            switch(op >> 12){
+                case 0x3:
+                    for(size_t k = 0; k < n; k++)
+                        taken += vx[lanes[k]] == NN;
+                    break;
+                case 0x4:
+                    for(size_t k = 0; k < n; k++)
+                        taken += vx[lanes[k]] != NN;
+                    break;
+                case 0x5:
+                    for(size_t k = 0; k < n; k++)
+                        taken += vx[lanes[k]] == vy[lanes[k]];
+                    break;
+                case 0x9:
+                    for(size_t k = 0; k < n; k++)
+                        taken += vx[lanes[k]] != vy[lanes[k]];
+                    break;
+                default:
+                    for(size_t k = 0; k < n; k++)
+                        taken += isKeyDown(lanes[k], vx[lanes[k]]) == (NN == 0x9E);
+            }
+            return taken;
+        }
+
+        //the skip op at sharedPC if every lane goes the same way; false if they don't, or if the
+        //word skipped over may differ between lanes or lies past the 4KB
+        bool skipTogether(uint16_t op){
+            size_t taken = active.size() == count ? skipping(op, AllLanes{count})
+                : skipping(op, LaneList{active.data(), active.size()});
+            uint16_t next = sharedPC + 2;
+            if(!taken)
+                sharedPC = next;
+            else if(taken == active.size() && next < WIDEMEMORY - 1 && !written[next] && !written[next + 1]){
+                bool wide = memory[next*count] == 0xF0 && memory[(next + 1)*count] == 0x00;
+                sharedPC = next + (wide ? 4 : 2);
+            }
+            else
+                return false;
+            return true;
+        }
+
+        //00EE at sharedPC if every lane returns to the same address; false, with nothing done,
+        //if they don't
+        bool returnTogether(){
+            uint32_t first = active[0];
+            uint16_t to = stack[((SP[first] - 1) & 15)*count + first];
+            bool same = true;
+            for(uint32_t l : active)
+                same &= stack[((SP[l] - 1) & 15)*count + l] == to;
+            if(!same)
+                return false;
+            for(uint32_t l : active)
+                SP[l] = (SP[l] - 1) & 15;
+            sharedPC = to;
+            return true;
+        }
+
+        //sharedPC starts a delay timer spin, FX07, a test of VX and a jump back, and no lane
+        //leaves it this run: the timer only moves between runs, so budget steps end as
+        //Emulator::skipIdle leaves them, with VX loaded and the PC budget steps into the loop
+        bool timerIdle(uint16_t op, uint64_t budget){
+            uint16_t pc = sharedPC;
+            if((op & 0xF0FF) != 0xF007 || pc + 5 >= WIDEMEMORY)
+                return false;
+            for(uint16_t addr = pc + 2; addr < pc + 6; addr++){
+                if(written[addr])
+                    return false;
+            }
+            uint16_t test = memory[(pc + 2)*count] << 8 | memory[(pc + 3)*count];
+            uint16_t jump = memory[(pc + 4)*count] << 8 | memory[(pc + 5)*count];
+            if((test >> 12 != 0x3 && test >> 12 != 0x4) || (test & 0x0F00) != (op & 0x0F00) || jump != (0x1000 | pc))
+                return false;
+            uint8_t NN = test & 0xFF;
+            bool equal = test >> 12 == 0x4;
+            for(uint32_t l : active){
+                if((delay[l] == NN) != equal)
+                    return false;
+            }
+            uint8_t* vx = V(op >> 8 & 0xF);
+            for(uint32_t l : active)
+                vx[l] = delay[l];
+            sharedPC = pc + 2*(budget % 3);
+            return true;
+        }
+
+        void dropHalted(){
+            active.erase(std::remove_if(active.begin(), active.end(), [this](uint32_t l){
+                return halted[l] != 0;
+            }), active.end());
+            removed = false;
+        }
+
+        template<class Q>
+        static void runWith(WideEmulator& w, uint64_t steps){
+            for(uint64_t s = 0; s < steps && !w.active.empty(); s++){
+                if(w.together){
+                    uint16_t pc = w.sharedPC;
+                    //bytes no lane has stored to are the same in every lane, read lane 0's
+                    if(pc < WIDEMEMORY - 1 && !w.written[pc] && !w.written[pc + 1]){
+                        uint16_t op = w.memory[pc*w.count] << 8 | w.memory[(pc + 1)*w.count];
+                        if(op >> 12 == 0x1){
+                            w.sharedPC = op & 0xFFF;
+                            w.togetherSteps++;
+                            continue;
+                        }
+                        if(w.timerIdle(op, steps - s)){
+                            w.togetherSteps += steps - s;
+                            return;
+                        }
+                        if(op >> 12 == 0x2 || (lockstep(op) && !w.nearEnd(op))){
+                            w.sharedPC += 2;
+                            //calls still push per lane, the stack pointers can differ
+                            if(op >> 12 == 0x2){
+                                for(uint32_t l : w.active){
+                                    w.stack[w.SP[l]*w.count + l] = w.sharedPC;
+                                    w.SP[l] = (w.SP[l] + 1) & 15;
+                                }
+                                w.sharedPC = op & 0xFFF;
+                            }
+                            else if(w.active.size() == w.count)
+                                w.execute<Q>(op, AllLanes{w.count});
+                            else
+                                w.execute<Q>(op, LaneList{w.active.data(), w.active.size()});
+                            w.togetherSteps++;
+                            continue;
+                        }
+                        if((isSkip(op) && w.skipTogether(op)) || (op == 0x00EE && w.returnTogether())){
+                            w.togetherSteps++;
+                            continue;
+                        }
+                        //anything else still fetched once; returns, FX0A and skips the lanes
+                        //disagree on give them their own PCs until they meet again
+                        w.stepShared<Q>(op);
+                        w.togetherSteps++;
+                        //every lane still waiting on FX0A after a try waits the whole run
+                        if(w.together && w.sharedPC == pc && (op & 0xF0FF) == 0xF00A){
+                            w.togetherSteps += steps - s - 1;
+                            return;
+                        }
+                        continue;
+                    }
+                    w.split();
+                }
+                w.stepApart<Q>();
+            }
+        }
+
+    public:
+        WideEmulator(size_t lanes, Profile profile = PROFILE_CUSTOM):
+            count(lanes), registers(16*lanes), PC(lanes), I(lanes), SP(lanes), delay(lanes), sound(lanes),
+            keyWait(lanes), stack(16*lanes), rng(lanes), keys(lanes), keyPresses(lanes),
+            memory((size_t)WIDEMEMORY*lanes), screen(HEIGHT*lanes), halted(lanes), opcodes(lanes),
+            order(lanes), group(lanes){
+            switch(profile){
+                case PROFILE_VIP: runner = &runWith<QuirksVip>; break;
+                case PROFILE_CHIP48: runner = &runWith<QuirksChip48>; break;
+                case PROFILE_SUPERCHIP: runner = &runWith<QuirksSuperChip>; break;
+                case PROFILE_XOCHIP: runner = &runWith<QuirksXoChip>; break;
+                default: runner = &runWith<QuirksCustom>;
+            }
+            reset(Emulator::blankState(), std::vector<uint32_t>(lanes));
+        }
+
+        //every lane starts over from pristine (e.g. a RomImage) with its own seed, seeds[lane]
+        void reset(const MachineState& pristine, const std::vector<uint32_t>& seeds){
+            for(int addr = 0; addr < WIDEMEMORY; addr++)
+                memset(&memory[addr*count], pristine.memory[addr], count);
+            for(int r = 0; r < 16; r++)
+                memset(&registers[r*count], pristine.registers[r], count);
+            for(int s = 0; s < 16; s++)
+                std::fill(stack.begin() + s*count, stack.begin() + (s+1)*count, pristine.stack[s]);
+            for(int y = 0; y < HEIGHT; y++)
+                std::fill(screen.begin() + y*count, screen.begin() + (y+1)*count, pristine.screen.planes[0][0][y]);
+            std::fill(PC.begin(), PC.end(), pristine.PC);
+            std::fill(I.begin(), I.end(), pristine.I);
+            std::fill(SP.begin(), SP.end(), pristine.SP);
+            std::fill(delay.begin(), delay.end(), pristine.delay);
+            std::fill(sound.begin(), sound.end(), pristine.sound);
+            std::fill(keyWait.begin(), keyWait.end(), pristine.keyWait);
+            std::fill(keys.begin(), keys.end(), 0);
+            std::fill(keyPresses.begin(), keyPresses.end(), 0);
+            std::fill(halted.begin(), halted.end(), 0);
+            for(size_t l = 0; l < count; l++)
+                rng[l] = Emulator::seedRandom(l < seeds.size() ? seeds[l] : 0);
+
+            active.resize(count);
+            for(size_t l = 0; l < count; l++)
+                active[l] = l;
+            removed = false;
+            together = true;
+            sharedPC = pristine.PC;
+            written.reset();
+            togetherSteps = apartSteps = groupsRun = 0;
+        }
+
+        //every running lane executes steps instructions
+        void run(uint64_t steps){
+            runner(*this, steps);
+        }
+
+        void decrementTimers(){
+            for(size_t l = 0; l < count; l++){
+                delay[l] -= delay[l] > 0;
+                sound[l] -= sound[l] > 0;
+            }
+        }
+
+        //a key already held isn't a new press for FX0A
+        void pressKey(size_t lane, uint8_t key){
+            keyPresses[lane] |= (1 << (key & 0x0F)) & ~keys[lane];
+            keys[lane] |= 1 << (key & 0x0F);
+        }
+
+        void releaseKey(size_t lane, uint8_t key){
+            keys[lane] &= ~(1 << (key & 0x0F));
+        }
+
+        size_t lanes() const {
+            return count;
+        }
+
+        //lanes that haven't stopped
+        size_t running() const {
+            return active.size();
+        }
+
+        //lane stopped on an instruction that doesn't run wide, its PC points at it
+        bool stopped(size_t lane) const {
+            return halted[lane] != 0;
+        }
+
+        //copy lane's registers, timers, stack, screen and first 4KB of memory into out; the rest
+        //of out is left alone, so start it from the pristine state
+        void save(size_t lane, MachineState& out) const {
+            for(int r = 0; r < 16; r++)
+                out.registers[r] = registers[r*count + lane];
+            for(int s = 0; s < 16; s++)
+                out.stack[s] = stack[s*count + lane];
+            out.PC = together && !halted[lane] ? sharedPC : PC[lane];
+            out.I = I[lane];
+            out.SP = SP[lane];
+            out.delay = delay[lane];
+            out.sound = sound[lane];
+            out.keyWait = keyWait[lane];
+            out.rng = rng[lane];
+            for(int addr = 0; addr < WIDEMEMORY; addr++)
+                out.memory[addr] = memory[addr*count + lane];
+            display(lane, out.screen);
+        }
+
+        //lane's screen as a lo-res FrameBuffer
+        void display(size_t lane, FrameBuffer& out) const {
+            memset(out.planes, 0, sizeof(out.planes));
+            for(int y = 0; y < HEIGHT; y++)
+                out.planes[0][0][y] = screen[y*count + lane];
+            out.hires = false;
+        }
+
+        //steps run with every lane at one PC, steps run apart, and opcode groups those ran
+        uint64_t stepsTogether() const {
+            return togetherSteps;
+        }
+
+        uint64_t stepsApart() const {
+            return apartSteps;
+        }
+
+        uint64_t groups() const {
+            return groupsRun;
+        }
+};
+
+#endif
@@ -0,0 +1,174 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <random>
+#include <cstring>
+#include "wide.h"
+#include "romcache.h"
+#include "checkmain.h"
+using namespace std;
+
+const size_t LANES = 16;
+
+//random CHIP-8 program of count instructions at 0x200 between a call chain and a landing pad,
+//only opcodes the wide engine runs, with I often set near the end of the 4KB so memory
+//instructions reach past it, and some delay timer spins for the lanes to skip together
+vector<uint8_t> randomRom(mt19937& rng, int count){
+    auto nibble = [&](){ return (uint16_t)(rng() & 0xF); };
+    auto byte = [&](){ return (uint16_t)(rng() & 0xFF); };
+    auto target = [&](){ return (uint16_t)(0x200 + 2*(rng() % count)); };
+    vector<uint16_t> ops;
+    appendCallChain(ops);
+    for(int i = 16; i < count - 1; i++){
+        uint16_t X = nibble(), Y = nibble(), NN = byte();
+        uint16_t op;
+        switch(rng() % 27){
+            case 0: op = 0x00E0; break;
+            case 1: op = 0x00EE; break;
+            case 2: op = 0x1000 | target(); break;
+            case 3: op = 0x2000 | target(); break;
+            case 4: op = 0x3000 | X << 8 | NN; break;
+            case 5: op = 0x4000 | X << 8 | NN; break;
+            case 6: op = 0x5000 | X << 8 | Y << 4; break;
+            case 7: case 8: op = 0x6000 | X << 8 | NN; break;
+            case 9: op = 0x7000 | X << 8 | NN; break;
+            case 10: case 11: {
+                static const uint16_t alu[] = {0, 1, 2, 3, 4, 5, 6, 7, 0xE};
+                op = 0x8000 | X << 8 | Y << 4 | alu[rng() % 9];
+                break;
+            }
+            case 12: op = 0x9000 | X << 8 | Y << 4; break;
+            case 13: op = 0xA000 | (0x200 + 2*count + 0x100 + rng() % 0x400); break;
+            case 14: op = 0xA000 | (0x1000 - 1 - rng() % 16); break;
+            case 15: op = 0xB000 | target(); break;
+            case 16: op = 0xC000 | X << 8 | NN; break;
+            case 17: case 18: op = 0xD000 | X << 8 | Y << 4 | (1 + rng() % 15); break;
+            case 19: op = (rng() & 1 ? 0xE09E : 0xE0A1) | X << 8; break;
+            case 20: {
+                static const uint16_t timers[] = {0x07, 0x0A, 0x15, 0x18, 0x29};
+                op = 0xF000 | X << 8 | timers[rng() % 5];
+                break;
+            }
+            case 21: op = 0xF01E | X << 8; break;
+            //FX07, a test of VX against a small value and a jump back to the FX07
+            case 26:
+                if(i + 3 < count - 1){
+                    ops.push_back(0xF007 | X << 8);
+                    ops.push_back((rng() & 1 ? 0x3000 : 0x4000) | X << 8 | (rng() % 3));
+                    op = 0x1000 | (0x200 + 2*(ops.size() - 2));
+                    i += 2;
+                    break;
+                }
+                //fall through
+            case 22: op = 0xF033 | X << 8; break;
+            case 23: op = 0xF055 | X << 8; break;
+            default: op = 0xF065 | X << 8; break;
+        }
+        ops.push_back(op);
+    }
+    ops.push_back(0x1200);
+    vector<uint8_t> bytes = romBytes(ops);
+    appendLandingPad(bytes);
+    return bytes;
+}
+
+//usage: chip8_widecheck [--roms N] [--frames N] [--seed N]
+//runs random programs on LANES lanes of a WideEmulator and on as many separate Emulators, with
+//random key presses, under every quirk profile; after each frame every lane's state must match
+//its Emulator's, and a lane that stops must match its Emulator at the instruction it stopped on,
+//on the programs stepped one instruction at a time
+int main(int argc, char* argv[]){
+    CheckOptions options{100, 100};
+    if(!parseCheckOptions(argc, argv, options))
+        return 1;
+    uint32_t roms = options.roms, frames = options.frames, seed = options.seed;
+
+    silenceEngineErrors();
+
+    const uint64_t perFrame = INSTFREQ/TIMERFREQ;
+    unique_ptr<MachineState> a(new MachineState), b(new MachineState);
+    uint32_t failed = 0;
+    for(int p = PROFILE_CUSTOM; p <= PROFILE_XOCHIP; p++){
+        Profile profile = (Profile)p;
+        mt19937 rng(seed);
+        uint32_t diverged = 0, stopped = 0;
+        for(uint32_t r = 0; r < roms; r++){
+            vector<uint8_t> rom = randomRom(rng, 128);
+            shared_ptr<RomImage> image = RomImage::fromBytes(rom.data(), rom.size());
+            vector<uint32_t> seeds(LANES);
+            for(uint32_t& s : seeds)
+                s = rng();
+            WideEmulator wide(LANES, profile);
+            wide.reset(image->pristine(), seeds);
+            vector<unique_ptr<Emulator>> emus;
+            for(size_t l = 0; l < LANES; l++){
+                emus.emplace_back(new Emulator(seeds[l], profile));
+                emus.back()->reset(image->pristine(), seeds[l]);
+            }
+
+            vector<bool> done(LANES);
+            for(uint32_t f = 0; f < frames && !all_of(done.begin(), done.end(), [](bool d){ return d; }); f++){
+                for(size_t l = 0; l < LANES; l++){
+                    uint8_t key = rng() & 0xF;
+                    if(rng() & 1){
+                        wide.pressKey(l, key);
+                        emus[l]->pressKey(key);
+                    }
+                    else {
+                        wide.releaseKey(l, key);
+                        emus[l]->releaseKey(key);
+                    }
+                }
+                //step the lanes one at a time so a lane that stops is compared where it stopped;
+                //every other program runs whole frames, as the timer spins are skipped, and ends
+                //uncompared when a lane stops somewhere in one
+                vector<uint64_t> steps(LANES, perFrame);
+                if(r % 2){
+                    wide.run(perFrame);
+                    if(wide.running() < LANES){
+                        stopped += LANES - wide.running();
+                        break;
+                    }
+                }
+                for(uint64_t s = 0; s < perFrame && r % 2 == 0; s++){
+                    wide.run(1);
+                    for(size_t l = 0; l < LANES; l++){
+                        if(!done[l] && wide.stopped(l) && steps[l] == perFrame)
+                            steps[l] = s;
+                    }
+                }
+                wide.decrementTimers();
+                for(size_t l = 0; l < LANES; l++){
+                    if(done[l])
+                        continue;
+                    emus[l]->run(steps[l]);
+                    emus[l]->decrementTimers();
+                    emus[l]->save(*a);
+                    memcpy(b.get(), &image->pristine(), sizeof(MachineState));
+                    wide.save(l, *b);
+                    //the wide engine keeps no planes, pitch, audio or flags, which these programs never change
+                    if(memcmp(a->registers, b->registers, sizeof(a->registers)) || a->PC != b->PC || a->I != b->I
+                        || a->SP != b->SP || a->delay != b->delay || a->sound != b->sound || a->keyWait != b->keyWait
+                        || a->rng != b->rng || memcmp(a->stack, b->stack, sizeof(a->stack))
+                        || memcmp(a->memory, b->memory, sizeof(a->memory))
+                        || memcmp(a->screen.planes[0], b->screen.planes[0], sizeof(a->screen.planes[0]))){
+                        cout << PROFILENAMES[p] << " rom " << r << " lane " << l << " differs after frame " << f << hex
+                             << ": PC " << a->PC << "/" << b->PC << ", I " << a->I << "/" << b->I << dec << endl;
+                        diverged++;
+                        fill(done.begin(), done.end(), true);
+                        break;
+                    }
+                    if(wide.stopped(l)){
+                        stopped++;
+                        done[l] = true;
+                    }
+                }
+            }
+        }
+        cout << PROFILENAMES[p] << ": " << roms << " programs on " << LANES << " lanes, " << stopped
+             << " lanes stopped, " << diverged << " diverged" << endl;
+        failed += diverged;
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,68 @@
+#ifndef XORDELTA_H
+#define XORDELTA_H
+
+#include <cstdint>
+#include <cstring>
+
+//delta codec shared by rewind history and frame captures: state XOR base, run-length encoded as
+//(zero run, literal length, literal bytes) triples with varint lengths
+
+//encode state XOR base into out, which must hold 2*size + 16 bytes; returns the encoded length
+inline size_t encodeXorDelta(const uint8_t* state, const uint8_t* base, size_t size, uint8_t* out){
+    auto putVarint = [](uint8_t*& at, size_t value){
+        while(value >= 0x80){
+            *at++ = (uint8_t)(value | 0x80);
+            value >>= 7;
+        }
+        *at++ = (uint8_t)value;
+    };
+    uint8_t* at = out;
+    size_t i = 0;
+    while(i < size){
+        //unchanged runs are skipped a word at a time
+        size_t zeros = i;
+        uint64_t x, y;
+        while(zeros + 8 <= size && (memcpy(&x, state + zeros, 8), memcpy(&y, base + zeros, 8), x == y))
+            zeros += 8;
+        while(zeros < size && state[zeros] == base[zeros])
+            zeros++;
+        size_t literal = zeros;
+        //end a literal run only at two matching bytes in a row, so single matches don't split it
+        while(literal < size && (state[literal] != base[literal]
+            || (literal+1 < size && state[literal+1] != base[literal+1])))
+            literal++;
+        putVarint(at, zeros - i);
+        putVarint(at, literal - zeros);
+        for(size_t j = zeros; j < literal; j++)
+            *at++ = state[j] ^ base[j];
+        i = literal;
+    }
+    return at - out;
+}
+
+//apply an encoded delta of length bytes to state in place, false if it is malformed
+inline bool decodeXorDelta(const uint8_t* in, size_t length, uint8_t* state, size_t size){
+    const uint8_t* end = in + length;
+    auto getVarint = [&](size_t& value){
+        value = 0;
+        for(int shift = 0; in < end && shift < 64; shift += 7){
+            uint8_t byte = *in++;
+            value |= (size_t)(byte & 0x7F) << shift;
+            if(!(byte & 0x80))
+                return true;
+        }
+        return false;
+    };
+    size_t i = 0;
+    while(in < end){
+        size_t zeros, literal;
+        if(!getVarint(zeros) || !getVarint(literal) || zeros + literal > size - i || literal > (size_t)(end - in))
+            return false;
+        i += zeros;
+        for(size_t j = 0; j < literal; j++)
+            state[i++] ^= *in++;
+    }
+    return true;
+}
+
+#endif